@@ -0,0 +1,22 @@
+# Build the Python bindings with 'python setup.py build_ext --inplace'
+# or install them with 'pip install .' from this directory.
+from setuptools import setup, Extension
+
+SOURCES = ['starcode.c', 'trie.c', 'trace.c', 'metrics.c', 'compress.c',
+           'bam.c', 'long.c']
+
+setup(
+   name='starcode',
+   version='1.0',
+   description='Sequence clustering based on all-pairs search',
+   ext_modules=[
+      Extension(
+         'starcode',
+         sources=['starcodemodule.c'] + ['../src/' + f for f in SOURCES],
+         include_dirs=['../src'],
+         libraries=['pthread', 'z', 'm'],
+         # 'TOWER_TOP' is a tentative definition in 'trie.h'.
+         extra_compile_args=['-std=gnu99', '-fcommon'],
+      )
+   ],
+)
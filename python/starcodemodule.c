@@ -0,0 +1,237 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+// Python bindings of 'starcode_cluster()'. The sequences and the counts
+// are read in place from any object with the buffer protocol (numpy
+// arrays, bytes, array.array...) and the results are returned as int
+// memoryviews (numpy.asarray() does not copy them). The GIL is released
+// during the clustering.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+#include "starcode.h"
+
+// The clustering options are shared by the process (see
+// 'starcode_cluster()'), so the calls are serialized.
+static PyThread_type_lock LOCK = NULL;
+
+
+static PyObject *
+int_array
+(
+   PyObject * bytes
+)
+// SYNOPSIS:
+//   Return a memoryview of C ints over 'bytes' (a bytearray).
+{
+   PyObject *view = PyMemoryView_FromObject(bytes);
+   Py_DECREF(bytes);
+   if (view == NULL) return NULL;
+   PyObject *ints = PyObject_CallMethod(view, "cast", "s", "i");
+   Py_DECREF(view);
+   return ints;
+}
+
+
+static PyObject *
+cluster
+(
+   PyObject * self,
+   PyObject * args,
+   PyObject * kwargs
+)
+{
+
+   static char *kwlist[] = {"seqs", "counts", "dist", "threads",
+      "algorithm", "ratio", "width", NULL};
+   PyObject *seqsobj = NULL;
+   PyObject *countsobj = Py_None;
+   int dist = -1;
+   int threads = 1;
+   const char *algorithm = "mp";
+   int ratio = 5;
+   Py_ssize_t width = 0;
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Oiisin", kwlist,
+            &seqsobj, &countsobj, &dist, &threads, &algorithm, &ratio,
+            &width)) {
+      return NULL;
+   }
+
+   int clusteralg;
+   if (strcmp(algorithm, "mp") == 0) clusteralg = MP_CLUSTER;
+   else if (strcmp(algorithm, "spheres") == 0) clusteralg = SPHERES_CLUSTER;
+   else if (strcmp(algorithm, "components") == 0) {
+      clusteralg = COMPONENTS_CLUSTER;
+   }
+   else {
+      PyErr_SetString(PyExc_ValueError,
+            "algorithm must be 'mp', 'spheres' or 'components'");
+      return NULL;
+   }
+   if (dist > STARCODE_MAX_TAU || threads < 1 || ratio < 1 || width < 0) {
+      PyErr_Format(PyExc_ValueError, "dist must be at most %d, "
+            "threads and ratio at least 1", STARCODE_MAX_TAU);
+      return NULL;
+   }
+
+   // The sequences are the items of the buffer (e.g. a numpy array of
+   // type 'S'), or consecutive records of 'width' bytes.
+   Py_buffer seqs;
+   if (PyObject_GetBuffer(seqsobj, &seqs, PyBUF_C_CONTIGUOUS|PyBUF_FORMAT)) {
+      return NULL;
+   }
+   const char *fmt = seqs.format == NULL ? "B" : seqs.format;
+   const char type = fmt[strlen(fmt)-1];
+   if (width == 0 && type == 's') width = seqs.itemsize;
+   if (width == 0 || strchr("sBbc", type) == NULL ||
+         (type == 's' && width != seqs.itemsize) || seqs.len % width) {
+      PyErr_SetString(PyExc_ValueError, "seqs must be an array of "
+            "fixed-width strings, or bytes with a 'width'");
+      PyBuffer_Release(&seqs);
+      return NULL;
+   }
+   Py_ssize_t nseq = seqs.len / width;
+   if (nseq > INT_MAX) {
+      PyErr_SetString(PyExc_ValueError, "too many sequences");
+      PyBuffer_Release(&seqs);
+      return NULL;
+   }
+
+   Py_buffer counts = {0};
+   if (countsobj != Py_None) {
+      if (PyObject_GetBuffer(countsobj, &counts,
+               PyBUF_C_CONTIGUOUS|PyBUF_FORMAT)) {
+         PyBuffer_Release(&seqs);
+         return NULL;
+      }
+      fmt = counts.format == NULL ? "B" : counts.format;
+      if (strchr("il", fmt[strlen(fmt)-1]) == NULL ||
+            counts.itemsize != sizeof(int) ||
+            counts.len != nseq * (Py_ssize_t) sizeof(int)) {
+         PyErr_SetString(PyExc_ValueError, "counts must be an array "
+               "of 32-bit integers with one count per sequence");
+         PyBuffer_Release(&counts);
+         PyBuffer_Release(&seqs);
+         return NULL;
+      }
+   }
+
+   // The results are written in place.
+   const Py_ssize_t size = nseq * sizeof(int);
+   PyObject *clusters = PyByteArray_FromStringAndSize(NULL, size);
+   PyObject *canonicals = PyByteArray_FromStringAndSize(NULL, size);
+   PyObject *sizes = PyByteArray_FromStringAndSize(NULL, size);
+   int ncl = -1;
+   if (clusters != NULL && canonicals != NULL && sizes != NULL) {
+      Py_BEGIN_ALLOW_THREADS
+      PyThread_acquire_lock(LOCK, WAIT_LOCK);
+      ncl = starcode_cluster(
+            seqs.buf,
+            width,
+            countsobj == Py_None ? NULL : counts.buf,
+            nseq,
+            dist,
+            threads,
+            clusteralg,
+            ratio,
+            (int *) PyByteArray_AS_STRING(clusters),
+            (int *) PyByteArray_AS_STRING(canonicals),
+            (int *) PyByteArray_AS_STRING(sizes)
+      );
+      PyThread_release_lock(LOCK);
+      Py_END_ALLOW_THREADS
+   }
+   if (countsobj != Py_None) PyBuffer_Release(&counts);
+   PyBuffer_Release(&seqs);
+
+   if (ncl < 0) {
+      if (!PyErr_Occurred()) {
+         PyErr_SetString(PyExc_ValueError, "invalid sequence or count "
+               "(see standard error)");
+      }
+      Py_XDECREF(clusters);
+      Py_XDECREF(canonicals);
+      Py_XDECREF(sizes);
+      return NULL;
+   }
+   if (PyByteArray_Resize(canonicals, ncl * sizeof(int)) ||
+         PyByteArray_Resize(sizes, ncl * sizeof(int))) {
+      Py_DECREF(clusters);
+      Py_DECREF(canonicals);
+      Py_DECREF(sizes);
+      return NULL;
+   }
+
+   canonicals = int_array(canonicals);
+   sizes = int_array(sizes);
+   clusters = int_array(clusters);
+   if (canonicals == NULL || sizes == NULL || clusters == NULL) {
+      Py_XDECREF(clusters);
+      Py_XDECREF(canonicals);
+      Py_XDECREF(sizes);
+      return NULL;
+   }
+   return Py_BuildValue("(NNN)", canonicals, sizes, clusters);
+
+}
+
+
+static PyMethodDef starcode_methods[] = {
+   {"cluster", (PyCFunction)(void(*)(void)) cluster,
+      METH_VARARGS | METH_KEYWORDS,
+      "cluster(seqs, counts=None, dist=-1, threads=1, algorithm='mp',\n"
+      "        ratio=5, width=0)\n"
+      "--\n\n"
+      "Cluster the sequences of 'seqs' (an array of fixed-width strings\n"
+      "such as a numpy array of type 'S', or bytes of records of 'width'\n"
+      "bytes) with optional 32-bit 'counts'. 'dist' is the maximum\n"
+      "Levenshtein distance (-1 for auto) and 'algorithm' one of 'mp',\n"
+      "'spheres' and 'components'.\n\n"
+      "Return (canonicals, sizes, clusters) as int memoryviews: the index\n"
+      "of the canonical sequence and the count of every cluster, sorted\n"
+      "by decreasing count, and the cluster of every sequence (-1 if it\n"
+      "is not assigned)."},
+   {NULL, NULL, 0, NULL}
+};
+
+
+static struct PyModuleDef starcode_module = {
+   PyModuleDef_HEAD_INIT,
+   "starcode",
+   "Sequence clustering based on all-pairs search.",
+   -1,
+   starcode_methods,
+};
+
+
+PyMODINIT_FUNC
+PyInit_starcode
+(void)
+{
+   if (LOCK == NULL && (LOCK = PyThread_allocate_lock()) == NULL) {
+      return PyErr_NoMemory();
+   }
+   return PyModule_Create(&starcode_module);
+}
@@ -0,0 +1,59 @@
+# Tests of the Python bindings, run with 'python test_starcode.py'
+# after 'python setup.py build_ext --inplace'.
+import array
+import threading
+import unittest
+
+import starcode
+
+
+SEQS = [b'ACGTACGTAC', b'ACGTACGTAA', b'acgtacgtac', b'TTTTTTTTTT', b'TTTTTTTTTA']
+COUNTS = [10, 1, 2, 3, 3]
+
+
+class TestCluster(unittest.TestCase):
+
+   def test_bytes(self):
+      buf = b''.join(SEQS)
+      counts = array.array('i', COUNTS)
+      canonicals, sizes, clusters = starcode.cluster(buf, counts,
+            dist=1, width=10)
+      self.assertEqual(list(canonicals), [0, 4, 3])
+      self.assertEqual(list(sizes), [13, 3, 3])
+      self.assertEqual(list(clusters), [0, 0, 0, 2, 1])
+      self.assertEqual(clusters.format, 'i')
+
+   def test_algorithms(self):
+      buf = b''.join(s.ljust(12, b'\0') for s in SEQS)
+      counts = array.array('i', COUNTS)
+      for algorithm in ('spheres', 'components'):
+         canonicals, sizes, clusters = starcode.cluster(buf, counts,
+               dist=1, width=12, algorithm=algorithm)
+         self.assertEqual(list(sizes), [13, 6])
+         self.assertEqual(list(clusters), [0, 0, 0, 1, 1])
+
+   def test_errors(self):
+      with self.assertRaises(ValueError):
+         starcode.cluster(b'ACGX', width=4)
+      with self.assertRaises(ValueError):
+         starcode.cluster(b'ACGTAC', width=4)
+      with self.assertRaises(ValueError):
+         starcode.cluster(b'ACGT', width=4, algorithm='other')
+      with self.assertRaises(ValueError):
+         starcode.cluster(b''.join(SEQS), array.array('i', [1]), width=10)
+
+   def test_threads(self):
+      # The calls release the GIL and can be made from several threads.
+      buf = b''.join(SEQS)
+      results = []
+      def run():
+         results.append(list(starcode.cluster(buf, dist=1, width=10)[2]))
+      threads = [threading.Thread(target=run) for _ in range(4)]
+      for t in threads: t.start()
+      for t in threads: t.join()
+      self.assertEqual(len(results), 4)
+      self.assertTrue(all(r == results[0] for r in results))
+
+
+if __name__ == '__main__':
+   unittest.main()
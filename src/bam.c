@@ -0,0 +1,463 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "bam.h"
+
+#define BGZF_BLOCK_SIZE   65536     // Max size of a block (both ways).
+#define BGZF_HEADER_SIZE  18        // Header with the 'BC' subfield.
+#define BGZF_BATCH        256       // Blocks decompressed per batch.
+
+#define QUAL_DEFAULT      '"'       // Phred 1, as 'samtools fastq'.
+
+typedef struct inflargs_t inflargs_t;
+
+struct bam_t {
+   FILE     * inputf;
+   int        nthreads;
+   int        eof;                  // No more blocks in 'inputf'.
+   int        failed;               // Error (already reported).
+   // Compressed blocks of the current batch.
+   int        nblocks;
+   uint8_t  * cdata;
+   size_t     coff[BGZF_BATCH+1];   // Offsets of the blocks in 'cdata'.
+   size_t     doff[BGZF_BATCH+1];   // Offsets of the output in 'data'.
+   uint32_t   crc[BGZF_BATCH];
+   // Decompressed stream ('pos' to 'end' is not consumed yet).
+   uint8_t  * data;
+   size_t     size;
+   size_t     pos;
+   size_t     end;
+   // Decoded record.
+   char     * name;
+   char     * seq;
+   char     * qual;
+   size_t     reclen;
+};
+
+struct inflargs_t {
+   bam_t    * bam;
+   int        first;
+   int        step;
+   int        failed;
+};
+
+static const char NT16[17] = "=ACMGRSVTWYHKDBN";
+// Complement of the 16 codes above (ambiguity codes included).
+static const char COMP16[17] = "=TGKCYSBAWRDMHVN";
+
+
+static uint32_t
+le32
+(
+   const uint8_t * p
+)
+{
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+static uint16_t
+le16
+(
+   const uint8_t * p
+)
+{
+   return p[0] | (p[1] << 8);
+}
+
+
+static int
+read_blocks
+(
+   bam_t * bam
+)
+// SYNOPSIS:
+//   Read the next batch of (up to 'BGZF_BATCH') compressed blocks and
+//   set the offsets of their output in 'bam->data', after the bytes
+//   that are not consumed yet (which are moved to the front).
+//
+// RETURN:
+//   The number of blocks read, or -1 in case of error.
+{
+
+   memmove(bam->data, bam->data + bam->pos, bam->end - bam->pos);
+   bam->end -= bam->pos;
+   bam->pos = 0;
+
+   bam->nblocks = 0;
+   bam->coff[0] = 0;
+   bam->doff[0] = bam->end;
+
+   while (!bam->eof && bam->nblocks < BGZF_BATCH) {
+      uint8_t *block = bam->cdata + bam->coff[bam->nblocks];
+      size_t nread = fread(block, 1, BGZF_HEADER_SIZE, bam->inputf);
+      if (nread == 0) {
+         bam->eof = 1;
+         break;
+      }
+      // Check the gzip header and the 'BC' subfield that holds
+      // the size of the block (this is what makes BGZF).
+      if (nread != BGZF_HEADER_SIZE || block[0] != 31 || block[1] != 139) {
+         fprintf(stderr, "error: input is not BGZF compressed\n");
+         return -1;
+      }
+      if (block[2] != 8 || block[3] != 4 || le16(block+10) != 6 ||
+            block[12] != 'B' || block[13] != 'C' || le16(block+14) != 2) {
+         fprintf(stderr, "error: gzip input is not BGZF "
+               "(only BAM files are supported)\n");
+         return -1;
+      }
+      size_t bsize = le16(block+16) + 1;
+      if (bsize < BGZF_HEADER_SIZE + 8) {
+         fprintf(stderr, "error: corrupt BGZF block\n");
+         return -1;
+      }
+      size_t rest = bsize - BGZF_HEADER_SIZE;
+      if (fread(block + BGZF_HEADER_SIZE, 1, rest, bam->inputf) != rest) {
+         fprintf(stderr, "error: truncated BGZF block\n");
+         return -1;
+      }
+      uint32_t isize = le32(block + bsize - 4);
+      if (isize > BGZF_BLOCK_SIZE) {
+         fprintf(stderr, "error: corrupt BGZF block\n");
+         return -1;
+      }
+      bam->crc[bam->nblocks] = le32(block + bsize - 8);
+      bam->nblocks++;
+      bam->coff[bam->nblocks] = bam->coff[bam->nblocks-1] + bsize;
+      bam->doff[bam->nblocks] = bam->doff[bam->nblocks-1] + isize;
+   }
+
+   return bam->nblocks;
+
+}
+
+
+static int
+inflate_block
+(
+   bam_t * bam,
+   int     i
+)
+// SYNOPSIS:
+//   Decompress block 'i' of the current batch to its place in
+//   'bam->data' and check its CRC. Return 0 on success.
+{
+
+   const uint8_t *block = bam->cdata + bam->coff[i];
+   const size_t bsize = bam->coff[i+1] - bam->coff[i];
+   const size_t isize = bam->doff[i+1] - bam->doff[i];
+
+   z_stream zs = {0};
+   if (inflateInit2(&zs, -15) != Z_OK) return 1;
+   zs.next_in = (uint8_t *) block + BGZF_HEADER_SIZE;
+   zs.avail_in = bsize - BGZF_HEADER_SIZE - 8;
+   zs.next_out = bam->data + bam->doff[i];
+   zs.avail_out = isize;
+   int status = inflate(&zs, Z_FINISH);
+   inflateEnd(&zs);
+   if (status != Z_STREAM_END || zs.total_out != isize) return 1;
+
+   uint32_t crc = crc32(crc32(0L, Z_NULL, 0), bam->data + bam->doff[i],
+         isize);
+   return crc != bam->crc[i];
+
+}
+
+
+static void *
+inflate_worker
+(
+   void * args
+)
+// SYNOPSIS:
+//   Thread function that decompresses every 'step'-th block of
+//   the batch, starting from 'first'.
+{
+
+   inflargs_t *inflargs = (inflargs_t *) args;
+   bam_t *bam = inflargs->bam;
+   for (int i = inflargs->first ; i < bam->nblocks ; i += inflargs->step) {
+      if (inflate_block(bam, i)) {
+         inflargs->failed = 1;
+         break;
+      }
+   }
+   return NULL;
+
+}
+
+
+static int
+refill
+(
+   bam_t * bam
+)
+// SYNOPSIS:
+//   Read and decompress the next batch of blocks. The blocks are
+//   independent so they are decompressed in parallel. Return 0 on
+//   success, 1 at the end of the file and -1 in case of error.
+{
+
+   int nblocks = read_blocks(bam);
+   if (nblocks < 0) {
+      bam->failed = 1;
+      return -1;
+   }
+   if (nblocks == 0) return 1;
+
+   // Make room for the decompressed batch.
+   size_t needed = bam->doff[nblocks];
+   if (needed > bam->size) {
+      uint8_t *data = realloc(bam->data, needed);
+      if (data == NULL) {
+         fprintf(stderr, "error: could not allocate BAM buffer\n");
+         bam->failed = 1;
+         return -1;
+      }
+      bam->data = data;
+      bam->size = needed;
+   }
+
+   int nthreads = bam->nthreads < nblocks ? bam->nthreads : nblocks;
+   inflargs_t args[nthreads];
+   pthread_t threads[nthreads];
+   for (int t = 0 ; t < nthreads ; t++) {
+      args[t] = (inflargs_t) { .bam = bam, .first = t, .step = nthreads };
+   }
+   // The first share (and those of the threads that could
+   // not be created) is decompressed by the calling thread.
+   int created[nthreads];
+   for (int t = 1 ; t < nthreads ; t++) {
+      created[t] = !pthread_create(threads+t, NULL, inflate_worker, args+t);
+   }
+   inflate_worker(args);
+   int failed = args[0].failed;
+   for (int t = 1 ; t < nthreads ; t++) {
+      if (created[t]) pthread_join(threads[t], NULL);
+      else            inflate_worker(args+t);
+      failed |= args[t].failed;
+   }
+   if (failed) {
+      fprintf(stderr, "error: corrupt BGZF block\n");
+      bam->failed = 1;
+      return -1;
+   }
+
+   bam->end = needed;
+   return 0;
+
+}
+
+
+static const uint8_t *
+fetch
+(
+   bam_t  * bam,
+   size_t   n
+)
+// SYNOPSIS:
+//   Consume 'n' bytes of the decompressed stream and return a pointer
+//   to them. The bytes are contiguous and the pointer is valid until
+//   the next call. Return NULL if the stream ends before 'n' bytes
+//   ('bam->pos' is then unchanged) or in case of error.
+{
+
+   while (bam->end - bam->pos < n) {
+      if (refill(bam)) return NULL;
+   }
+   const uint8_t *p = bam->data + bam->pos;
+   bam->pos += n;
+   return p;
+
+}
+
+
+bam_t *
+bam_open
+(
+   FILE * inputf,
+   int    nthreads
+)
+// SYNOPSIS:
+//   Open a BAM file and skip its header. Return NULL in case of error.
+{
+
+   bam_t *bam = calloc(1, sizeof(bam_t));
+   if (bam == NULL) {
+      fprintf(stderr, "error: could not create BAM reader\n");
+      return NULL;
+   }
+   bam->inputf = inputf;
+   bam->nthreads = nthreads > 0 ? nthreads : 1;
+   bam->cdata = malloc(BGZF_BATCH * BGZF_BLOCK_SIZE);
+   if (bam->cdata == NULL) {
+      fprintf(stderr, "error: could not allocate BAM buffer\n");
+      bam_close(bam);
+      return NULL;
+   }
+
+   const uint8_t *p = fetch(bam, 4);
+   if (p == NULL || memcmp(p, "BAM\1", 4) != 0) {
+      if (!bam->failed) {
+         fprintf(stderr, "error: BGZF input is not a BAM file\n");
+      }
+      bam_close(bam);
+      return NULL;
+   }
+
+   // Skip the text header and the references.
+   uint32_t nref = 0;
+   if ((p = fetch(bam, 4)) == NULL || fetch(bam, le32(p)) == NULL ||
+         (p = fetch(bam, 4)) == NULL) goto truncated;
+   nref = le32(p);
+   for (uint32_t i = 0 ; i < nref ; i++) {
+      if ((p = fetch(bam, 4)) == NULL || fetch(bam, le32(p) + 4) == NULL)
+         goto truncated;
+   }
+
+   return bam;
+
+truncated:
+   if (!bam->failed) fprintf(stderr, "error: truncated BAM header\n");
+   bam_close(bam);
+   return NULL;
+
+}
+
+
+int
+bam_next
+(
+   bam_t    * bam,
+   bamrec_t * rec
+)
+// SYNOPSIS:
+//   Decode the next primary record into 'rec'. The strings belong to
+//   the reader and are overwritten by the next call.
+//
+// RETURN:
+//   1 if a record was read, 0 at the end of the file, -1 on error.
+{
+
+   while (1) {
+
+      const uint8_t *p = fetch(bam, 4);
+      if (p == NULL) {
+         // Clean end only if no byte is left over.
+         if (!bam->failed && bam->pos == bam->end) return 0;
+         if (!bam->failed) fprintf(stderr, "error: truncated BAM record\n");
+         return -1;
+      }
+      uint32_t size = le32(p);
+      if (size < 32 || (p = fetch(bam, size)) == NULL) {
+         if (!bam->failed) fprintf(stderr, "error: truncated BAM record\n");
+         return -1;
+      }
+
+      int      lname  = p[8];
+      int      ncigar = le16(p+12);
+      int      flag   = le16(p+14);
+      uint32_t lseq   = le32(p+16);
+      const uint8_t *name = p + 32;
+      const uint8_t *seq  = name + lname + 4*ncigar;
+      const uint8_t *qual = seq + (lseq+1) / 2;
+      if (lname < 1 || qual + lseq > p + size) {
+         fprintf(stderr, "error: corrupt BAM record\n");
+         return -1;
+      }
+
+      if (flag & (BAM_FSECONDARY | BAM_FSUPPLEMENT)) continue;
+
+      if (lseq + 1 > bam->reclen || (size_t) lname > bam->reclen) {
+         uint32_t longest = lseq > (uint32_t) lname ? lseq : (uint32_t) lname;
+         size_t len = 2 * (size_t) longest + 1;
+         char *buf1 = realloc(bam->name, len);
+         if (buf1 != NULL) bam->name = buf1;
+         char *buf2 = realloc(bam->seq, len);
+         if (buf2 != NULL) bam->seq = buf2;
+         char *buf3 = realloc(bam->qual, len);
+         if (buf3 != NULL) bam->qual = buf3;
+         if (buf1 == NULL || buf2 == NULL || buf3 == NULL) {
+            fprintf(stderr, "error: could not allocate BAM record\n");
+            return -1;
+         }
+         bam->reclen = len;
+      }
+
+      memcpy(bam->name, name, lname);
+      bam->name[lname-1] = '\0';
+
+      // Sequence is 4-bit packed, high nibble first. Quality
+      // is raw Phred, or 0xff for all bases if absent.
+      const int missing = lseq > 0 && qual[0] == 0xff;
+      if (flag & BAM_FREVERSE) {
+         for (uint32_t i = 0 ; i < lseq ; i++) {
+            uint32_t j = lseq-1 - i;
+            int code = (seq[j/2] >> (j % 2 ? 0 : 4)) & 0xf;
+            bam->seq[i] = COMP16[code];
+            bam->qual[i] = missing ? QUAL_DEFAULT : qual[j] + 33;
+         }
+      }
+      else {
+         for (uint32_t i = 0 ; i < lseq ; i++) {
+            int code = (seq[i/2] >> (i % 2 ? 0 : 4)) & 0xf;
+            bam->seq[i] = NT16[code];
+            bam->qual[i] = missing ? QUAL_DEFAULT : qual[i] + 33;
+         }
+      }
+      bam->seq[lseq] = bam->qual[lseq] = '\0';
+
+      rec->flag = flag;
+      rec->len  = lseq;
+      rec->name = bam->name;
+      rec->seq  = bam->seq;
+      rec->qual = bam->qual;
+      return 1;
+
+   }
+
+}
+
+
+void
+bam_close
+(
+   bam_t * bam
+)
+{
+   if (bam == NULL) return;
+   free(bam->cdata);
+   free(bam->data);
+   free(bam->name);
+   free(bam->seq);
+   free(bam->qual);
+   free(bam);
+}
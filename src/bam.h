@@ -0,0 +1,57 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+#ifndef _STARCODE_BAM_HEADER
+#define _STARCODE_BAM_HEADER
+
+#include <stdio.h>
+
+// Reader of unaligned (or aligned) BAM files. The BGZF blocks are
+// decompressed in batches by several threads and the records are
+// decoded to the same strings as 'samtools fastq': the sequence
+// and the quality are reverse-complemented for reverse reads, and
+// secondary and supplementary alignments are skipped.
+
+#define BAM_FPAIRED        0x1
+#define BAM_FREVERSE      0x10
+#define BAM_FREAD1        0x40
+#define BAM_FREAD2        0x80
+#define BAM_FSECONDARY   0x100
+#define BAM_FSUPPLEMENT  0x800
+
+typedef struct bam_t bam_t;
+typedef struct bamrec_t bamrec_t;
+
+struct bamrec_t {
+   int      flag;
+   int      len;        // Sequence length.
+   char   * name;       // Read name.
+   char   * seq;        // Sequence ('=ACMGRSVTWYHKDBN').
+   char   * qual;       // Phred+33 quality.
+};
+
+bam_t * bam_open (FILE *, int);
+int     bam_next (bam_t *, bamrec_t *);
+void    bam_close (bam_t *);
+
+#endif
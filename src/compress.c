@@ -0,0 +1,411 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "compress.h"
+
+// The compressed output is a custom stream, opened with 'fopencookie()'
+// in the GNU C library and with 'funopen()' on BSD and macOS. Without
+// either, only COMPRESS_NONE is available.
+#if defined(__GLIBC__)
+#define COMPRESS_FOPENCOOKIE
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) \
+   || defined(__OpenBSD__) || defined(__DragonFly__)
+#define COMPRESS_FUNOPEN
+#endif
+
+#define GZIP_LEVEL 6
+#define ZSTD_LEVEL 3
+
+typedef struct cblock_t cblock_t;
+typedef struct cstream_t cstream_t;
+
+struct cblock_t {
+   char   * in;
+   size_t   inlen;
+   char   * out;
+   size_t   outlen;
+   long     number;
+};
+
+// The blocks are queued in a ring of 'nslots' slots. Block 'n' is
+// in slot 'n % nslots', it is compressed by any worker and written
+// by the same worker once all the previous blocks are written.
+struct cstream_t {
+   FILE            * out;
+   compress_t        format;
+   int               nthreads;
+   int               nslots;
+   cblock_t        * slots;
+   char            * buf;       // Block being filled.
+   size_t            buflen;
+   long              nsent;     // Blocks queued.
+   long              ntaken;    // Blocks taken by a worker.
+   long              nwritten;  // Blocks written.
+   int               closing;
+   int               error;
+   pthread_t       * workers;
+   pthread_mutex_t   mutex;
+   pthread_cond_t    cond;
+};
+
+
+compress_t
+compress_format
+(
+   const char * name
+)
+// SYNOPSIS:
+//   Format from the argument of an option ("gzip", "zstd" or "none"),
+//   COMPRESS_INVALID if the format is not available in this build.
+{
+   if (strcmp(name, "none") == 0) return COMPRESS_NONE;
+#if defined(COMPRESS_FOPENCOOKIE) || defined(COMPRESS_FUNOPEN)
+   if (strcmp(name, "gzip") == 0 || strcmp(name, "gz") == 0) {
+      return COMPRESS_GZIP;
+   }
+#ifdef HAVE_ZSTD
+   if (strcmp(name, "zstd") == 0 || strcmp(name, "zst") == 0) {
+      return COMPRESS_ZSTD;
+   }
+#endif
+#endif
+   return COMPRESS_INVALID;
+}
+
+
+compress_t
+compress_suffix
+(
+   const char * path
+)
+// SYNOPSIS:
+//   Format from the extension of a file name ('.gz' or '.zst'),
+//   COMPRESS_INVALID if the format is not available in this build.
+{
+   const char *c = strrchr(path, '.');
+   if (c == NULL) return COMPRESS_NONE;
+   if (strcmp(c, ".gz") == 0) return compress_format("gzip");
+   if (strcmp(c, ".zst") == 0) return compress_format("zstd");
+   return COMPRESS_NONE;
+}
+
+
+int
+compress_block
+(
+   cblock_t   * block,
+   compress_t   format
+)
+// SYNOPSIS:
+//   Compress a block as a gzip member or a zstd frame.
+//
+// RETURN:
+//   0 upon success, 1 upon failure.
+{
+
+#ifdef HAVE_ZSTD
+   if (format == COMPRESS_ZSTD) {
+      size_t bound = ZSTD_compressBound(block->inlen);
+      block->out = malloc(bound);
+      if (block->out == NULL) return 1;
+      block->outlen = ZSTD_compress(block->out, bound,
+            block->in, block->inlen, ZSTD_LEVEL);
+      return ZSTD_isError(block->outlen);
+   }
+#endif
+
+   // Window of 15 bits, +16 for the gzip header.
+   z_stream strm = {0};
+   if (deflateInit2(&strm, GZIP_LEVEL, Z_DEFLATED, 15+16, 8,
+            Z_DEFAULT_STRATEGY) != Z_OK) {
+      return 1;
+   }
+   size_t bound = deflateBound(&strm, block->inlen);
+   block->out = malloc(bound);
+   if (block->out == NULL) {
+      deflateEnd(&strm);
+      return 1;
+   }
+   strm.next_in = (unsigned char *) block->in;
+   strm.avail_in = block->inlen;
+   strm.next_out = (unsigned char *) block->out;
+   strm.avail_out = bound;
+   int status = deflate(&strm, Z_FINISH);
+   block->outlen = bound - strm.avail_out;
+   deflateEnd(&strm);
+   return status != Z_STREAM_END;
+
+}
+
+
+void *
+compress_worker
+(
+   void * args
+)
+// SYNOPSIS:
+//   Thread function of the workers, compress the queued blocks and
+//   write them in order.
+{
+
+   cstream_t *cs = (cstream_t *) args;
+
+   pthread_mutex_lock(&cs->mutex);
+   while (1) {
+      while (cs->ntaken == cs->nsent && !cs->closing) {
+         pthread_cond_wait(&cs->cond, &cs->mutex);
+      }
+      if (cs->ntaken == cs->nsent) break;
+      cblock_t *block = cs->slots + cs->ntaken++ % cs->nslots;
+      pthread_mutex_unlock(&cs->mutex);
+
+      int failed = compress_block(block, cs->format);
+
+      pthread_mutex_lock(&cs->mutex);
+      while (cs->nwritten < block->number) {
+         pthread_cond_wait(&cs->cond, &cs->mutex);
+      }
+      if (failed) cs->error = 1;
+      // Write outside the lock, the other workers can only write
+      // the next blocks after this one.
+      pthread_mutex_unlock(&cs->mutex);
+      if (!failed && fwrite(block->out, 1, block->outlen, cs->out)
+            != block->outlen) {
+         failed = 1;
+      }
+      free(block->in);
+      free(block->out);
+      pthread_mutex_lock(&cs->mutex);
+      if (failed) cs->error = 1;
+      cs->nwritten++;
+      pthread_cond_broadcast(&cs->cond);
+   }
+   pthread_mutex_unlock(&cs->mutex);
+
+   return NULL;
+
+}
+
+
+int
+compress_send
+(
+   cstream_t * cs
+)
+// SYNOPSIS:
+//   Queue the current block, wait for a free slot if needed.
+//
+// RETURN:
+//   0 upon success, 1 upon failure.
+{
+   pthread_mutex_lock(&cs->mutex);
+   while (cs->nsent - cs->nwritten == cs->nslots) {
+      pthread_cond_wait(&cs->cond, &cs->mutex);
+   }
+   cblock_t *block = cs->slots + cs->nsent % cs->nslots;
+   block->in = cs->buf;
+   block->inlen = cs->buflen;
+   block->out = NULL;
+   block->number = cs->nsent++;
+   int error = cs->error;
+   pthread_cond_broadcast(&cs->cond);
+   pthread_mutex_unlock(&cs->mutex);
+
+   cs->buf = malloc(COMPRESS_BLOCK_SIZE);
+   cs->buflen = 0;
+   return error || cs->buf == NULL;
+}
+
+
+ssize_t
+compress_write
+(
+         void   * cookie,
+   const char   * data,
+         size_t   size
+)
+// SYNOPSIS:
+//   Write function of the stream (see 'fopencookie()').
+{
+   cstream_t *cs = (cstream_t *) cookie;
+   size_t done = 0;
+   while (done < size) {
+      if (cs->buf == NULL) return -1;
+      size_t n = COMPRESS_BLOCK_SIZE - cs->buflen;
+      if (n > size - done) n = size - done;
+      memcpy(cs->buf + cs->buflen, data + done, n);
+      cs->buflen += n;
+      done += n;
+      if (cs->buflen == COMPRESS_BLOCK_SIZE && compress_send(cs)) {
+         return -1;
+      }
+   }
+   return size;
+}
+
+
+#ifdef COMPRESS_FUNOPEN
+int
+compress_write_bsd
+(
+         void   * cookie,
+   const char   * data,
+         int      size
+)
+// SYNOPSIS:
+//   Write function of the stream for 'funopen()'.
+{
+   return (int) compress_write(cookie, data, size);
+}
+#endif
+
+
+int
+compress_close
+(
+   void * cookie
+)
+// SYNOPSIS:
+//   Close function of the stream, compress the last block, wait for
+//   the workers and close the underlying file (unless it is stdout).
+{
+
+   cstream_t *cs = (cstream_t *) cookie;
+
+   // An empty output is still a valid (empty) gzip or zstd file.
+   int error = 0;
+   if (cs->out != NULL && cs->buf != NULL &&
+         (cs->buflen > 0 || cs->nsent == 0)) {
+      error = compress_send(cs);
+   }
+
+   pthread_mutex_lock(&cs->mutex);
+   cs->closing = 1;
+   pthread_cond_broadcast(&cs->cond);
+   pthread_mutex_unlock(&cs->mutex);
+   for (int i = 0 ; i < cs->nthreads ; i++) {
+      pthread_join(cs->workers[i], NULL);
+   }
+
+   error |= cs->error;
+   if (cs->out == stdout)     error |= fflush(cs->out) != 0;
+   else if (cs->out != NULL)  error |= fclose(cs->out) != 0;
+
+   pthread_mutex_destroy(&cs->mutex);
+   pthread_cond_destroy(&cs->cond);
+   free(cs->buf);
+   free(cs->slots);
+   free(cs->workers);
+   free(cs);
+
+   return error ? EOF : 0;
+
+}
+
+
+FILE *
+compress_open
+(
+   FILE       * out,
+   compress_t   format,
+   int          nthreads
+)
+// SYNOPSIS:
+//   Open a stream that compresses what is written to it in 'format'
+//   with 'nthreads' background threads, and writes it to 'out'. The
+//   stream takes ownership of 'out', which is closed with the stream
+//   (or flushed if it is stdout).
+//
+// RETURN:
+//   The stream, or NULL upon failure (in which case 'out' is left
+//   untouched).
+{
+
+   if (format == COMPRESS_NONE) return out;
+   if (format == COMPRESS_INVALID) return NULL;
+   if (nthreads < 1) nthreads = 1;
+
+   cstream_t *cs = calloc(1, sizeof(cstream_t));
+   if (cs == NULL) return NULL;
+   cs->out = out;
+   cs->format = format;
+   // Two slots per thread so that the caller can fill a block while
+   // the workers compress.
+   cs->nslots = 2 * nthreads;
+   cs->slots = calloc(cs->nslots, sizeof(cblock_t));
+   cs->workers = malloc(nthreads * sizeof(pthread_t));
+   cs->buf = malloc(COMPRESS_BLOCK_SIZE);
+   if (cs->slots == NULL || cs->workers == NULL || cs->buf == NULL) {
+      goto fail;
+   }
+
+#if defined(COMPRESS_FOPENCOOKIE)
+   cookie_io_functions_t io = {
+      .read  = NULL,
+      .write = compress_write,
+      .seek  = NULL,
+      .close = compress_close,
+   };
+   FILE *stream = fopencookie(cs, "w", io);
+#elif defined(COMPRESS_FUNOPEN)
+   FILE *stream = funopen(cs, NULL, compress_write_bsd, NULL,
+         compress_close);
+#else
+   FILE *stream = NULL;
+#endif
+   if (stream == NULL) goto fail;
+
+   pthread_mutex_init(&cs->mutex, NULL);
+   pthread_cond_init(&cs->cond, NULL);
+   for ( ; cs->nthreads < nthreads ; cs->nthreads++) {
+      if (pthread_create(cs->workers + cs->nthreads, NULL,
+               compress_worker, cs)) {
+         break;
+      }
+   }
+   if (cs->nthreads == 0) {
+      // Release the stream, but not 'out'.
+      cs->out = NULL;
+      fclose(stream);
+      return NULL;
+   }
+
+   return stream;
+
+fail:
+   free(cs->slots);
+   free(cs->workers);
+   free(cs->buf);
+   free(cs);
+   return NULL;
+
+}
@@ -0,0 +1,49 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+#ifndef _STARCODE_COMPRESS_HEADER
+#define _STARCODE_COMPRESS_HEADER
+
+#include <stdio.h>
+
+// Compressed output streams. The text written to the stream is cut in
+// blocks that are compressed by background threads while the caller
+// keeps formatting the output. Every block is a complete gzip member
+// or zstd frame, and the concatenation is a valid file for 'gzip -d'
+// and 'zstd -d'. The zstd format needs building with 'HAVE_ZSTD', and
+// compression needs 'fopencookie()' (glibc) or 'funopen()' (BSD, macOS).
+
+#define COMPRESS_BLOCK_SIZE (1 << 20)
+
+typedef enum {
+   COMPRESS_NONE,
+   COMPRESS_GZIP,
+   COMPRESS_ZSTD,
+   COMPRESS_INVALID,
+} compress_t;
+
+compress_t   compress_format (const char *);
+compress_t   compress_suffix (const char *);
+FILE       * compress_open (FILE *, compress_t, int);
+
+#endif
@@ -0,0 +1,531 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "long.h"
+
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+
+typedef struct lindex_t lindex_t;
+typedef struct largs_t largs_t;
+
+// Minimizers of all the sequences. The minimizers of sequence 'i'
+// are 'mins[offset[i]]' to 'mins[offset[i+1]-1]', the first 'npref[i]'
+// of them being the rarest ones (the "prefix"). The prefixes are
+// also stored in 'keys' as (hash << 32 | i), sorted.
+struct lindex_t {
+   uint32_t * mins;
+   long     * offset;
+   int      * npref;
+   uint64_t * keys;
+   long       nkeys;
+};
+
+// Arguments of 'pairs_worker()'. Thread 'first' checks the sequences
+// 'first', 'first+step', etc.
+struct largs_t {
+   char          ** seqs;
+   int              nseqs;
+   int              tau;
+   lindex_t       * index;
+   int              first;
+   int              step;
+   ledge_t        * edges;
+   long             nedges;
+   long             nslots;
+   int              err;
+};
+
+int      ledge_order (const void *, const void *);
+int      key_order (const void *, const void *);
+int      uint32_order (const void *, const void *);
+void   * pairs_worker (void *);
+
+static const int code[256] = {
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1, 0,-1, 1,-1,-1,-1, 2,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1, 3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1, 0,-1, 1,-1,-1,-1, 2,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1, 3,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+
+int
+long_distance
+(
+   const char * a,
+   const char * b,
+   const int    tau
+)
+// SYNOPSIS:
+//   Levenshtein distance between 'a' and 'b' if it is at most 'tau'.
+//   The dynamic programming table is computed in a band of width
+//   '2*tau+1' around the diagonal with the bit-parallel algorithm of
+//   Myers (in the formulation of Hyyro). The band is one 64-bit word
+//   that slides down by one row for every character of 'b', so the
+//   cost is linear in the length of the sequences.
+//
+//   Bit 'k' of the vectors of column 'j' is the row 'j-tau+k'. Above
+//   row 0 and outside the band, the distances are taken as the offset
+//   to the diagonal (which is more than 'tau'), so the values up to
+//   'tau' are exact. The score is followed along the diagonal.
+//
+// RETURN:
+//   The distance, or 'tau+1' if the distance is greater than 'tau'.
+{
+
+   const int m = strlen(a);
+   const int n = strlen(b);
+   if (abs(m - n) > tau) return tau + 1;
+   if (tau == 0) {
+      for (int i = 0 ; i < m ; i++) {
+         if (a[i] != b[i] || code[(unsigned char) a[i]] < 0) return 1;
+      }
+      return 0;
+   }
+   if (m == 0 || n == 0) return max(m, n);
+
+   const int width = 2*tau + 1;
+   const uint64_t top = (uint64_t) 1 << (width - 1);
+   const uint64_t full = top | (top - 1);
+
+   // Match masks of the band for every nucleotide.
+   uint64_t peq[4] = {0};
+   for (int k = tau+1 ; k < width && k-tau-1 < m ; k++) {
+      int c = code[(unsigned char) a[k-tau-1]];
+      if (c >= 0) peq[c] |= (uint64_t) 1 << k;
+   }
+
+   // Column 0: the distance at row 'r' is '|r|'.
+   uint64_t pv = full & ~(((uint64_t) 1 << (tau+1)) - 1);
+   uint64_t mv = ((uint64_t) 1 << (tau+1)) - 1;
+   int diag = 0;
+
+   for (int j = 1 ; j <= n ; j++) {
+      // Slide the band down. The new bottom row gets +1.
+      for (int c = 0 ; c < 4 ; c++) peq[c] >>= 1;
+      if (j+tau-1 < m) {
+         int c = code[(unsigned char) a[j+tau-1]];
+         if (c >= 0) peq[c] |= top;
+      }
+      pv = (pv >> 1) | top;
+      mv = mv >> 1;
+
+      int c = code[(unsigned char) b[j-1]];
+      uint64_t eq = c < 0 ? 0 : peq[c];
+      uint64_t xv = eq | mv;
+      uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+      uint64_t ph = mv | ~(xh | pv);
+      uint64_t mh = pv & xh;
+      // Horizontal step from row 'j-1'.
+      diag += ((ph >> (tau-1)) & 1) - ((mh >> (tau-1)) & 1);
+      // The row above the band gets +1.
+      ph = (ph << 1) | 1;
+      mh = mh << 1;
+      pv = (mh | ~(xv | ph)) & full;
+      mv = (ph & xv) & full;
+      // Vertical step to row 'j'.
+      diag += ((pv >> tau) & 1) - ((mv >> tau) & 1);
+   }
+
+   // Move from row 'n' to row 'm' in the last column.
+   int dist = diag;
+   for (int r = n+1 ; r <= m ; r++) {
+      dist += ((pv >> (r-n+tau)) & 1) - ((mv >> (r-n+tau)) & 1);
+   }
+   for (int r = n ; r > m ; r--) {
+      dist -= ((pv >> (r-n+tau)) & 1) - ((mv >> (r-n+tau)) & 1);
+   }
+
+   return min(dist, tau + 1);
+
+}
+
+
+int
+long_minimizers
+(
+   const char * seq,
+   uint32_t   * mins
+)
+// SYNOPSIS:
+//   Compute the (w,k)-minimizers of a sequence: the smallest hash of
+//   the k-mers in every window of 'LONG_W' consecutive k-mers. The
+//   k-mers with a character other than A, C, G or T are skipped. The
+//   hash is invertible, so different k-mers have different hashes.
+//   Sequences with fewer than 'LONG_W' k-mers have one window.
+//
+// ARGUMENTS:
+//   seq: the sequence
+//   mins: output array with at least 'strlen(seq)' slots.
+//
+// RETURN:
+//   The number of distinct minimizers, which are sorted.
+{
+
+   const int len = strlen(seq);
+   const int nkmers = len - LONG_K + 1;
+   if (nkmers <= 0) return 0;
+
+   uint32_t *hashes = malloc(nkmers * sizeof(uint32_t));
+   if (hashes == NULL) return -1;
+
+   // Hash all the k-mers ('UINT32_MAX' for invalid k-mers).
+   const uint32_t mask = ((uint32_t) 1 << (2*LONG_K)) - 1;
+   uint32_t kmer = 0;
+   int valid = 0;
+   for (int i = 0 ; i < len ; i++) {
+      int c = code[(unsigned char) seq[i]];
+      valid = c < 0 ? 0 : valid + 1;
+      kmer = ((kmer << 2) | (c & 3)) & mask;
+      if (i < LONG_K - 1) continue;
+      if (valid < LONG_K) {
+         hashes[i-LONG_K+1] = UINT32_MAX;
+         continue;
+      }
+      // Finalizer of MurmurHash3 (invertible).
+      uint32_t h = kmer;
+      h ^= h >> 16;
+      h *= 0x85ebca6b;
+      h ^= h >> 13;
+      h *= 0xc2b2ae35;
+      h ^= h >> 16;
+      hashes[i-LONG_K+1] = h == UINT32_MAX ? UINT32_MAX - 1 : h;
+   }
+
+   int nmins = 0;
+   const int nwin = max(1, nkmers - LONG_W + 1);
+   for (int w = 0 ; w < nwin ; w++) {
+      uint32_t best = UINT32_MAX;
+      for (int i = w ; i < min(nkmers, w + LONG_W) ; i++) {
+         best = min(best, hashes[i]);
+      }
+      if (best == UINT32_MAX) continue;
+      if (nmins == 0 || mins[nmins-1] != best) mins[nmins++] = best;
+   }
+   free(hashes);
+
+   // Sort and remove duplicates.
+   qsort(mins, nmins, sizeof(uint32_t), uint32_order);
+   int n = 0;
+   for (int i = 0 ; i < nmins ; i++) {
+      if (n == 0 || mins[n-1] != mins[i]) mins[n++] = mins[i];
+   }
+
+   return n;
+
+}
+
+
+long
+long_pairs
+(
+   char    ** seqs,
+   int        nseqs,
+   int        tau,
+   int        nthreads,
+   ledge_t ** edges
+)
+// SYNOPSIS:
+//   Find the pairs of sequences at distance 1 to 'tau'. A pair at
+//   distance 'tau' has lost at most about 'LONG_E*tau' minimizers,
+//   so the sequences must share one minimizer among their rarest
+//   'LONG_E*tau+1' (prefix filtering). Only the prefixes are indexed
+//   and probed, which keeps the number of candidates close to linear
+//   when the sequences are diverse. The candidates are verified with
+//   'long_distance()' in 'nthreads' threads.
+//
+//   The filter is a heuristic: a pair whose errors fall on more
+//   minimizers than expected can be missed.
+//
+// RETURN:
+//   The number of pairs stored in '*edges' (sorted by 'i' then 'j'),
+//   or -1 in case of failure.
+{
+
+   *edges = NULL;
+   if (tau < 1 || tau > LONG_MAXTAU) return -1;
+   nthreads = max(1, nthreads);
+
+   lindex_t index = {0};
+   index.offset = malloc((nseqs + 1) * sizeof(long));
+   index.npref = malloc(nseqs * sizeof(int));
+   long total = 0;
+   for (int i = 0 ; i < nseqs ; i++) total += strlen(seqs[i]) + 1;
+   index.mins = malloc(total * sizeof(uint32_t));
+   if (index.offset == NULL || index.npref == NULL || index.mins == NULL) {
+      goto fail;
+   }
+
+   // Minimizers of every sequence.
+   long nmins = 0;
+   for (int i = 0 ; i < nseqs ; i++) {
+      index.offset[i] = nmins;
+      int n = long_minimizers(seqs[i], index.mins + nmins);
+      if (n < 0) goto fail;
+      nmins += n;
+   }
+   index.offset[nseqs] = nmins;
+
+   // Count the occurrences of every minimizer.
+   uint32_t *hash = malloc((nmins + 1) * sizeof(uint32_t));
+   int *count = malloc((nmins + 1) * sizeof(int));
+   if (hash == NULL || count == NULL) {
+      free(hash);
+      free(count);
+      goto fail;
+   }
+   memcpy(hash, index.mins, nmins * sizeof(uint32_t));
+   qsort(hash, nmins, sizeof(uint32_t), uint32_order);
+   long nhash = 0;
+   for (long i = 0 ; i < nmins ; i++) {
+      if (nhash > 0 && hash[nhash-1] == hash[i]) {
+         count[nhash-1]++;
+      }
+      else {
+         hash[nhash] = hash[i];
+         count[nhash++] = 1;
+      }
+   }
+
+   // Put the rarest minimizers of every sequence first (sorted by
+   // number of occurrences, then by hash).
+   uint64_t *rank = malloc((index.offset[nseqs] + 1) * sizeof(uint64_t));
+   if (rank == NULL) {
+      free(hash);
+      free(count);
+      goto fail;
+   }
+   for (long i = 0 ; i < nmins ; i++) {
+      uint32_t *h = bsearch(index.mins + i, hash, nhash, sizeof(uint32_t),
+            uint32_order);
+      rank[i] = ((uint64_t) count[h - hash] << 32) | index.mins[i];
+   }
+   index.nkeys = 0;
+   for (int i = 0 ; i < nseqs ; i++) {
+      uint64_t *r = rank + index.offset[i];
+      int n = index.offset[i+1] - index.offset[i];
+      qsort(r, n, sizeof(uint64_t), key_order);
+      for (int p = 0 ; p < n ; p++) {
+         index.mins[index.offset[i] + p] = (uint32_t) r[p];
+      }
+      index.npref[i] = min(n, LONG_E*tau + 1);
+      index.nkeys += index.npref[i];
+   }
+   free(rank);
+   free(hash);
+   free(count);
+
+   // Index the prefixes.
+   index.keys = malloc((index.nkeys + 1) * sizeof(uint64_t));
+   if (index.keys == NULL) goto fail;
+   long k = 0;
+   for (int i = 0 ; i < nseqs ; i++) {
+      for (int p = 0 ; p < index.npref[i] ; p++) {
+         uint64_t h = index.mins[index.offset[i] + p];
+         index.keys[k++] = (h << 32) | (uint32_t) i;
+      }
+   }
+   qsort(index.keys, index.nkeys, sizeof(uint64_t), key_order);
+
+   // Verify the candidates in parallel.
+   pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+   largs_t *args = calloc(nthreads, sizeof(largs_t));
+   if (threads == NULL || args == NULL) {
+      free(threads);
+      free(args);
+      goto fail;
+   }
+   int err = 0;
+   for (int t = 0 ; t < nthreads ; t++) {
+      args[t] = (largs_t) {
+         .seqs = seqs, .nseqs = nseqs, .tau = tau, .index = &index,
+         .first = t, .step = nthreads,
+      };
+      if (t > 0 && pthread_create(threads + t, NULL, pairs_worker,
+               args + t)) {
+         args[t].err = 1;
+      }
+   }
+   pairs_worker(args);
+   long nedges = 0;
+   for (int t = 0 ; t < nthreads ; t++) {
+      if (t > 0 && !args[t].err) pthread_join(threads[t], NULL);
+      err |= args[t].err;
+      nedges += args[t].nedges;
+   }
+
+   // Merge the pairs of the threads.
+   ledge_t *all = err ? NULL : malloc((nedges + 1) * sizeof(ledge_t));
+   if (all != NULL) {
+      long n = 0;
+      for (int t = 0 ; t < nthreads ; t++) {
+         memcpy(all + n, args[t].edges, args[t].nedges * sizeof(ledge_t));
+         n += args[t].nedges;
+      }
+      // The pairs of a thread are sorted, merge by sorting again.
+      qsort(all, nedges, sizeof(ledge_t), ledge_order);
+   }
+   for (int t = 0 ; t < nthreads ; t++) free(args[t].edges);
+   free(threads);
+   free(args);
+   free(index.keys);
+   free(index.mins);
+   free(index.offset);
+   free(index.npref);
+   if (all == NULL) {
+      fprintf(stderr, "error: could not find long pairs\n");
+      return -1;
+   }
+   *edges = all;
+   return nedges;
+
+fail:
+   fprintf(stderr, "error: could not allocate minimizer index\n");
+   free(index.keys);
+   free(index.mins);
+   free(index.offset);
+   free(index.npref);
+   return -1;
+
+}
+
+
+void *
+pairs_worker
+(
+   void * data
+)
+// SYNOPSIS:
+//   Generate and verify the candidates of the sequences assigned to
+//   the thread. A candidate 'j' of sequence 'i' has 'j > i' and shares
+//   one of the prefix minimizers of 'i', so every pair is checked by
+//   one thread only, and only once ('seen[j] == i').
+{
+   largs_t *args = (largs_t *) data;
+   lindex_t *index = args->index;
+   int *seen = malloc(args->nseqs * sizeof(int));
+   if (seen == NULL) {
+      args->err = 1;
+      return NULL;
+   }
+   for (int j = 0 ; j < args->nseqs ; j++) seen[j] = -1;
+
+   for (int i = args->first ; i < args->nseqs ; i += args->step) {
+      const int leni = strlen(args->seqs[i]);
+      for (int p = 0 ; p < index->npref[i] ; p++) {
+         uint64_t h = index->mins[index->offset[i] + p];
+         // First key of the minimizer (bisection).
+         long lo = 0;
+         long hi = index->nkeys;
+         while (lo < hi) {
+            long mid = (lo + hi) / 2;
+            if (index->keys[mid] >> 32 < h) lo = mid + 1;
+            else hi = mid;
+         }
+         for (long k = lo ; k < index->nkeys ; k++) {
+            if (index->keys[k] >> 32 != h) break;
+            int j = (uint32_t) index->keys[k];
+            if (j <= i || seen[j] == i) continue;
+            seen[j] = i;
+            if (abs(leni - (int) strlen(args->seqs[j])) > args->tau) {
+               continue;
+            }
+            int dist = long_distance(args->seqs[i], args->seqs[j],
+                  args->tau);
+            if (dist < 1 || dist > args->tau) continue;
+            if (args->nedges == args->nslots) {
+               long nslots = 2 * args->nslots + 1024;
+               ledge_t *edges = realloc(args->edges,
+                     nslots * sizeof(ledge_t));
+               if (edges == NULL) {
+                  args->err = 1;
+                  free(seen);
+                  return NULL;
+               }
+               args->edges = edges;
+               args->nslots = nslots;
+            }
+            args->edges[args->nedges++] = (ledge_t) {i, j, dist};
+         }
+      }
+   }
+
+   free(seen);
+   return NULL;
+}
+
+
+int
+ledge_order
+(
+   const void * a,
+   const void * b
+)
+{
+   const ledge_t *ea = (const ledge_t *) a;
+   const ledge_t *eb = (const ledge_t *) b;
+   if (ea->i != eb->i) return ea->i < eb->i ? -1 : 1;
+   return (ea->j > eb->j) - (ea->j < eb->j);
+}
+
+
+int
+key_order
+(
+   const void * a,
+   const void * b
+)
+{
+   uint64_t ka = *(uint64_t *) a;
+   uint64_t kb = *(uint64_t *) b;
+   return (ka > kb) - (ka < kb);
+}
+
+
+int
+uint32_order
+(
+   const void * a,
+   const void * b
+)
+{
+   uint32_t ua = *(uint32_t *) a;
+   uint32_t ub = *(uint32_t *) b;
+   return (ua > ub) - (ua < ub);
+}
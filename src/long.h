@@ -0,0 +1,52 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+#ifndef _STARCODE_LONG_HEADER
+#define _STARCODE_LONG_HEADER
+
+#include <stdint.h>
+
+// Engine for long sequences (amplicons of a few hundred nucleotides).
+// Candidate pairs are the pairs of sequences that share a minimizer
+// among their rarest ones, and they are verified with a banded
+// bit-parallel edit distance. The distance is the plain Levenshtein
+// distance where 'N' is a mismatch with every character.
+
+#define LONG_K   15        // Length of the k-mers.
+#define LONG_W   10        // Number of k-mers per window.
+#define LONG_E    6        // Minimizers lost per error (heuristic).
+#define LONG_MAXTAU 31     // The band must fit in 64 bits.
+
+typedef struct ledge_t ledge_t;
+
+struct ledge_t {
+   int   i;       // Lower index.
+   int   j;       // Higher index.
+   int   dist;
+};
+
+int    long_distance (const char *, const char *, int);
+int    long_minimizers (const char *, uint32_t *);
+long   long_pairs (char **, int, int, int, ledge_t **);
+
+#endif
@@ -28,6 +28,9 @@
 #include <string.h>
 #include <unistd.h>
 #include "starcode.h"
+#include "trace.h"
+#include "metrics.h"
+#include "compress.h"
 
 #define ERRM "starcode error:"
 
@@ -47,6 +50,22 @@ char *USAGE =
 "    -t --threads: number of concurrent threads (default 1)\n"
 "    -q --quiet: quiet output (default verbose)\n"
 "    -v --version: display version and exit\n"
+"       --trace: write a timeline of the run to the given file\n"
+"                (Chrome trace format, see chrome://tracing)\n"
+"       --metrics: write metrics of the run to the given file\n"
+"                (Prometheus text format, updated periodically)\n"
+"       --metrics-interval: seconds between updates of the\n"
+"                metrics (default 10)\n"
+"       --split-search: split the distance between both halves of\n"
+"                the sequences (same length only, uses more memory)\n"
+"       --long: search long sequences (200 nt or more) with\n"
+"                minimizers instead of tries\n"
+"       --max-indels: maximum shift (net insertions minus deletions)\n"
+"                between the sequences (same length only)\n"
+"       --batch: cluster every input of a manifest (lines with an\n"
+"                input and an output separated by a tab)\n"
+"       --serve: load the input once and answer nearest-neighbour\n"
+"                queries on the given Unix socket\n"
 "\n"
 "  cluster options: (default algorithm: message passing)\n"
 "    -r --cluster-ratio: minumum cluster size ratio (message passing, default 5)\n"
@@ -54,12 +73,14 @@ char *USAGE =
 "    -c --connected-comp: cluster connected components\n"
 "\n"
 "  input/output options (single file, default)\n"
-"    -i --input: input file (default stdin)\n"
+"    -i --input: input file (default stdin, can be repeated)\n"
 "    -o --output: output file (default stdout)\n"
+"       --compress: compress the output(s) with gzip, zstd or\n"
+"                none (default from the extension .gz or .zst)\n"
 "\n"
 "  input options (paired-end fastq files)\n"
-"    -1 --input1: input file 1\n"
-"    -2 --input2: input file 2\n"
+"    -1 --input1: input file 1 (can be repeated)\n"
+"    -2 --input2: input file 2 (can be repeated)\n"
 "\n"
 "  output options (paired-end fastq files, --non-redundant only)\n"
 "       --output1: output file1 (default input1-starcode.fastq)\n"
@@ -134,21 +155,38 @@ main(
    static int cl_flag = 0;
    static int id_flag = 0;
    static int cp_flag = 0;
+   static int ss_flag = 0;
+   static int lg_flag = 0;
 
    // Unset flags (value -1).
    int dist = -1;
    int threads = -1;
    int cluster_ratio = -1;
+   int max_indels = -1;
+   double metrics_interval = -1;
 
    // Unset options (value 'UNSET').
    char * const UNSET = "unset";
-   char * input   = UNSET;
-   char * input1  = UNSET;
-   char * input2  = UNSET;
    char * output  = UNSET;
    char * output1 = UNSET;
    char * output2 = UNSET;
-
+   char * tracef  = UNSET;
+   char * batch   = UNSET;
+   char * serve   = UNSET;
+   char * metricsf = UNSET;
+   char * compress = UNSET;
+
+   // Input files (the options can be repeated).
+   int     ninput  = 0;
+   int     ninput1 = 0;
+   int     ninput2 = 0;
+   char ** input   = malloc(argc * sizeof(char *));
+   char ** input1  = malloc(argc * sizeof(char *));
+   char ** input2  = malloc(argc * sizeof(char *));
+   if (input == NULL || input1 == NULL || input2 == NULL) {
+      fprintf(stderr, "%s memory error\n", ERRM);
+      return EXIT_FAILURE;
+   }
 
    if (argc == 1 && isatty(0)) {
       say_usage();
@@ -165,6 +203,8 @@ main(
          {"quiet",             no_argument,       &vb_flag,  0 },
          {"sphere",            no_argument,       &sp_flag, 's'},
          {"connected-comp",    no_argument,       &cp_flag, 'c'},
+         {"split-search",      no_argument,       &ss_flag,  1 },
+         {"long",              no_argument,       &lg_flag,  1 },
          {"version",           no_argument,              0, 'v'},
          {"dist",              required_argument,        0, 'd'},
          {"cluster-ratio",     required_argument,        0, 'r'},
@@ -176,6 +216,13 @@ main(
          {"threads",           required_argument,        0, 't'},
          {"output1",           required_argument,        0, '3'},
          {"output2",           required_argument,        0, '4'},
+         {"trace",             required_argument,        0, '5'},
+         {"max-indels",        required_argument,        0, '6'},
+         {"batch",             required_argument,        0, '7'},
+         {"serve",             required_argument,        0, '8'},
+         {"metrics",           required_argument,        0, '9'},
+         {"metrics-interval",  required_argument,        0, '0'},
+         {"compress",          required_argument,        0, 'z'},
 
          {0, 0, 0, 0}
       };
@@ -192,49 +239,130 @@ main(
          break;
 
       case '1':
-         if (input1 == UNSET) {
-            input1 = optarg;
+         input1[ninput1++] = optarg;
+         break;
+
+      case '2':
+         input2[ninput2++] = optarg;
+         break;
+
+      case '3':
+         if (output1 == UNSET) {
+            output1 = optarg;
          }
          else {
-            fprintf(stderr, "%s --input1 set more than once\n", ERRM);
+            fprintf(stderr, "%s --output1 set more than once\n", ERRM);
             say_usage();
             return EXIT_FAILURE;
          }
          break;
 
-      case '2':
-         if (input2 == UNSET) {
-            input2 = optarg;
+      case '4':
+         if (output2 == UNSET) {
+            output2 = optarg;
          }
          else {
-            fprintf(stderr, "%s --input2 set more than once\n", ERRM);
+            fprintf(stderr, "%s --output2 set more than once\n", ERRM);
             say_usage();
             return EXIT_FAILURE;
          }
          break;
 
-      case '3':
-         if (output1 == UNSET) {
-            output1 = optarg;
+      case '5':
+         if (tracef == UNSET) {
+            tracef = optarg;
          }
          else {
-            fprintf(stderr, "%s --output1 set more than once\n", ERRM);
+            fprintf(stderr, "%s --trace set more than once\n", ERRM);
             say_usage();
             return EXIT_FAILURE;
          }
          break;
 
-      case '4':
-         if (output2 == UNSET) {
-            output2 = optarg;
+      case '6':
+         if (max_indels < 0) {
+            max_indels = atoi(optarg);
+            if (max_indels < 0) {
+               fprintf(stderr, "%s --max-indels must be a positive "
+                     "integer or 0\n", ERRM);
+               say_usage();
+               return EXIT_FAILURE;
+            }
          }
          else {
-            fprintf(stderr, "%s --output2 set more than once\n", ERRM);
+            fprintf(stderr, "%s --max-indels set more than once\n", ERRM);
             say_usage();
             return EXIT_FAILURE;
          }
          break;
 
+      case '7':
+         if (batch == UNSET) {
+            batch = optarg;
+         }
+         else {
+            fprintf(stderr, "%s --batch set more than once\n", ERRM);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         break;
+
+      case '8':
+         if (serve == UNSET) {
+            serve = optarg;
+         }
+         else {
+            fprintf(stderr, "%s --serve set more than once\n", ERRM);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         break;
+
+      case '9':
+         if (metricsf == UNSET) {
+            metricsf = optarg;
+         }
+         else {
+            fprintf(stderr, "%s --metrics set more than once\n", ERRM);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         break;
+
+      case '0':
+         if (metrics_interval < 0) {
+            metrics_interval = atof(optarg);
+            if (metrics_interval <= 0) {
+               fprintf(stderr, "%s --metrics-interval must be a positive "
+                     "number\n", ERRM);
+               say_usage();
+               return EXIT_FAILURE;
+            }
+         }
+         else {
+            fprintf(stderr, "%s --metrics-interval set more than once\n",
+                  ERRM);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         break;
+
+      case 'z':
+         if (compress == UNSET) {
+            compress = optarg;
+            if (compress_format(compress) == COMPRESS_INVALID) {
+               fprintf(stderr, "%s --compress must be gzip, zstd or none "
+                     "(zstd needs building with ZSTD=1)\n", ERRM);
+               say_usage();
+               return EXIT_FAILURE;
+            }
+         }
+         else {
+            fprintf(stderr, "%s --compress set more than once\n", ERRM);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         break;
 
       case 'd':
          if (dist < 0) {
@@ -259,14 +387,7 @@ main(
          return 0;
 
       case 'i':
-         if (input == UNSET) {
-            input = optarg;
-         }
-         else {
-            fprintf(stderr, "%s --input set more than once\n", ERRM);
-            say_usage();
-            return EXIT_FAILURE;
-         }
+         input[ninput++] = optarg;
          break;
 
       case 'o':
@@ -341,10 +462,10 @@ main(
    }
 
    if (optind < argc) {
-      // If no input is specified, assume first positional argument
-      // is the name of the input file.
-      if ((optind == argc-1) && (input == UNSET && input1 == UNSET)) {
-         input = argv[optind];
+      // If no input is specified, assume positional arguments
+      // are the names of the input files.
+      if (ninput == 0 && ninput1 == 0 && ninput2 == 0) {
+         while (optind < argc) input[ninput++] = argv[optind++];
       }
       else {
          fprintf(stderr, "%s too many options\n", ERRM);
@@ -361,24 +482,30 @@ main(
       say_usage();
       return EXIT_FAILURE;
    }
-   if (input != UNSET && (input1 != UNSET || input2 != UNSET)) {
+   if (ninput > 0 && (ninput1 > 0 || ninput2 > 0)) {
       fprintf(stderr,
             "%s --input and --input1/2 are incompatible\n", ERRM);
       say_usage();
       return EXIT_FAILURE;
    }
-   if (input1 == UNSET && input2 != UNSET) {
+   if (ninput1 == 0 && ninput2 > 0) {
       fprintf(stderr, "%s --input2 set without --input1\n", ERRM);
       say_usage();
       return EXIT_FAILURE;
    }
-   if (input2 == UNSET && input1 != UNSET) {
+   if (ninput2 == 0 && ninput1 > 0) {
       fprintf(stderr, "%s --input1 set without --input2\n", ERRM);
       say_usage();
       return EXIT_FAILURE;
    }
+   if (ninput1 != ninput2) {
+      fprintf(stderr, "%s --input1 and --input2 must be set "
+            "the same number of times\n", ERRM);
+      say_usage();
+      return EXIT_FAILURE;
+   }
    if (nr_flag && output != UNSET &&
-         (input1 != UNSET || input2 != UNSET)) {
+         (ninput1 > 0 || ninput2 > 0)) {
       fprintf(stderr, "%s cannot specify --output for paired-end "
             "fastq file with --non-redundant\n", ERRM);
       say_usage();
@@ -401,43 +528,138 @@ main(
    else if (sp_flag) cluster_alg = SPHERES_CLUSTER;
    else              cluster_alg = MP_CLUSTER;
 
+   // Metrics are only written for a single run.
+   if (metricsf != UNSET && (serve != UNSET || batch != UNSET)) {
+      fprintf(stderr, "%s --metrics is incompatible with --serve "
+            "and --batch\n", ERRM);
+      say_usage();
+      return EXIT_FAILURE;
+   }
+   if (metrics_interval > 0 && metricsf == UNSET) {
+      fprintf(stderr, "%s --metrics-interval requires --metrics\n", ERRM);
+      say_usage();
+      return EXIT_FAILURE;
+   }
+
+   // The server reads single files and does not write output.
+   if (serve != UNSET) {
+      if (batch != UNSET || ninput1 > 0 || output != UNSET ||
+            output1 != UNSET || output2 != UNSET || tracef != UNSET ||
+            compress != UNSET) {
+         fprintf(stderr, "%s --serve is incompatible with output, "
+               "paired-end, --batch and --trace options\n", ERRM);
+         say_usage();
+         return EXIT_FAILURE;
+      }
+   }
+
+   // In batch mode, the inputs and outputs are in the manifest.
+   if (batch != UNSET) {
+      if (ninput > 0 || ninput1 > 0 || output != UNSET ||
+            output1 != UNSET || output2 != UNSET || compress != UNSET) {
+         fprintf(stderr, "%s --batch is incompatible with input "
+               "and output options\n", ERRM);
+         say_usage();
+         return EXIT_FAILURE;
+      }
+      if (tracef != UNSET) {
+         fprintf(stderr, "%s --batch and --trace are incompatible\n",
+               ERRM);
+         say_usage();
+         return EXIT_FAILURE;
+      }
+      int exitcode = starcode_batch(
+            batch,
+            dist,
+            vb_flag,
+            threads < 0 ? 1 : threads,
+            cluster_alg,
+            cluster_ratio < 0 ? 5 : cluster_ratio,
+            cl_flag,
+            id_flag,
+            output_type,
+            ss_flag,
+            lg_flag,
+            max_indels
+      );
+      free(input);
+      free(input1);
+      free(input2);
+      return exitcode;
+   }
 
 
    // Set input file(s). //
-   FILE *inputf1 = NULL;
-   FILE *inputf2 = NULL;
+   int ninputs = ninput1 > 0 ? ninput1 : ninput > 0 ? ninput : 1;
+   FILE **inputf1 = calloc(ninputs, sizeof(FILE *));
+   FILE **inputf2 = NULL;
+   if (inputf1 == NULL) {
+      fprintf(stderr, "%s memory error\n", ERRM);
+      return EXIT_FAILURE;
+   }
 
    // Set output file(s). //
    FILE *outputf1 = NULL;
    FILE *outputf2 = NULL;
 
-   if (input != UNSET) {
-      inputf1 = fopen(input, "r");
-      if (inputf1 == NULL) {
-         fprintf(stderr, "%s cannot open file %s\n", ERRM, input);
-         say_usage();
-         return EXIT_FAILURE;
+   if (ninput > 0) {
+      for (int i = 0 ; i < ninput ; i++) {
+         inputf1[i] = fopen(input[i], "r");
+         if (inputf1[i] == NULL) {
+            fprintf(stderr, "%s cannot open file %s\n", ERRM, input[i]);
+            say_usage();
+            return EXIT_FAILURE;
+         }
       }
    }
-   else if (input1 != UNSET) {
-      inputf1 = fopen(input1, "r");
-      if (inputf1 == NULL) {
-         fprintf(stderr, "%s cannot open file %s\n", ERRM, input1);
-         say_usage();
-         return EXIT_FAILURE;
-      }
-      inputf2 = fopen(input2, "r");
+   else if (ninput1 > 0) {
+      inputf2 = calloc(ninputs, sizeof(FILE *));
       if (inputf2 == NULL) {
-         fprintf(stderr, "%s cannot open file %s\n", ERRM, input2);
-         say_usage();
+         fprintf(stderr, "%s memory error\n", ERRM);
          return EXIT_FAILURE;
       }
+      for (int i = 0 ; i < ninput1 ; i++) {
+         inputf1[i] = fopen(input1[i], "r");
+         if (inputf1[i] == NULL) {
+            fprintf(stderr, "%s cannot open file %s\n", ERRM, input1[i]);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         inputf2[i] = fopen(input2[i], "r");
+         if (inputf2[i] == NULL) {
+            fprintf(stderr, "%s cannot open file %s\n", ERRM, input2[i]);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+      }
    }
    else {
-      inputf1 = stdin;
+      inputf1[0] = stdin;
    }
 
+   if (serve != UNSET) {
+      int exitcode = starcode_serve(
+            inputf1,
+            ninputs,
+            serve,
+            dist,
+            vb_flag,
+            threads < 0 ? 1 : threads
+      );
+      for (int i = 0 ; i < ninputs ; i++) {
+         if (inputf1[i] != stdin) fclose(inputf1[i]);
+      }
+      free(inputf1);
+      free(input);
+      return exitcode;
+   }
+
+   // Compression of the outputs (from the extensions by default).
+   compress_t format1 = COMPRESS_NONE;
+   compress_t format2 = COMPRESS_NONE;
+
    if (output != UNSET) {
+      format1 = compress_suffix(output);
       outputf1 = fopen(output, "w");
       if (outputf1 == NULL) {
          fprintf(stderr, "%s cannot write to file %s\n", ERRM, output);
@@ -445,34 +667,39 @@ main(
          return EXIT_FAILURE;
       }
    }
-   else if (nr_flag && input1 != UNSET && input2 != UNSET) {
+   else if (nr_flag && ninput1 > 0 && ninput2 > 0) {
       // Set default names as inputX-starcode.fastq
+      // (after the first pair of input files).
       if (output1 == UNSET) {
-         output1 = outname(input1);
+         output1 = outname(input1[0]);
+         format1 = compress_suffix(output1);
          outputf1 = fopen(output1, "w");
          free(output1);
       } else {
+         format1 = compress_suffix(output1);
          outputf1 = fopen(output1, "w");
       }
 
       if (outputf1 == NULL) {
          fprintf(stderr,
-               "%s cannot write to file %s\n", ERRM, outname(input1));
+               "%s cannot write to file %s\n", ERRM, outname(input1[0]));
          say_usage();
          return EXIT_FAILURE;
       }
 
       if (output2 == UNSET) {
-         output2 = outname(input2);
+         output2 = outname(input2[0]);
+         format2 = compress_suffix(output2);
          outputf2 = fopen(output2, "w");
          free(output2);
       } else {
+         format2 = compress_suffix(output2);
          outputf2 = fopen(output2, "w");
       }
 
       if (outputf2 == NULL) {
          fprintf(stderr,
-               "%s cannot write to file %s\n", ERRM, outname(input2));
+               "%s cannot write to file %s\n", ERRM, outname(input2[0]));
          say_usage();
          return EXIT_FAILURE;
       }
@@ -481,14 +708,48 @@ main(
       outputf1 = stdout;
    }
 
+   if (tracef != UNSET && trace_open(tracef)) {
+      fprintf(stderr, "%s cannot write to file %s\n", ERRM, tracef);
+      say_usage();
+      return EXIT_FAILURE;
+   }
+
+   if (metricsf != UNSET && metrics_open(metricsf,
+            metrics_interval < 0 ? 10 : metrics_interval)) {
+      fprintf(stderr, "%s cannot write to file %s\n", ERRM, metricsf);
+      say_usage();
+      return EXIT_FAILURE;
+   }
+
    // Set remaining default options.
    if (threads < 0) threads = 1;
    if (cluster_ratio < 0) cluster_ratio = 5;
 
+   // The output is formatted after the search, the compression
+   // uses the threads of the search.
+   if (compress != UNSET) {
+      format1 = format2 = compress_format(compress);
+   }
+   if (format1 == COMPRESS_INVALID || format2 == COMPRESS_INVALID) {
+      fprintf(stderr, "%s compressed output not available in this "
+            "build (zstd needs building with ZSTD=1)\n", ERRM);
+      return EXIT_FAILURE;
+   }
+   FILE *stream1 = compress_open(outputf1, format1, threads);
+   FILE *stream2 = outputf2 == NULL ? NULL :
+      compress_open(outputf2, format2, threads);
+   if (stream1 == NULL || (outputf2 != NULL && stream2 == NULL)) {
+      fprintf(stderr, "%s cannot compress the output\n", ERRM);
+      return EXIT_FAILURE;
+   }
+   outputf1 = stream1;
+   outputf2 = stream2;
+
    int exitcode =
    starcode(
        inputf1,
        inputf2,
+       ninputs,
        outputf1,
        outputf2,
        dist,
@@ -498,13 +759,38 @@ main(
        cluster_ratio,
        cl_flag,
        id_flag,
-       output_type
+       output_type,
+       ss_flag,
+       lg_flag,
+       max_indels
    );
 
-   if (inputf1 != stdin)   fclose(inputf1);
-   if (inputf2 != NULL)    fclose(inputf2);
-   if (outputf1 != stdout) fclose(outputf1);
-   if (outputf2 != NULL)   fclose(outputf2);
+   if (trace_close()) {
+      fprintf(stderr, "%s cannot write to file %s\n", ERRM, tracef);
+      exitcode = EXIT_FAILURE;
+   }
+
+   if (metrics_close()) {
+      fprintf(stderr, "%s cannot write to file %s\n", ERRM, metricsf);
+      exitcode = EXIT_FAILURE;
+   }
+
+   for (int i = 0 ; i < ninputs ; i++) {
+      if (inputf1[i] != stdin) fclose(inputf1[i]);
+      if (inputf2 != NULL)     fclose(inputf2[i]);
+   }
+   // Compressed outputs are written when they are closed.
+   if ((outputf1 != stdout && fclose(outputf1) != 0) ||
+         (outputf2 != NULL && fclose(outputf2) != 0)) {
+      fprintf(stderr, "%s cannot write the output\n", ERRM);
+      exitcode = EXIT_FAILURE;
+   }
+
+   free(inputf1);
+   free(inputf2);
+   free(input);
+   free(input1);
+   free(input2);
 
    return exitcode;
 
@@ -0,0 +1,276 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "metrics.h"
+
+#define count(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#define value(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+//    Global variables    //
+static char            * PATH      = NULL;   // Metrics file.
+static char            * TMPPATH   = NULL;   // Written, then renamed.
+static double            INTERVAL  = 10.0;   // Seconds between reports.
+static int               STOP      = 0;
+static pthread_t         REPORTER;
+static pthread_mutex_t   MMUTEX    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    MCOND     = PTHREAD_COND_INITIALIZER;
+static struct timespec   ORIGIN;
+// Counters, updated by the workers.
+static const char      * STAGE     = "start";
+static long              JOBS      = 0;
+static long              JOBSDONE  = 0;
+static long              QUERIES   = 0;
+static long              SKIPS     = 0;
+static long              EDGES     = 0;
+// State of the reporter (throughput since the last report).
+static long              LASTQ     = 0;
+static double            LASTT     = 0.0;
+
+void   * metrics_reporter (void *);
+int      metrics_write (void);
+
+
+double
+metrics_elapsed
+(void)
+// SYNOPSIS:
+//   Seconds since the metrics were opened.
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (ts.tv_sec - ORIGIN.tv_sec) + (ts.tv_nsec - ORIGIN.tv_nsec) / 1e9;
+}
+
+
+long
+metrics_rss
+(void)
+// SYNOPSIS:
+//   Resident set size in bytes, or the peak if '/proc' is not
+//   available.
+{
+   long pages;
+   FILE *f = fopen("/proc/self/statm", "r");
+   if (f != NULL) {
+      int ok = fscanf(f, "%*d %ld", &pages) == 1;
+      fclose(f);
+      if (ok) return pages * sysconf(_SC_PAGESIZE);
+   }
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage)) return 0;
+   // Kilobytes on Linux.
+   return usage.ru_maxrss * 1024L;
+}
+
+
+int
+metrics_open
+(
+   const char * path,
+   double       interval
+)
+// SYNOPSIS:
+//   Write the metrics to 'path' every 'interval' seconds until
+//   'metrics_close()' is called.
+//
+// RETURN:
+//   0 upon success, 1 upon failure.
+{
+   PATH = strdup(path);
+   TMPPATH = malloc(strlen(path) + 5);
+   if (PATH == NULL || TMPPATH == NULL) return 1;
+   sprintf(TMPPATH, "%s.tmp", path);
+   INTERVAL = interval;
+   clock_gettime(CLOCK_MONOTONIC, &ORIGIN);
+   STOP = 0;
+   // Fail early if the file cannot be written.
+   if (metrics_write()) return 1;
+   return pthread_create(&REPORTER, NULL, metrics_reporter, NULL) != 0;
+}
+
+
+void
+metrics_stage
+(
+   const char * name
+)
+// SYNOPSIS:
+//   Set the current stage of the run. 'name' must be a string
+//   constant (the pointer is kept).
+{
+   if (PATH == NULL || name == NULL) return;
+   __atomic_store_n(&STAGE, name, __ATOMIC_RELAXED);
+}
+
+
+void
+metrics_jobs
+(
+   int njobs
+)
+// SYNOPSIS:
+//   Add 'njobs' jobs to the total of the run.
+{
+   if (PATH == NULL) return;
+   count(JOBS, njobs);
+}
+
+
+void
+metrics_job_done
+(
+   long queries,
+   long skips,
+   long edges
+)
+// SYNOPSIS:
+//   Count a job with 'queries' queries (of which 'skips' were skipped
+//   thanks to the k-mer index) and 'edges' matching pairs. Thread safe.
+{
+   if (PATH == NULL) return;
+   count(JOBSDONE, 1);
+   count(QUERIES, queries);
+   count(SKIPS, skips);
+   count(EDGES, edges);
+}
+
+
+int
+metrics_write
+(void)
+// SYNOPSIS:
+//   Write the metrics to the temporary file and move it to 'PATH'.
+//
+// RETURN:
+//   0 upon success, 1 upon failure.
+{
+
+   FILE *f = fopen(TMPPATH, "w");
+   if (f == NULL) return 1;
+
+   const double now = metrics_elapsed();
+   const long queries = value(QUERIES);
+   const long skips = value(SKIPS);
+   const double rate = now > LASTT ? (queries - LASTQ) / (now - LASTT) : 0;
+   LASTQ = queries;
+   LASTT = now;
+
+   fprintf(f, "# HELP starcode_stage Current stage of the run.\n"
+         "# TYPE starcode_stage gauge\n"
+         "starcode_stage{stage=\"%s\"} 1\n", value(STAGE));
+   fprintf(f, "# HELP starcode_jobs Search jobs of the run.\n"
+         "# TYPE starcode_jobs gauge\n"
+         "starcode_jobs %ld\n", value(JOBS));
+   fprintf(f, "# HELP starcode_jobs_done_total Search jobs done.\n"
+         "# TYPE starcode_jobs_done_total counter\n"
+         "starcode_jobs_done_total %ld\n", value(JOBSDONE));
+   fprintf(f, "# HELP starcode_queries_total Queries of the jobs.\n"
+         "# TYPE starcode_queries_total counter\n"
+         "starcode_queries_total %ld\n", queries);
+   fprintf(f, "# HELP starcode_lut_skips_total Queries skipped thanks "
+         "to the k-mer index.\n"
+         "# TYPE starcode_lut_skips_total counter\n"
+         "starcode_lut_skips_total %ld\n", skips);
+   fprintf(f, "# HELP starcode_lut_skip_ratio Fraction of the queries "
+         "skipped.\n"
+         "# TYPE starcode_lut_skip_ratio gauge\n"
+         "starcode_lut_skip_ratio %.6f\n",
+         queries > 0 ? (double) skips / queries : 0.0);
+   fprintf(f, "# HELP starcode_edges_total Matching pairs found.\n"
+         "# TYPE starcode_edges_total counter\n"
+         "starcode_edges_total %ld\n", value(EDGES));
+   fprintf(f, "# HELP starcode_queries_per_second Queries per second "
+         "since the previous report.\n"
+         "# TYPE starcode_queries_per_second gauge\n"
+         "starcode_queries_per_second %.1f\n", rate);
+   fprintf(f, "# HELP starcode_rss_bytes Resident set size.\n"
+         "# TYPE starcode_rss_bytes gauge\n"
+         "starcode_rss_bytes %ld\n", metrics_rss());
+   fprintf(f, "# HELP starcode_elapsed_seconds Time since the start.\n"
+         "# TYPE starcode_elapsed_seconds gauge\n"
+         "starcode_elapsed_seconds %.3f\n", now);
+
+   if (fclose(f) != 0) return 1;
+   return rename(TMPPATH, PATH) != 0;
+
+}
+
+
+void *
+metrics_reporter
+(
+   void * args
+)
+// SYNOPSIS:
+//   Thread function of the reporter, write the metrics every
+//   'INTERVAL' seconds until 'metrics_close()' wakes it up.
+{
+   (void) args;
+   pthread_mutex_lock(&MMUTEX);
+   while (!STOP) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      long nsec = ts.tv_nsec + (long) ((INTERVAL - (long) INTERVAL) * 1e9);
+      ts.tv_sec += (long) INTERVAL + nsec / 1000000000L;
+      ts.tv_nsec = nsec % 1000000000L;
+      int rc = pthread_cond_timedwait(&MCOND, &MMUTEX, &ts);
+      if (rc == ETIMEDOUT && !STOP) metrics_write();
+   }
+   pthread_mutex_unlock(&MMUTEX);
+   return NULL;
+}
+
+
+int
+metrics_close
+(void)
+// SYNOPSIS:
+//   Stop the reporter and write the final metrics (with the stage
+//   "done").
+//
+// RETURN:
+//   0 upon success, 1 upon failure.
+{
+   if (PATH == NULL) return 0;
+   pthread_mutex_lock(&MMUTEX);
+   STOP = 1;
+   pthread_cond_signal(&MCOND);
+   pthread_mutex_unlock(&MMUTEX);
+   pthread_join(REPORTER, NULL);
+
+   metrics_stage("done");
+   int status = metrics_write();
+   free(PATH);
+   free(TMPPATH);
+   PATH = TMPPATH = NULL;
+   return status;
+}
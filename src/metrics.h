@@ -0,0 +1,40 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+#ifndef _STARCODE_METRICS_HEADER
+#define _STARCODE_METRICS_HEADER
+
+// Metrics of the run in the text format of Prometheus, for the
+// textfile collector of the node exporter. A reporter thread rewrites
+// the file periodically through a temporary file and a rename, so the
+// collector never reads a partial file. The counters are updated with
+// relaxed atomic additions. All functions do nothing unless
+// 'metrics_open()' was called.
+
+int     metrics_open (const char *, double);
+int     metrics_close (void);
+void    metrics_stage (const char *);
+void    metrics_jobs (int);
+void    metrics_job_done (long, long, long);
+
+#endif
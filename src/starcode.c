@@ -25,12 +25,28 @@
 #include <ctype.h>
 #include <errno.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "bam.h"
+#include "long.h"
 #include "trie.h"
+#include "trace.h"
+#include "metrics.h"
+#include "compress.h"
 #include "starcode.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define alert() fprintf(stderr, "error `%s' in %s() (%s:%d)\n",\
                      strerror(errno), __func__, __FILE__, __LINE__)
 
@@ -43,6 +59,10 @@
 #define TRIE_BUSY 1
 #define TRIE_DONE 2
 
+#define SORT_RUN_SIZE   65536
+#define SMALL_INPUT     5000      // Max sequences for 'small_search()'.
+#define SERVE_MAX_QUERIES (1 << 20) // Max queries of a served request.
+
 #define STRATEGY_EQUAL  1
 #define STRATEGY_PREFIX  99
 
@@ -89,6 +109,7 @@ typedef enum {
    FASTQ,
    RAW,
    PE_FASTQ,
+   BAM,
    UNSET,
 } format_t;
 
@@ -98,9 +119,16 @@ typedef struct match_t match_t;
 typedef struct mtplan_t mtplan_t;
 typedef struct mttrie_t mttrie_t;
 typedef struct mtjob_t mtjob_t;
+typedef struct maskargs_t maskargs_t;
 typedef struct lookup_t lookup_t;
 
 typedef struct sortargs_t sortargs_t;
+typedef struct readargs_t readargs_t;
+typedef struct batchargs_t batchargs_t;
+typedef struct serveargs_t serveargs_t;
+typedef struct sorter_t sorter_t;
+typedef struct sortrun_t sortrun_t;
+typedef struct mergeargs_t mergeargs_t;
 
 
 // The field 'seqid' is either an id number for
@@ -118,9 +146,13 @@ struct useq_t {
   int           *  seqid;
 };
 
+// K-mer index of the tries. Every k-mer of every position has
+// 'ntries' consecutive bits in 'lut[position]', set if a sequence
+// of the block that builds the trie has the k-mer.
 struct lookup_t {
             int    slen;
             int    kmers;
+            int    ntries;
             int  * klen;
    unsigned char * lut[];
 };
@@ -135,10 +167,92 @@ struct sortargs_t {
    int     repeats;
 };
 
+// Sorted runs of the input, made while it is read. The reader
+// hands off batches of 'runsize' sequences, each of them is sorted
+// (and reduced) by its own thread while reading goes on. The runs
+// are merged by 'merge_runs()'. See 'sorter_feed()'.
+struct sorter_t {
+   int               runsize;
+   int               thrmax;
+   int               start;      // First sequence not handed off.
+   int               nruns;
+   int               njoined;    // Runs whose thread is joined.
+   int               nslots;
+   struct sortrun_t * runs;
+};
+
+struct sortrun_t {
+   useq_t         ** items;
+   int               size;
+   int               nuniq;
+   int               threaded;
+   pthread_t         thread;
+};
+
+struct mergeargs_t {
+   useq_t         ** src;
+   useq_t         ** dst;
+   int             * start;
+   int             * len;
+   int               nruns;
+   int               first;
+   int               step;
+};
+
+// Arguments of 'mask_worker()'. The blocks 'first', 'first+step',
+// etc. are processed by the same thread, which owns the index 'own'.
+struct maskargs_t {
+   lookup_t        * lut;
+   lookup_t        * own;
+   useq_t         ** items;
+   int             * bounds;
+   uint32_t        * masks;
+   int             * nsearch;
+   int               first;
+   int               step;
+};
+
+struct readargs_t {
+   FILE           ** inputf1;
+   FILE           ** inputf2;
+   gstack_t       ** useqS;
+   sorter_t       ** sorters;
+   int             * paired;
+   int               ninputs;
+   int               thrmax;
+   format_t          format;
+   int             * next;
+   pthread_mutex_t * mutex;
+};
+
+struct batchargs_t {
+   gstack_t        * inputs;
+   gstack_t        * outputs;
+   int               tau;
+   int               verbose;
+   int               showclusters;
+   int               showids;
+   int               splitsearch;
+   int               maxindels;
+   int             * next;
+   int             * ndone;
+   int             * nfailed;
+   pthread_mutex_t * mutex;
+};
+
+struct serveargs_t {
+   int               sock;
+   trie_t          * trie;
+   int               tau;
+   int               verbose;
+};
+
 struct mtplan_t {
    char              active;
    int               ntries;
    int		     jobsdone;
+   char            * lanes;
+   uint32_t        * masks;
    struct mttrie_t * tries;
    pthread_mutex_t * mutex;
    pthread_cond_t  * monitor;
@@ -158,69 +272,121 @@ struct mtjob_t {
    int                build;
    int                queryid;
    int                trieid;
+   int                lane;
+   int                nsearch;    // Sequences to search.
+   int                indels;     // Max shift (band search) or -1.
+   int                nwords;     // Words per mask.
    gstack_t         * useqS;
    trie_t           * trie;
+   trie_t           * rtrie;      // Reversed sequences (split search).
    node_t           * node_pos;
-   lookup_t         * lut;
+   uint32_t         * masks;
    pthread_mutex_t  * mutex;
    pthread_cond_t   * monitor;
    int	    	    * jobsdone;
    char             * trieflag;
    char             * active;
+   char             * lanes;
 };
 
 int        size_order (const void *a, const void *b);
 int        addmatch (useq_t*, useq_t*, int, int);
+void       link_match (useq_t *, useq_t *, int, int, pthread_mutex_t *,
+              pthread_mutex_t *);
+void       long_search (gstack_t *, int, int);
 int        bisection (int, int, char *, useq_t **, int, int);
 int        canonical_order (const void*, const void*);
 int        cluster_count (const void *, const void *);
 gstack_t * compute_clusters (gstack_t *);
 void       connected_components (useq_t *, gstack_t **);
-long int   count_trie_nodes (useq_t **, int, int);
+long int   count_trie_nodes (useq_t **, int, int, int);
 int        count_order (const void *, const void *);
 int        count_order_spheres (const void *, const void *);
 void       destroy_useq (useq_t *);
 void       destroy_lookup (lookup_t *);
+void     * batch_worker (void *);
+void       destroy_plan (mtplan_t *);
+int        serve_connection (trie_t *, int, FILE *, FILE *);
+void       serve_stop (int);
+void     * serve_worker (void *);
+void       set_stage (const char *);
 void     * do_query (void*);
+int        ingest_seq (char *, size_t);
 int        int_ascending (const void*, const void*);
+int        seqid_order (const void *, const void *);
+void       sort_matches (gstack_t *);
 void       krash (void) __attribute__ ((__noreturn__));
-int        lut_insert (lookup_t *, useq_t *); 
-int        lut_search (lookup_t *, useq_t *); 
+int        lut_insert (lookup_t *, useq_t *, int);
+int        lut_search (lookup_t *, useq_t *, int, uint32_t *);
 void       message_passing_clustering (gstack_t*, int);
-lookup_t * new_lookup (int, int, int);
+lookup_t * new_lookup (int, int, int, int);
 useq_t   * new_useq (int, char *, char *);
-int        pad_useq (gstack_t*, int*);
-mtplan_t * plan_mt (int, int, int, int, gstack_t *);
+useq_t   * new_useq_ingested (int, char *, size_t, char *);
+int        padded_prefix (const char *, const char *, int);
+int        padded_seq2id (char *, int, int, int);
+void     * mask_worker (void *);
+mtplan_t * plan_mt (int, int, int, int, int, gstack_t *);
+int        starcode_job (FILE **, FILE **, int, FILE *, FILE *, int, int,
+              int, int, int, int, int, int);
+int        search_useqs (gstack_t *, int, int, int, int, int);
 void       run_plan (mtplan_t *, int, int);
-gstack_t * read_rawseq (FILE *, gstack_t *);
-gstack_t * read_fasta (FILE *, gstack_t *);
-gstack_t * read_fastq (FILE *, gstack_t *);
-gstack_t * read_file (FILE *, FILE *, int);
-gstack_t * read_PE_fastq (FILE *, FILE *, gstack_t *);
+void       small_search (gstack_t *, int, int, int);
+gstack_t * read_bam (FILE *, gstack_t *, sorter_t *, int, int *);
+gstack_t * read_rawseq (FILE *, gstack_t *, sorter_t *);
+gstack_t * read_fasta (FILE *, gstack_t *, sorter_t *);
+gstack_t * read_fastq (FILE *, gstack_t *, sorter_t *);
+gstack_t * read_file (FILE *, FILE *, sorter_t *, int, int);
+gstack_t * read_files (FILE **, FILE **, int, sorter_t *, int, int);
+void     * read_worker (void *);
+format_t   guess_format (FILE *);
+gstack_t * read_PE_fastq (FILE *, FILE *, gstack_t *, sorter_t *);
 int        seq2id (char *, int);
 gstack_t * seq2useq (gstack_t*, int);
 int        seqsort (useq_t **, int, int);
+int        merge_runs (sorter_t *, useq_t **, int);
+void     * merge_worker (void *);
+sorter_t * new_sorter (int, int);
+void       destroy_sorter (sorter_t *);
+void       sorter_feed (sorter_t *, gstack_t *);
+void       sorter_flush (sorter_t *, gstack_t *);
+void       shift_seqids (useq_t *, int);
+int        first_seqid (useq_t *);
+int        emit_clusters (gstack_t *, int, const starcode_callbacks_t *);
+int        emit_cluster (useq_t *, gstack_t *, int,
+              const starcode_callbacks_t *);
+int        emit_ids (useq_t *, int, const starcode_callbacks_t *);
+int        fill_cluster (const starcode_cluster_t *, void *);
+int        fill_assign (int, int, void *);
+void     * sort_run (void *);
 void       sphere_clustering (gstack_t *, int);
 void       transfer_counts_and_update_canonicals (useq_t*, int);
 void       transfer_useq_ids (useq_t *, useq_t *);
-void       unpad_useq (gstack_t*);
+int        useq_lengths (gstack_t*, int*);
 void     * nukesort (void *); 
 
 
 //    Global variables    //
-static FILE     * OUTPUTF1      = NULL;           // output file 1
-static FILE     * OUTPUTF2      = NULL;           // output file 2
-static format_t   FORMAT        = UNSET;          // input format
 static output_t   OUTPUTT       = DEFAULT_OUTPUT; // output type
 static cluster_t  CLUSTERALG    = MP_CLUSTER;     // cluster algorithm
 static int        CLUSTER_RATIO = 5;              // min parent/child ratio
                                                   // to link clusters
+static int        LONGMODE      = 0;              // long sequences
+static char        SOCKETPATH[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+
+// The variables below describe the input of a run, they are local
+// to the thread of the run (see 'starcode_batch()').
+static __thread FILE     * OUTPUTF1    = NULL;    // output file 1
+static __thread FILE     * OUTPUTF2    = NULL;    // output file 2
+static __thread format_t   FORMAT      = UNSET;   // input format
+static __thread int        SPLITSEARCH = 0;       // split-budget search
+static __thread int        MAXINDELS   = -1;      // band search
 
 int
 starcode
 (
-   FILE *inputf1,
-   FILE *inputf2,
+   FILE **inputf1,
+   FILE **inputf2,
+   const int ninputs,
    FILE *outputf1,
    FILE *outputf2,
          int tau,
@@ -230,58 +396,104 @@ starcode
          int parent_to_child,
    const int showclusters,
    const int showids,
-   const int outputt
+   const int outputt,
+   const int splitsearch,
+   const int longmode,
+   const int maxindels
 )
 {
 
-   OUTPUTF1 = outputf1;
-   OUTPUTF2 = outputf2;
    OUTPUTT = outputt;
    CLUSTERALG = clusteralg;
    CLUSTER_RATIO = parent_to_child;
+   LONGMODE = longmode;
+
+   return starcode_job(inputf1, inputf2, ninputs, outputf1, outputf2,
+         tau, verbose, thrmax, showclusters, showids, splitsearch,
+         maxindels, 0);
+
+}
+
+
+void
+set_stage
+(
+   const char * name
+)
+// SYNOPSIS:
+//   Mark the start of a stage in the trace and in the metrics. The
+//   stage 'name' must be a string constant.
+{
+   trace_stage(name);
+   metrics_stage(name);
+}
+
+
+int
+starcode_job
+(
+   FILE **inputf1,
+   FILE **inputf2,
+   const int ninputs,
+   FILE *outputf1,
+   FILE *outputf2,
+         int tau,
+   const int verbose,
+         int thrmax,
+   const int showclusters,
+   const int showids,
+   const int splitsearch,
+   const int maxindels,
+   const int cleanup
+)
+// SYNOPSIS:
+//   Body of 'starcode()' once the options shared by all the runs
+//   of the process are set. If 'cleanup' is set, all the memory of
+//   the run is freed before returning (by default, the memory is
+//   left to the end of the process).
+{
+
+   OUTPUTF1 = outputf1;
+   OUTPUTF2 = outputf2;
+   SPLITSEARCH = splitsearch;
 
    if (verbose) {
       fprintf(stderr, "running starcode with %d thread%s\n",
            thrmax, thrmax > 1 ? "s" : "");
       fprintf(stderr, "reading input files\n");
    }
-   gstack_t *uSQ = read_file(inputf1, inputf2, verbose);
+   set_stage("read");
+   // Runs of the input are sorted while it is read.
+   sorter_t *sorter = new_sorter(SORT_RUN_SIZE, thrmax);
+   gstack_t *uSQ = read_files(inputf1, inputf2, ninputs, sorter,
+         thrmax, verbose);
    if (uSQ == NULL || uSQ->nitems < 1) {
       fprintf(stderr, "input file empty\n");
+      destroy_sorter(sorter);
+      if (cleanup) free(uSQ);
       return 1;
    }
 
-   // Sort/reduce.
+   // Sort/reduce (merge the sorted runs).
    if (verbose) fprintf(stderr, "sorting\n");
-   uSQ->nitems = seqsort((useq_t **) uSQ->items, uSQ->nitems, thrmax);
-
-   // Get number of tries.
-   int ntries = 3 * thrmax + (thrmax % 2 == 0);
-   if (uSQ->nitems < ntries) {
-      ntries = 1;
-      thrmax = 1;
-   }
- 
-   // Pad sequences (and return the median size).
-   // Compute 'tau' from it in "auto" mode.
-   int med = -1;
-   int height = pad_useq(uSQ, &med);
-   if (tau < 0) {
-      tau = med > 160 ? 8 : 2 + med/30;
-      if (verbose) {
-         fprintf(stderr, "setting dist to %d\n", tau);
+   set_stage("sort");
+   uSQ->nitems = merge_runs(sorter, (useq_t **) uSQ->items, thrmax);
+   destroy_sorter(sorter);
+
+   // The clustering can remove sequences from 'uSQ', keep
+   // a copy of the stack to free them.
+   gstack_t *all = NULL;
+   if (cleanup) {
+      all = malloc(gstack_size(uSQ->nitems));
+      if (all == NULL) {
+         alert();
+         krash();
       }
+      all->nslots = all->nitems = uSQ->nitems;
+      memcpy(all->items, uSQ->items, uSQ->nitems * sizeof(void *));
    }
-   
-   // Make multithreading plan.
-   mtplan_t *mtplan = plan_mt(tau, height, med, ntries, uSQ);
 
-   // Run the query.
-   run_plan(mtplan, verbose, thrmax);
-   if (verbose) fprintf(stderr, "progress: 100.00%%\n");
-
-   // Remove padding characters.
-   unpad_useq(uSQ);
+   search_useqs(uSQ, tau, verbose, thrmax, maxindels, cleanup);
 
    /*
     *  MESSAGE PASSING ALGORITHM
@@ -290,18 +502,18 @@ starcode
    if (CLUSTERALG == MP_CLUSTER) {
 
       if (verbose) fprintf(stderr, "message passing clustering\n");
+      set_stage("cluster");
       // Cluster the pairs.
       message_passing_clustering(uSQ, showids);
       // Sort in canonical order.
       qsort(uSQ->items, uSQ->nitems, sizeof(useq_t *), canonical_order);
+      set_stage("output");
 
-      if (OUTPUTT == DEFAULT_OUTPUT) {
-         useq_t *first = (useq_t *) uSQ->items[0];
+      // If the first canonical is NULL they all are.
+      useq_t *first = (useq_t *) uSQ->items[0];
+      if (OUTPUTT == DEFAULT_OUTPUT && first->canonical != NULL) {
          useq_t *canonical = first->canonical;
 
-         // If the first canonical is NULL they all are.
-         if (first->canonical == NULL) return 0;
-
          if (FORMAT == PE_FASTQ) {
             if (showclusters) {
                fprintf(OUTPUTF1, "%s\t%d\t%s",
@@ -402,10 +614,12 @@ starcode
 
    } else if (CLUSTERALG == SPHERES_CLUSTER) {
       if (verbose) fprintf(stderr, "spheres clustering\n");
+      set_stage("cluster");
       // Cluster the pairs.
       sphere_clustering(uSQ, showids);
       // Sort in count order.
       qsort(uSQ->items, uSQ->nitems, sizeof(useq_t *), count_order);
+      set_stage("output");
 
       // Default output.
       if (OUTPUTT == DEFAULT_OUTPUT) {
@@ -457,11 +671,13 @@ starcode
 
    } else if (CLUSTERALG == COMPONENTS_CLUSTER) {
       if (verbose) fprintf(stderr, "connected components clustering\n");
+      set_stage("cluster");
       // Cluster connected components.
       // Returns a stack containing stacks of clusters, where clusters->item[i]->item[0] is
       // the centroid of the i-th cluster. The output is sorted by cluster count, which is
       // stored in centroid->count.
       gstack_t * clusters = compute_clusters(uSQ);
+      set_stage("output");
 
       // Default output.
       if (OUTPUTT == DEFAULT_OUTPUT) {
@@ -485,6 +701,12 @@ starcode
          for (int i = 0 ; i < clusters->nitems ; i++)
             push(((gstack_t *)clusters->items[i])->items[0], &uSQ);
       }
+      if (cleanup) {
+         for (int i = 0 ; i < clusters->nitems ; i++) {
+            free(clusters->items[i]);
+         }
+         free(clusters);
+      }
    }
 
    /*
@@ -493,6 +715,7 @@ starcode
 
    if (OUTPUTT == NRED_OUTPUT) {
       if (verbose) fprintf(stderr, "non-redundant output\n");
+      set_stage("output");
       // If print non redundant sequences, just print the
       // canonicals with their info.
       for (int i = 0 ; i < uSQ->nitems ; i++) {
@@ -515,6 +738,9 @@ starcode
                     header, u->seq, quality);
          }
          else if (FORMAT == PE_FASTQ) {
+            // Paired-end reads from a single BAM file
+            // are written interleaved to the output.
+            FILE *outputf2 = OUTPUTF2 != NULL ? OUTPUTF2 : OUTPUTF1;
             char head1[M] = {0};
             char head2[M] = {0};
             char qual1[M] = {0};
@@ -539,214 +765,1362 @@ starcode
             // Print to separate files.
             fprintf(OUTPUTF1, "%s\n%s\n+\n%s\n",
                     head1, seq1, qual1);
-            fprintf(OUTPUTF2, "%s\n%s\n+\n%s\n",
+            fprintf(outputf2, "%s\n%s\n+\n%s\n",
                     head2, seq2, qual2);
          }
       }
    }
 
-   // Do not free anything.
+   // Do not free anything (unless asked to).
+   if (cleanup) {
+      for (int i = 0 ; i < all->nitems ; i++) destroy_useq(all->items[i]);
+      free(all);
+      free(uSQ);
+   }
+   set_stage(NULL);
    OUTPUTF1 = NULL;
    OUTPUTF2 = NULL;
    return 0;
 
 }
 
-void
-run_plan
+int
+search_useqs
 (
-   mtplan_t *mtplan,
-   const int verbose,
-   const int thrmax
+         gstack_t * uSQ,
+         int        tau,
+   const int        verbose,
+         int        thrmax,
+   const int        maxindels,
+   const int        cleanup
 )
+// SYNOPSIS:
+//   Find the pairs of sequences within distance 'tau' in 'uSQ' (sorted
+//   and reduced) with the search that suits the input ('LONGMODE',
+//   'SPLITSEARCH' and 'MAXINDELS'). The pairs are recorded in the field
+//   'matches' of the sequences. If 'cleanup' is set, the plan is freed.
+//
+// RETURN:
+//   The distance of the search ('tau' is computed from the median
+//   length of the sequences if it is negative).
 {
-   // Count total number of jobs.
-   int njobs = mtplan->ntries * (mtplan->ntries+1) / 2;
-
-   // Thread Scheduler
-   int triedone = 0;
-   int idx = -1;
-
-   while (triedone < mtplan->ntries) { 
-      // Cycle through the tries in turn.
-      idx = (idx+1) % mtplan->ntries;
-      mttrie_t *mttrie = mtplan->tries + idx;
-      pthread_mutex_lock(mtplan->mutex);     
 
-      // Check whether trie is idle and there are available threads.
-      if (mttrie->flag == TRIE_FREE && mtplan->active < thrmax) {
+   // Get number of tries.
+   int ntries = 3 * thrmax + (thrmax % 2 == 0);
+   if (uSQ->nitems < ntries) {
+      ntries = 1;
+      thrmax = 1;
+   }
+ 
+   // Get the maximum and median lengths. Sequences are not
+   // padded, the trie uses the maximum length as its height.
+   // Compute 'tau' from the median in "auto" mode.
+   int med = -1;
+   set_stage("plan");
+   int height = useq_lengths(uSQ, &med);
+   if (tau < 0) {
+      tau = med > 160 ? 8 : 2 + med/30;
+      if (verbose) {
+         fprintf(stderr, "setting dist to %d\n", tau);
+      }
+   }
 
-         // No more jobs on this trie.
-         if (mttrie->currentjob == mttrie->njobs) {
-            mttrie->flag = TRIE_DONE;
-            triedone++;
-         }
+   // The shortest sequence is the first after sorting.
+   const int shortest = strlen(((useq_t *) uSQ->items[0])->seq);
+
+   // Sequences shorter than a window have no minimizer, so the
+   // minimizer engine would miss all their pairs. Use the tries
+   // instead ('LONGMODE' is shared by the jobs of batch mode).
+   int longmode = LONGMODE;
+   if (longmode && shortest < LONG_K + LONG_W - 1) {
+      longmode = 0;
+      fprintf(stderr, "warning: sequences shorter than %d nt, "
+            "--long disabled\n", LONG_K + LONG_W - 1);
+   }
 
-         // Some more jobs to do.
-         else {
-            mttrie->flag = TRIE_BUSY;
-            mtplan->active++;
-            mtjob_t *job = mttrie->jobs + mttrie->currentjob++;
-            pthread_t thread;
-            // Start job and detach thread.
-            if (pthread_create(&thread, NULL, do_query, job)) {
-               alert();
-               krash();
-            }
-            pthread_detach(thread);
-            if (verbose) {
-               fprintf(stderr, "progress: %.2f%% \r",
-                     100*(float)(mtplan->jobsdone)/njobs);
-            }
-         }
+   // The split search needs sequences of the same length.
+   int fixed = shortest == height;
+   if (SPLITSEARCH && !longmode && !fixed) {
+      SPLITSEARCH = 0;
+      if (verbose) {
+         fprintf(stderr, "variable length, split search disabled\n");
       }
+   }
 
-      // If max thread number is reached, wait for a thread.
-      while (mtplan->active == thrmax) {
-         pthread_cond_wait(mtplan->monitor, mtplan->mutex);
+   // The band search also needs sequences of the same length. It is
+   // only useful if the shift is smaller than the distance, and then
+   // it replaces the split search.
+   MAXINDELS = -1;
+   if (maxindels >= 0 && maxindels < tau && !longmode) {
+      if (fixed) {
+         MAXINDELS = maxindels;
+         SPLITSEARCH = 0;
       }
-
-      pthread_mutex_unlock(mtplan->mutex);
-
+      else if (verbose) {
+         fprintf(stderr, "variable length, --max-indels ignored\n");
+      }
+   }
+   
+   if (longmode) {
+      // Long sequences do not use the tries.
+      set_stage("search");
+      long_search(uSQ, tau, thrmax);
+   }
+   else if (uSQ->nitems <= SMALL_INPUT) {
+      // Small inputs are searched in a single trie.
+      set_stage("search");
+      small_search(uSQ, tau, height, med);
+   }
+   else {
+      // Make multithreading plan.
+      mtplan_t *mtplan = plan_mt(tau, height, med, ntries, thrmax, uSQ);
+
+      // Run the query.
+      set_stage("search");
+      run_plan(mtplan, verbose, thrmax);
+      if (verbose) fprintf(stderr, "progress: 100.00%%\n");
+      if (cleanup) destroy_plan(mtplan);
    }
 
-   return;
+   // The matches are recorded in the order of the jobs, which
+   // depends on the number of threads.
+   sort_matches(uSQ);
+
+   return tau;
 
 }
 
 
-void *
-do_query
+int
+starcode_batch
 (
-   void * args
-)  
+   const char * manifest,
+         int    tau,
+   const int    verbose,
+   const int    thrmax,
+   const int    clusteralg,
+   const int    parent_to_child,
+   const int    showclusters,
+   const int    showids,
+   const int    outputt,
+   const int    splitsearch,
+   const int    longmode,
+   const int    maxindels
+)
+// SYNOPSIS:
+//   Run 'starcode()' on every input of the manifest with the same
+//   options. Each line of the manifest is the path of an input file
+//   and the path of the output file, separated by a tab (empty lines
+//   and lines starting with '#' are skipped). The runs are independent
+//   and share a pool of 'thrmax' threads, each run uses one thread
+//   and frees its memory when it is done.
+//
+// RETURN:
+//   0 if all the runs succeeded, 1 otherwise.
 {
-   // Unpack arguments.
-   mtjob_t  * job    = (mtjob_t*) args;
-   gstack_t * useqS  = job->useqS;
-   trie_t   * trie   = job->trie;
-   lookup_t * lut    = job->lut;
-   const int  tau    = job->tau;
-   node_t * node_pos = job->node_pos;
 
-   // Create local hit stack.
-   gstack_t **hits = new_tower(tau+1);
-   if (hits == NULL) {
+   OUTPUTT = outputt;
+   CLUSTERALG = clusteralg;
+   CLUSTER_RATIO = parent_to_child;
+   LONGMODE = longmode;
+
+   FILE *f = fopen(manifest, "r");
+   if (f == NULL) {
+      fprintf(stderr, "cannot open manifest %s\n", manifest);
+      return 1;
+   }
+
+   gstack_t *inputs = new_gstack();
+   gstack_t *outputs = new_gstack();
+   if (inputs == NULL || outputs == NULL) {
       alert();
       krash();
    }
 
-   // Define a constant to help the compiler recognize
-   // that only one of the two cases will ever be used
-   // in the loop below.
-   const int bidir_match = (CLUSTERALG == SPHERES_CLUSTER || CLUSTERALG == COMPONENTS_CLUSTER);
-   useq_t * last_query = NULL;
-
-   for (int i = job->start ; i <= job->end ; i++) {
-      useq_t *query = (useq_t *) useqS->items[i];
-      int do_search = lut_search(lut, query) == 1;
-
-      // Insert the new sequence in the lut and trie, but let
-      // the last pointer to NULL so that the query does not
-      // find itself upon search.
-      void **data = NULL;
-      if (job->build) {
-         if (lut_insert(lut, query)) {
-            alert();
-            krash();
-         }
-         data = insert_string_wo_malloc(trie, query->seq, &node_pos);
-         if (data == NULL || *data != NULL) {
+   int status = 0;
+   int lineno = 0;
+   ssize_t nread;
+   size_t nchar = M;
+   char *line = malloc(M * sizeof(char));
+   if (line == NULL) {
+      alert();
+      krash();
+   }
+   while ((nread = getline(&line, &nchar, f)) != -1) {
+      lineno++;
+      if (nread > 0 && line[nread-1] == '\n') line[--nread] = '\0';
+      if (nread > 0 && line[nread-1] == '\r') line[--nread] = '\0';
+      if (nread == 0 || line[0] == '#') continue;
+      char *tab = strchr(line, '\t');
+      if (tab == NULL || tab == line || tab[1] == '\0') {
+         fprintf(stderr, "manifest line %d: expected input and output "
+               "separated by a tab\n", lineno);
+         status = 1;
+         break;
+      }
+      *tab = '\0';
+      char *input = strdup(line);
+      char *output = strdup(tab+1);
+      if (input == NULL || output == NULL ||
+            push(input, &inputs) || push(output, &outputs)) {
+         alert();
+         krash();
+      }
+   }
+   free(line);
+   fclose(f);
+
+   const int njobs = inputs->nitems;
+   if (status == 0 && njobs > 0) {
+      int next = 0;
+      int ndone = 0;
+      int nfailed = 0;
+      pthread_mutex_t mutex;
+      pthread_mutex_init(&mutex, NULL);
+      batchargs_t args = {
+         .inputs       = inputs,
+         .outputs      = outputs,
+         .tau          = tau,
+         .verbose      = verbose,
+         .showclusters = showclusters,
+         .showids      = showids,
+         .splitsearch  = splitsearch,
+         .maxindels    = maxindels,
+         .next         = &next,
+         .ndone        = &ndone,
+         .nfailed      = &nfailed,
+         .mutex        = &mutex,
+      };
+
+      int nthreads = min(thrmax, njobs);
+      if (verbose) {
+         fprintf(stderr, "running %d jobs with %d thread%s\n",
+               njobs, nthreads, nthreads > 1 ? "s" : "");
+      }
+      pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+      if (threads == NULL) {
+         alert();
+         krash();
+      }
+      for (int i = 0 ; i < nthreads ; i++) {
+         if (pthread_create(threads+i, NULL, batch_worker, &args)) {
             alert();
             krash();
          }
       }
+      for (int i = 0 ; i < nthreads ; i++) {
+         pthread_join(threads[i], NULL);
+      }
+      pthread_mutex_destroy(&mutex);
+      free(threads);
 
-      if (do_search) {
-         int trail = 0;
-         if (i < job->end) {
-            useq_t *next_query = (useq_t *) useqS->items[i+1];
-            // The 'while' condition is guaranteed to be false
-            // before the end of the 'char' arrays because all
-            // the queries have the same length and are different.
-            while (query->seq[trail] == next_query->seq[trail]) {
-               trail++;
-            }
-         }
-
-         // Compute start height.
-         int start = 0;
-         if (last_query != NULL) {
-            while(query->seq[start] == last_query->seq[start]) start++;
-         }
+      if (verbose) fprintf(stderr, "progress: 100.00%%\n");
+      if (nfailed > 0) {
+         fprintf(stderr, "%d of %d jobs failed\n", nfailed, njobs);
+         status = 1;
+      }
+   }
 
-         // Clear hit stack. //
-         for (int j = 0 ; hits[j] != TOWER_TOP ; j++) {
-            hits[j]->nitems = 0;
-         }
+   for (int i = 0 ; i < njobs ; i++) {
+      free(inputs->items[i]);
+      free(outputs->items[i]);
+   }
+   free(inputs);
+   free(outputs);
 
-         // Search the trie. //
-         int err = search(trie, query->seq, tau, hits, start, trail);
-         if (err) {
-            alert();
-            krash();
-         }
+   return status;
 
-         for (int j = 0 ; hits[j] != TOWER_TOP ; j++) {
-            if (hits[j]->nitems > hits[j]->nslots) {
-               fprintf(stderr, "warning: incomplete search (%s)\n",
-                       query->seq);
-               break;
-            }
-         }
+}
 
-         // Link matching pairs for clustering.
-         // Skip dist = 0, as this would be self.
-         for (int dist = 1 ; dist < tau+1 ; dist++) {
-         for (int j = 0 ; j < hits[dist]->nitems ; j++) {
 
-            useq_t *match = (useq_t *) hits[dist]->items[j];
-            if (bidir_match) {
-               // Make a bidirectional match reference.
-               // Add reference from query to matched node.
-               pthread_mutex_lock(job->mutex + job->queryid);
-               if (addmatch(query, match, dist, tau)) {
-                  fprintf(stderr,
-                        "Please contact guillaume.filion@gmail.com "
-                        "for support with this issue.\n");
-                  abort();
-               }
-               pthread_mutex_unlock(job->mutex + job->queryid);
-               // Add reference from matched node to query.
-               pthread_mutex_lock(job->mutex + job->trieid);
-               if (addmatch(match, query, dist, tau)) {
-                  fprintf(stderr,
-                        "Please contact guillaume.filion@gmail.com "
-                        "for support with this issue.\n");
-                  abort();
-               }
-               pthread_mutex_unlock(job->mutex + job->trieid);
-            }
+void *
+batch_worker
+(
+   void * args
+)
+// SYNOPSIS:
+//   Thread function of 'starcode_batch()'. Take the next job of the
+//   manifest and run it, until none is left.
+{
 
-            else {
-               useq_t *parent = match->count > query->count ? match : query;
-               useq_t *child  = match->count > query->count ? query : match;
-               // If clustering is done by message passing, do not link
-               // pair if counts are on the same order of magnitude.
-               int mincount = child->count;
-               int maxcount = parent->count;
-               if (maxcount < CLUSTER_RATIO * mincount) continue;
-               // The child is modified, use the child mutex.
-               int mutexid = match->count > query->count ?
-                             job->queryid : job->trieid;
-               pthread_mutex_lock(job->mutex + mutexid);
-               if (addmatch(child, parent, dist, tau)) {
-                  fprintf(stderr,
-                        "Please contact guillaume.filion@gmail.com "
-                        "for support with this issue.\n");
-                  abort();
-               }
-               pthread_mutex_unlock(job->mutex + mutexid);
+   batchargs_t *batchargs = (batchargs_t *) args;
+   const int njobs = batchargs->inputs->nitems;
+
+   while (1) {
+      pthread_mutex_lock(batchargs->mutex);
+      int i = (*batchargs->next)++;
+      pthread_mutex_unlock(batchargs->mutex);
+      if (i >= njobs) return NULL;
+
+      const char *input = batchargs->inputs->items[i];
+      const char *output = batchargs->outputs->items[i];
+      int failed = 1;
+      FILE *inputf = fopen(input, "r");
+      FILE *outputf = inputf == NULL ? NULL : fopen(output, "w");
+      // Compress by the extension of the output ('.gz' or '.zst').
+      if (outputf != NULL) {
+         FILE *stream = compress_open(outputf, compress_suffix(output), 1);
+         if (stream == NULL) fclose(outputf);
+         outputf = stream;
+      }
+      if (inputf == NULL) {
+         fprintf(stderr, "cannot open file %s\n", input);
+      }
+      else if (outputf == NULL) {
+         fprintf(stderr, "cannot write to file %s\n", output);
+      }
+      else {
+         failed = starcode_job(&inputf, NULL, 1, outputf, NULL,
+               batchargs->tau, 0, 1, batchargs->showclusters,
+               batchargs->showids, batchargs->splitsearch,
+               batchargs->maxindels, 1);
+         if (failed) fprintf(stderr, "job failed: %s\n", input);
+      }
+      if (inputf != NULL) fclose(inputf);
+      if (outputf != NULL && fclose(outputf) != 0) {
+         fprintf(stderr, "cannot write to file %s\n", output);
+         failed = 1;
+      }
+
+      pthread_mutex_lock(batchargs->mutex);
+      *batchargs->nfailed += failed;
+      int ndone = ++(*batchargs->ndone);
+      if (batchargs->verbose) {
+         fprintf(stderr, "progress: %.2f%% \r", 100.0 * ndone / njobs);
+      }
+      pthread_mutex_unlock(batchargs->mutex);
+   }
+
+}
+
+
+int
+starcode_cluster
+(
+   const char   * seqs,
+   const size_t   width,
+   const int    * counts,
+   const int      nseq,
+         int      tau,
+   const int      thrmax,
+   const int      clusteralg,
+   const int      parent_to_child,
+         int    * clusters,
+         int    * canonicals,
+         int    * sizes
+)
+// SYNOPSIS:
+//   Cluster sequences held in memory, without reading or writing any
+//   file. The 'nseq' sequences are stored every 'width' bytes of 'seqs'
+//   and end at the first NUL byte or after 'width' bytes (as in a numpy
+//   array of type 'S'). 'counts' holds the count of every sequence, or
+//   is NULL if they are all 1.
+//
+//   The clusters are in the same order as the output of 'starcode()':
+//   'canonicals' holds the index of their canonical sequence and
+//   'sizes' their count. 'clusters' holds the cluster of
+//   every sequence, or -1 if the sequence is not assigned (as with the
+//   ambiguous sequences of message passing). The three arrays must have
+//   room for 'nseq' values.
+//
+//   The clustering options are shared by the process, so concurrent
+//   calls must use the same 'clusteralg' and 'parent_to_child'.
+//
+// RETURN:
+//   The number of clusters, or -1 if a sequence or a count is invalid.
+{
+
+   CLUSTERALG = clusteralg;
+   CLUSTER_RATIO = parent_to_child;
+   LONGMODE = 0;
+   SPLITSEARCH = 0;
+
+   gstack_t *uSQ = malloc(gstack_size(max(nseq, 1)));
+   if (uSQ == NULL) {
+      alert();
+      krash();
+   }
+   uSQ->nslots = max(nseq, 1);
+   uSQ->nitems = 0;
+
+   // The sequence ids are the indices plus 1 (see 'useq_t').
+   char seq[M];
+   for (int i = 0 ; i < nseq ; i++) {
+      const char *s = seqs + i * width;
+      size_t len = strnlen(s, width);
+      int count = counts == NULL ? 1 : counts[i];
+      if (len == 0 || len > MAXBRCDLEN || count < 1) {
+         fprintf(stderr, "invalid sequence or count at index %d\n", i);
+         break;
+      }
+      memcpy(seq, s, len);
+      if (ingest_seq(seq, len)) {
+         fprintf(stderr, "invalid sequence at index %d\n", i);
+         break;
+      }
+      useq_t *u = new_useq_ingested(count, seq, len, NULL);
+      u->nids = 1;
+      u->seqid = (void *)(unsigned long) (i+1);
+      uSQ->items[uSQ->nitems++] = u;
+   }
+   if (uSQ->nitems < nseq) {
+      for (int i = 0 ; i < uSQ->nitems ; i++) destroy_useq(uSQ->items[i]);
+      free(uSQ);
+      return -1;
+   }
+   if (nseq == 0) {
+      free(uSQ);
+      return 0;
+   }
+
+   uSQ->nitems = seqsort((useq_t **) uSQ->items, uSQ->nitems, thrmax);
+   search_useqs(uSQ, tau, 0, thrmax, -1, 1);
+
+   int *results[] = {clusters, canonicals, sizes};
+   starcode_callbacks_t callbacks = {
+      .cluster = fill_cluster,
+      .assign  = fill_assign,
+      .data    = results,
+   };
+   int ncl = emit_clusters(uSQ, clusteralg, &callbacks);
+
+   for (int i = 0 ; i < uSQ->nitems ; i++) destroy_useq(uSQ->items[i]);
+   free(uSQ);
+   return ncl;
+
+}
+
+
+int
+fill_cluster
+(
+   const starcode_cluster_t * cluster,
+         void               * data
+)
+// SYNOPSIS:
+//   Callback of 'starcode_cluster()', fill the arrays of the clusters.
+{
+   int **results = (int **) data;
+   results[1][cluster->number] = cluster->canonical_id - 1;
+   results[2][cluster->number] = cluster->count;
+   return 0;
+}
+
+
+int
+fill_assign
+(
+   int    seqid,
+   int    cluster,
+   void * data
+)
+// SYNOPSIS:
+//   Callback of 'starcode_cluster()', fill the array of the sequences.
+{
+   int **results = (int **) data;
+   results[0][seqid-1] = cluster;
+   return 0;
+}
+
+
+int
+starcode_stream
+(
+         FILE                 ** inputf1,
+         FILE                 ** inputf2,
+   const int                     ninputs,
+         int                     tau,
+   const int                     verbose,
+   const int                     thrmax,
+   const int                     clusteralg,
+   const int                     parent_to_child,
+   const starcode_callbacks_t  * callbacks
+)
+// SYNOPSIS:
+//   Same as 'starcode()', but the clusters and the assignments of the
+//   reads are passed to the callbacks (see 'starcode.h') as soon as
+//   they are complete, instead of being written to a file. The order
+//   is the same as in the output of 'starcode()'. The memory is freed
+//   before returning. As in 'starcode_cluster()', the clustering
+//   options are shared by the process.
+//
+// RETURN:
+//   0 if the run completed, 1 if the input is empty or invalid, or if
+//   a callback stopped the run.
+{
+
+   OUTPUTT = DEFAULT_OUTPUT;
+   CLUSTERALG = clusteralg;
+   CLUSTER_RATIO = parent_to_child;
+   LONGMODE = 0;
+   SPLITSEARCH = 0;
+
+   sorter_t *sorter = new_sorter(SORT_RUN_SIZE, thrmax);
+   gstack_t *uSQ = read_files(inputf1, inputf2, ninputs, sorter,
+         thrmax, verbose);
+   if (uSQ == NULL || uSQ->nitems < 1) {
+      fprintf(stderr, "input file empty\n");
+      destroy_sorter(sorter);
+      free(uSQ);
+      return 1;
+   }
+   uSQ->nitems = merge_runs(sorter, (useq_t **) uSQ->items, thrmax);
+   destroy_sorter(sorter);
+
+   search_useqs(uSQ, tau, verbose, thrmax, -1, 1);
+   int status = emit_clusters(uSQ, clusteralg, callbacks) < 0;
+
+   for (int i = 0 ; i < uSQ->nitems ; i++) destroy_useq(uSQ->items[i]);
+   free(uSQ);
+   return status;
+
+}
+
+
+int
+emit_clusters
+(
+         gstack_t             * uSQ,
+   const int                    clusteralg,
+   const starcode_callbacks_t * callbacks
+)
+// SYNOPSIS:
+//   Cluster the sequences of 'uSQ' once they are searched, and pass
+//   every cluster to the callbacks as soon as it is complete, in the
+//   order of the output of 'starcode()'. The sequence ids are not
+//   transferred (see 'message_passing_clustering()'), so the reads
+//   of every unique sequence are assigned to its own cluster. The
+//   sequences stay in 'uSQ' (in a different order).
+//
+// RETURN:
+//   The number of clusters, or -1 if a callback stopped the run.
+{
+
+   int ncl = 0;
+   int status = 0;
+   gstack_t *members = new_gstack();
+   if (members == NULL) {
+      alert();
+      krash();
+   }
+
+   if (clusteralg == MP_CLUSTER) {
+      message_passing_clustering(uSQ, 0);
+      // The clusters are contiguous in canonical order, and
+      // the unassigned sequences are at the end.
+      qsort(uSQ->items, uSQ->nitems, sizeof(useq_t *), canonical_order);
+      int i = 0;
+      while (i < uSQ->nitems && status == 0) {
+         useq_t *canonical = ((useq_t *) uSQ->items[i])->canonical;
+         if (canonical == NULL) break;
+         members->nitems = 0;
+         for ( ; i < uSQ->nitems ; i++) {
+            useq_t *u = (useq_t *) uSQ->items[i];
+            if (u->canonical != canonical) break;
+            push(u, &members);
+         }
+         status = emit_cluster(canonical, members, ncl++, callbacks);
+      }
+      for ( ; i < uSQ->nitems && status == 0 ; i++) {
+         status = emit_ids(uSQ->items[i], -1, callbacks);
+      }
+   }
+   else if (clusteralg == SPHERES_CLUSTER) {
+      sphere_clustering(uSQ, 0);
+      qsort(uSQ->items, uSQ->nitems, sizeof(useq_t *), count_order);
+      for (int i = 0 ; i < uSQ->nitems && status == 0 ; i++) {
+         useq_t *u = (useq_t *) uSQ->items[i];
+         if (u->canonical != u) break;
+         members->nitems = 0;
+         push(u, &members);
+         gstack_t *hits;
+         for (int j = 0 ; u->matches != NULL &&
+               (hits = u->matches[j]) != TOWER_TOP ; j++) {
+            for (int k = 0 ; k < hits->nitems ; k++) {
+               useq_t *match = (useq_t *) hits->items[k];
+               if (match->canonical == u) push(match, &members);
+            }
+         }
+         status = emit_cluster(u, members, ncl++, callbacks);
+      }
+   }
+   else {
+      // The centroid is the first sequence of the components.
+      gstack_t *clusters = compute_clusters(uSQ);
+      for (int i = 0 ; i < clusters->nitems ; i++) {
+         gstack_t *cluster = (gstack_t *) clusters->items[i];
+         if (status == 0) {
+            status = emit_cluster(cluster->items[0], cluster, ncl++,
+                  callbacks);
+         }
+         free(cluster);
+      }
+      free(clusters);
+   }
+
+   free(members);
+   return status ? -1 : ncl;
+
+}
+
+
+int
+emit_cluster
+(
+         useq_t               * canonical,
+         gstack_t             * members,
+   const int                    number,
+   const starcode_callbacks_t * callbacks
+)
+// SYNOPSIS:
+//   Pass a cluster and then the reads of its members to the callbacks.
+//
+// RETURN:
+//   The return value of the first callback that is non-zero, or 0.
+{
+
+   if (callbacks->cluster != NULL) {
+      const char **seqs = malloc(members->nitems * sizeof(char *));
+      if (seqs == NULL) {
+         alert();
+         krash();
+      }
+      for (int i = 0 ; i < members->nitems ; i++) {
+         seqs[i] = ((useq_t *) members->items[i])->seq;
+      }
+      starcode_cluster_t cluster = {
+         .number       = number,
+         .canonical    = canonical->seq,
+         .canonical_id = first_seqid(canonical),
+         .count        = canonical->count,
+         .nmembers     = members->nitems,
+         .members      = seqs,
+      };
+      int status = callbacks->cluster(&cluster, callbacks->data);
+      free(seqs);
+      if (status) return status;
+   }
+
+   for (int i = 0 ; i < members->nitems ; i++) {
+      int status = emit_ids(members->items[i], number, callbacks);
+      if (status) return status;
+   }
+
+   return 0;
+
+}
+
+
+int
+emit_ids
+(
+         useq_t               * u,
+   const int                    number,
+   const starcode_callbacks_t * callbacks
+)
+// SYNOPSIS:
+//   Assign the reads of 'u' to the cluster 'number' (see 'emit_cluster()').
+{
+   if (callbacks->assign == NULL) return 0;
+   if (u->nids < 2) {
+      return callbacks->assign(first_seqid(u), number, callbacks->data);
+   }
+   for (unsigned int k = 0 ; k < u->nids ; k++) {
+      int status = callbacks->assign(u->seqid[k], number, callbacks->data);
+      if (status) return status;
+   }
+   return 0;
+}
+
+
+int
+starcode_serve
+(
+         FILE      ** inputf,
+   const int          ninputs,
+   const char       * socketpath,
+         int          tau,
+   const int          verbose,
+   const int          thrmax
+)
+// SYNOPSIS:
+//   Load the sequences of the input files (the whitelist) in a trie
+//   once, and answer the queries of the clients over a Unix domain
+//   socket until the process receives SIGINT or SIGTERM. Up to
+//   'thrmax' clients are served in parallel, each by its own thread
+//   with its own search state ('search_batch()' does not modify the
+//   trie).
+//
+//   The protocol is binary, with integers in the byte order of the
+//   host. A request is the number of queries (uint32), followed by
+//   the length (uint32) and the characters of every query. The
+//   response gives for every query the distance to the nearest
+//   sequences of the whitelist (uint32, UINT32_MAX if there is none
+//   within 'tau'), their number (uint32) and their ids (uint32 each,
+//   the rank of their first occurrence in the input as with
+//   '--seq-id', in ascending order). A client can send any number
+//   of requests on the same connection.
+//
+// RETURN:
+//   1 if the server could not start (it does not return otherwise).
+{
+
+   if (strlen(socketpath) >= sizeof(SOCKETPATH)) {
+      fprintf(stderr, "socket path too long: %s\n", socketpath);
+      return 1;
+   }
+
+   if (verbose) fprintf(stderr, "reading input files\n");
+   sorter_t *sorter = new_sorter(SORT_RUN_SIZE, thrmax);
+   gstack_t *uSQ = read_files(inputf, NULL, ninputs, sorter,
+         thrmax, verbose);
+   if (uSQ == NULL || uSQ->nitems < 1) {
+      fprintf(stderr, "input file empty\n");
+      destroy_sorter(sorter);
+      return 1;
+   }
+   uSQ->nitems = merge_runs(sorter, (useq_t **) uSQ->items, thrmax);
+   destroy_sorter(sorter);
+
+   int med = -1;
+   int height = useq_lengths(uSQ, &med);
+   if (tau < 0) {
+      tau = med > 160 ? 8 : 2 + med/30;
+      if (verbose) {
+         fprintf(stderr, "setting dist to %d\n", tau);
+      }
+   }
+
+   // The queries can be up to 'tau' nucleotides longer than the
+   // sequences of the whitelist. Build the trie in a single block
+   // of nodes (the sequences are sorted, see 'count_trie_nodes()').
+   height = min(height + tau, MAXBRCDLEN);
+   const int nseq = uSQ->nitems;
+   useq_t **items = (useq_t **) uSQ->items;
+   trie_t *trie = new_trie(height);
+   node_t *nodes = malloc(count_trie_nodes(items, 0, nseq, height) *
+         sizeof(node_t));
+   if (trie == NULL || nodes == NULL) {
+      alert();
+      krash();
+   }
+   node_t *node_pos = nodes;
+   for (int i = 0 ; i < nseq ; i++) {
+      void **data = insert_string_wo_malloc(trie, items[i]->seq, &node_pos);
+      if (data == NULL) {
+         alert();
+         krash();
+      }
+      *data = items[i];
+   }
+
+   // A stale socket is removed, but not a file of another type.
+   struct stat st;
+   if (stat(socketpath, &st) == 0 && S_ISSOCK(st.st_mode)) {
+      unlink(socketpath);
+   }
+   struct sockaddr_un addr = { .sun_family = AF_UNIX };
+   strcpy(addr.sun_path, socketpath);
+   int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr))
+         || listen(sock, SOMAXCONN)) {
+      fprintf(stderr, "cannot listen on socket %s (%s)\n",
+            socketpath, strerror(errno));
+      if (sock >= 0) close(sock);
+      return 1;
+   }
+   strcpy(SOCKETPATH, socketpath);
+   signal(SIGINT, serve_stop);
+   signal(SIGTERM, serve_stop);
+   // The errors of the clients are reported by 'serve_connection()'.
+   signal(SIGPIPE, SIG_IGN);
+
+   if (verbose) {
+      fprintf(stderr, "serving %d sequences on %s with %d thread%s\n",
+            nseq, socketpath, thrmax, thrmax > 1 ? "s" : "");
+   }
+
+   serveargs_t args = {
+      .sock    = sock,
+      .trie    = trie,
+      .tau     = tau,
+      .verbose = verbose,
+   };
+   pthread_t *threads = malloc(thrmax * sizeof(pthread_t));
+   if (threads == NULL) {
+      alert();
+      krash();
+   }
+   for (int i = 0 ; i < thrmax ; i++) {
+      if (pthread_create(threads+i, NULL, serve_worker, &args)) {
+         alert();
+         krash();
+      }
+   }
+   for (int i = 0 ; i < thrmax ; i++) {
+      pthread_join(threads[i], NULL);
+   }
+
+   // Only reached if 'accept()' fails in all the threads.
+   fprintf(stderr, "server stopped\n");
+   close(sock);
+   unlink(socketpath);
+   return 1;
+
+}
+
+
+void
+serve_stop
+(
+   int sig
+)
+// SYNOPSIS:
+//   Signal handler of 'starcode_serve()', remove the socket and exit.
+{
+   (void) sig;
+   unlink(SOCKETPATH);
+   _exit(EXIT_SUCCESS);
+}
+
+
+void *
+serve_worker
+(
+   void * args
+)
+// SYNOPSIS:
+//   Thread function of 'starcode_serve()'. Accept a client and serve
+//   its requests until it closes the connection, then wait for the
+//   next client.
+{
+
+   serveargs_t *serveargs = (serveargs_t *) args;
+
+   while (1) {
+      int fd = accept(serveargs->sock, NULL, NULL);
+      if (fd < 0) {
+         if (errno == EINTR || errno == ECONNABORTED) continue;
+         alert();
+         return NULL;
+      }
+      // Separate streams for reading and writing.
+      int fd2 = dup(fd);
+      FILE *in = fdopen(fd, "r");
+      FILE *out = fd2 < 0 ? NULL : fdopen(fd2, "w");
+      if (in == NULL || out == NULL) {
+         alert();
+         if (in != NULL) fclose(in); else close(fd);
+         if (out != NULL) fclose(out); else if (fd2 >= 0) close(fd2);
+         continue;
+      }
+      if (serve_connection(serveargs->trie, serveargs->tau, in, out) &&
+            serveargs->verbose) {
+         fprintf(stderr, "client dropped (bad request)\n");
+      }
+      fclose(in);
+      fclose(out);
+   }
+
+}
+
+
+int
+serve_connection
+(
+   trie_t * trie,
+   int      tau,
+   FILE   * in,
+   FILE   * out
+)
+// SYNOPSIS:
+//   Read the requests from 'in' and write the responses to 'out' (see
+//   'starcode_serve()' for the protocol). The buffers of the queries
+//   and the hits are kept from one request to the next.
+//
+// RETURN:
+//   0 if the client closed the connection, 1 upon error.
+{
+
+   const int height = get_height(trie);
+   int status = 0;
+   int nslots = 0;
+   int nids = 0;
+   int        *  ids     = NULL;
+   char       ** queries = NULL;
+   gstack_t  *** hits    = NULL;
+   const char ** batch   = NULL;
+   gstack_t  *** bhits   = NULL;
+
+   uint32_t nqueries;
+   while (fread(&nqueries, sizeof(uint32_t), 1, in) == 1) {
+      if (nqueries > SERVE_MAX_QUERIES) {
+         status = 1;
+         break;
+      }
+
+      // Grow the buffers if needed.
+      if ((int) nqueries > nslots) {
+         queries = realloc(queries, nqueries * sizeof(char *));
+         hits = realloc(hits, nqueries * sizeof(gstack_t **));
+         batch = realloc(batch, nqueries * sizeof(char *));
+         bhits = realloc(bhits, nqueries * sizeof(gstack_t **));
+         if (queries == NULL || hits == NULL ||
+               batch == NULL || bhits == NULL) {
+            alert();
+            krash();
+         }
+         for (int q = nslots ; q < (int) nqueries ; q++) {
+            queries[q] = malloc(M * sizeof(char));
+            hits[q] = new_tower(tau+1);
+            if (queries[q] == NULL || hits[q] == NULL) {
+               alert();
+               krash();
+            }
+         }
+         nslots = nqueries;
+      }
+
+      // Read the queries. Those longer than the trie cannot have
+      // a hit and are not searched.
+      int nbatch = 0;
+      for (int q = 0 ; q < (int) nqueries ; q++) {
+         uint32_t len;
+         if (fread(&len, sizeof(uint32_t), 1, in) != 1 || len > MAXBRCDLEN
+               || fread(queries[q], sizeof(char), len, in) != len) {
+            status = 1;
+            break;
+         }
+         queries[q][len] = '\0';
+         for (uint32_t i = 0 ; i < len ; i++) {
+            char c = queries[q][i];
+            queries[q][i] = c < 0 ? c : capitalize[(int) c];
+         }
+         for (int d = 0 ; d <= tau ; d++) hits[q][d]->nitems = 0;
+         if ((int) len <= height) {
+            batch[nbatch] = queries[q];
+            bhits[nbatch++] = hits[q];
+         }
+      }
+      if (status) break;
+      if (nbatch > 0 && search_batch(trie, batch, nbatch, tau, bhits)) {
+         status = 1;
+         break;
+      }
+
+      // Write the nearest hits.
+      for (int q = 0 ; q < (int) nqueries ; q++) {
+         gstack_t *nearest = NULL;
+         uint32_t dist = UINT32_MAX;
+         for (int d = 0 ; d <= tau ; d++) {
+            if (hits[q][d]->nitems > 0) {
+               nearest = hits[q][d];
+               dist = d;
+               break;
+            }
+         }
+         uint32_t nhits = nearest == NULL ? 0 : nearest->nitems;
+         fwrite(&dist, sizeof(uint32_t), 1, out);
+         fwrite(&nhits, sizeof(uint32_t), 1, out);
+         if (nhits == 0) continue;
+         if ((int) nhits > nids) {
+            nids = nhits;
+            ids = realloc(ids, nids * sizeof(int));
+            if (ids == NULL) {
+               alert();
+               krash();
+            }
+         }
+         for (uint32_t k = 0 ; k < nhits ; k++) {
+            ids[k] = first_seqid((useq_t *) nearest->items[k]);
+         }
+         qsort(ids, nhits, sizeof(int), int_ascending);
+         fwrite(ids, sizeof(uint32_t), nhits, out);
+      }
+      if (fflush(out) != 0) {
+         status = 1;
+         break;
+      }
+   }
+   if (ferror(in)) status = 1;
+
+   for (int q = 0 ; q < nslots ; q++) {
+      free(queries[q]);
+      destroy_tower(hits[q]);
+   }
+   free(ids);
+   free(queries);
+   free(hits);
+   free(batch);
+   free(bhits);
+
+   return status;
+
+}
+
+
+void
+destroy_plan
+(
+   mtplan_t * mtplan
+)
+// SYNOPSIS:
+//   Free the plan after 'run_plan()', with its tries and masks (the
+//   sequences are not freed). The last jobs may still be signaling
+//   the scheduler, so the function waits for them first.
+{
+   pthread_mutex_lock(mtplan->mutex);
+   while (mtplan->active > 0) {
+      pthread_cond_wait(mtplan->monitor, mtplan->mutex);
+   }
+   pthread_mutex_unlock(mtplan->mutex);
+   for (int i = 0 ; i < mtplan->ntries ; i++) {
+      mtjob_t *job = mtplan->tries[i].jobs;
+      destroy_trie(job->trie, DESTROY_NODES_NO, NULL);
+      if (job->rtrie != NULL) {
+         destroy_trie(job->rtrie, DESTROY_NODES_YES, NULL);
+      }
+      free(job->node_pos);
+      free(job);
+   }
+   for (int i = 0 ; i < mtplan->ntries + 1 ; i++) {
+      pthread_mutex_destroy(mtplan->mutex + i);
+   }
+   pthread_cond_destroy(mtplan->monitor);
+   free(mtplan->tries);
+   free(mtplan->masks);
+   free(mtplan->lanes);
+   free(mtplan->mutex);
+   free(mtplan->monitor);
+   free(mtplan);
+}
+
+
+void
+run_plan
+(
+   mtplan_t *mtplan,
+   const int verbose,
+   const int thrmax
+)
+{
+   // Count total number of jobs.
+   int njobs = mtplan->ntries * (mtplan->ntries+1) / 2;
+   metrics_jobs(njobs);
+
+   // Thread Scheduler
+   int triedone = 0;
+   int idx = -1;
+
+   // Worker lanes (only used to draw the timeline).
+   mtplan->lanes = calloc(thrmax, sizeof(char));
+   if (mtplan->lanes == NULL) {
+      alert();
+      krash();
+   }
+
+   while (triedone < mtplan->ntries) { 
+      // Cycle through the tries in turn.
+      idx = (idx+1) % mtplan->ntries;
+      mttrie_t *mttrie = mtplan->tries + idx;
+      pthread_mutex_lock(mtplan->mutex);     
+
+      // Check whether trie is idle and there are available threads.
+      if (mttrie->flag == TRIE_FREE && mtplan->active < thrmax) {
+
+         // No more jobs on this trie.
+         if (mttrie->currentjob == mttrie->njobs) {
+            mttrie->flag = TRIE_DONE;
+            triedone++;
+         }
+
+         // Skip query jobs without any sequence to search.
+         else if (!mttrie->jobs[mttrie->currentjob].build &&
+               mttrie->jobs[mttrie->currentjob].nsearch == 0) {
+            mtjob_t *job = mttrie->jobs + mttrie->currentjob++;
+            mtplan->jobsdone++;
+            int nskip = job->end - job->start + 1;
+            metrics_job_done(nskip, nskip, 0);
+         }
+
+         // Some more jobs to do.
+         else {
+            mttrie->flag = TRIE_BUSY;
+            mtplan->active++;
+            mtjob_t *job = mttrie->jobs + mttrie->currentjob++;
+            int lane = 0;
+            while (mtplan->lanes[lane]) lane++;
+            mtplan->lanes[lane] = 1;
+            job->lane  = lane + 1;
+            job->lanes = mtplan->lanes;
+            pthread_t thread;
+            // Start job and detach thread.
+            if (pthread_create(&thread, NULL, do_query, job)) {
+               alert();
+               krash();
+            }
+            pthread_detach(thread);
+            if (verbose) {
+               fprintf(stderr, "progress: %.2f%% \r",
+                     100*(float)(mtplan->jobsdone)/njobs);
+            }
+         }
+      }
+
+      // If max thread number is reached, wait for a thread.
+      while (mtplan->active == thrmax) {
+         pthread_cond_wait(mtplan->monitor, mtplan->mutex);
+      }
+
+      pthread_mutex_unlock(mtplan->mutex);
+
+   }
+
+   return;
+
+}
+
+
+void
+long_search
+(
+   gstack_t * useqS,
+   int        tau,
+   int        thrmax
+)
+// SYNOPSIS:
+//   Find the matching pairs of long sequences with the minimizer
+//   engine (see 'long_pairs()') and record them for the clustering.
+{
+
+   char **seqs = malloc((useqS->nitems + 1) * sizeof(char *));
+   if (seqs == NULL) {
+      alert();
+      krash();
+   }
+   for (int i = 0 ; i < useqS->nitems ; i++) {
+      seqs[i] = ((useq_t *) useqS->items[i])->seq;
+   }
+
+   metrics_jobs(1);
+   const double t0 = trace_now();
+   ledge_t *edges = NULL;
+   long nedges = tau == 0 ? 0 :
+      long_pairs(seqs, useqS->nitems, tau, thrmax, &edges);
+   if (nedges < 0) {
+      alert();
+      krash();
+   }
+   for (long e = 0 ; e < nedges ; e++) {
+      link_match(useqS->items[edges[e].i], useqS->items[edges[e].j],
+            edges[e].dist, tau, NULL, NULL);
+   }
+   trace_event("long", 1, t0, trace_now(),
+         "\"queries\":%d,\"hits\":%ld", useqS->nitems, nedges);
+   metrics_job_done(useqS->nitems, 0, nedges);
+
+   free(edges);
+   free(seqs);
+
+}
+
+
+void
+small_search
+(
+   gstack_t * useqS,
+   int        tau,
+   int        height,
+   int        medianlen
+)
+// SYNOPSIS:
+//   Search all the sequences in a single trie, in the calling thread.
+//   For small inputs, the fixed costs of the multithreading plan (the
+//   shared k-mer index, the mutexes, the tries and the threads, see
+//   'plan_mt()') are larger than the search itself. Here a single k-mer
+//   index is filled in order to tell which sequences can have a match
+//   among the previous ones, and the trie is built and searched by a
+//   single build job without mutexes or scheduler. Everything is freed
+//   at the end.
+{
+
+   const int nseq = useqS->nitems;
+   useq_t **items = (useq_t **) useqS->items;
+   trie_t *trie = new_trie(height);
+   trie_t *rtrie = SPLITSEARCH ? new_trie(height) : NULL;
+   node_t *nodes = malloc(count_trie_nodes(items, 0, nseq, height) *
+         sizeof(node_t));
+   // A few rows per sequence are enough for the k-mer index, whereas
+   // the default k-mers of 'new_lookup()' can be 14 nucleotides long
+   // (tables of 32 MB). The k-mers are shortened accordingly.
+   int k = 1;
+   while (k < MAX_K_FOR_LOOKUP && ((size_t) 1 << 2*k) < 64 * (size_t) nseq) {
+      k++;
+   }
+   lookup_t *lut = new_lookup(min(medianlen, k*(tau+1)), height, tau, 1);
+   uint32_t *masks = malloc(nseq * sizeof(uint32_t));
+   if (trie == NULL || nodes == NULL || lut == NULL || masks == NULL ||
+         (SPLITSEARCH && rtrie == NULL)) {
+      alert();
+      krash();
+   }
+
+   // Same as the own bit of 'mask_worker()'.
+   int nsearch = 0;
+   for (int i = 0 ; i < nseq ; i++) {
+      lut_search(lut, items[i], -1, masks + i);
+      if (lut_insert(lut, items[i], 0)) {
+         alert();
+         krash();
+      }
+      nsearch += masks[i] & 1;
+   }
+   destroy_lookup(lut);
+
+   mtjob_t job = {
+      .start    = 0,
+      .end      = nseq - 1,
+      .tau      = tau,
+      .indels   = MAXINDELS,
+      .build    = 1,
+      .queryid  = 1,
+      .trieid   = 1,
+      .lane     = 1,
+      .nsearch  = nsearch,
+      .nwords   = 1,
+      .useqS    = useqS,
+      .trie     = trie,
+      .rtrie    = rtrie,
+      .node_pos = nodes,
+      .masks    = masks,
+   };
+   metrics_jobs(1);
+   do_query(&job);
+
+   destroy_trie(trie, DESTROY_NODES_NO, NULL);
+   if (rtrie != NULL) destroy_trie(rtrie, DESTROY_NODES_YES, NULL);
+   free(nodes);
+   free(masks);
+
+}
+
+
+void *
+do_query
+(
+   void * args
+)  
+{
+   // Unpack arguments.
+   mtjob_t  * job    = (mtjob_t*) args;
+   gstack_t * useqS  = job->useqS;
+   trie_t   * trie   = job->trie;
+   const int  tau    = job->tau;
+   const int  trieid = job->trieid - 1;
+   const int  height = get_height(trie);
+   node_t * node_pos = job->node_pos;
+
+   // Statistics for the timeline.
+   const double t0 = trace_now();
+   int  lut_skips = 0;
+   long nhits = 0;
+
+   // Create local hit stack.
+   gstack_t **hits = new_tower(tau+1);
+   if (hits == NULL) {
+      alert();
+      krash();
+   }
+
+   useq_t * last_query = NULL;
+
+   for (int i = job->start ; i <= job->end ; i++) {
+      useq_t *query = (useq_t *) useqS->items[i];
+      // The k-mer index tells whether the query can match in this
+      // trie (see 'plan_mt()').
+      uint32_t word = job->masks[(size_t) i * job->nwords + trieid/32];
+      int do_search = (word >> (trieid%32)) & 1;
+      lut_skips += !do_search;
+
+      // Insert the new sequence in the trie, but let the last
+      // pointer to NULL so that the query does not find itself
+      // upon search.
+      void **data = NULL;
+      void **rdata = NULL;
+      if (job->build) {
+         data = insert_string_wo_malloc(trie, query->seq, &node_pos);
+         if (data == NULL || *data != NULL) {
+            alert();
+            krash();
+         }
+         // The reversed trie is not preallocated.
+         if (job->rtrie != NULL) {
+            char reversed[M];
+            int len = strlen(query->seq);
+            for (int j = 0 ; j < len ; j++) {
+               reversed[j] = query->seq[len-1-j];
+            }
+            reversed[len] = '\0';
+            rdata = insert_string(job->rtrie, reversed);
+            if (rdata == NULL || *rdata != NULL) {
+               alert();
+               krash();
+            }
+         }
+      }
+
+      if (do_search) {
+         int trail = 0;
+         if (i < job->end) {
+            useq_t *next_query = (useq_t *) useqS->items[i+1];
+            trail = padded_prefix(query->seq, next_query->seq, height);
+         }
+
+         // Compute start height.
+         int start = 0;
+         if (last_query != NULL) {
+            start = padded_prefix(query->seq, last_query->seq, height);
+         }
+
+         // Clear hit stack. //
+         for (int j = 0 ; hits[j] != TOWER_TOP ; j++) {
+            hits[j]->nitems = 0;
+         }
+
+         // Search the trie. //
+         int err = job->rtrie != NULL ?
+            search_split(trie, job->rtrie, query->seq, tau, hits,
+                  start, trail) :
+            job->indels >= 0 ?
+            search_band(trie, query->seq, tau, job->indels, hits,
+                  start, trail) :
+            search(trie, query->seq, tau, hits, start, trail);
+         if (err) {
+            alert();
+            krash();
+         }
+
+         for (int j = 0 ; hits[j] != TOWER_TOP ; j++) {
+            if (hits[j]->nitems > hits[j]->nslots) {
+               fprintf(stderr, "warning: incomplete search (%s)\n",
+                       query->seq);
+               break;
+            }
+         }
+
+         // Link matching pairs for clustering.
+         // Skip dist = 0, as this would be self.
+         for (int dist = 1 ; dist < tau+1 ; dist++) {
+         nhits += hits[dist]->nitems;
+         for (int j = 0 ; j < hits[dist]->nitems ; j++) {
+
+            useq_t *match = (useq_t *) hits[dist]->items[j];
+            if (job->mutex == NULL) {
+               link_match(query, match, dist, tau, NULL, NULL);
+            }
+            else {
+               link_match(query, match, dist, tau,
+                     job->mutex + job->queryid, job->mutex + job->trieid);
             }
          }
          }
@@ -758,21 +2132,102 @@ do_query
       if (job->build) {
          // Finally set the pointer of the inserted tail node.
          *data = query;
+         if (rdata != NULL) *rdata = query;
+      }
+   }
+   
+   destroy_tower(hits);
+
+   trace_event(job->build ? "build" : "query", job->lane, t0, trace_now(),
+         "\"trie\":%d,\"block\":%d,\"queries\":%d,"
+         "\"lut_skips\":%d,\"hits\":%ld", job->trieid - 1,
+         job->queryid - 1, job->end - job->start + 1, lut_skips, nhits);
+   metrics_job_done(job->end - job->start + 1, lut_skips, nhits);
+
+   // Jobs outside of a plan have no scheduler (see 'small_search()').
+   if (job->monitor == NULL) return NULL;
+
+   // Flag trie, update thread count and signal scheduler.
+   // Use the general mutex. (job->mutex[0])
+   pthread_mutex_lock(job->mutex);
+   job->lanes[job->lane - 1] = 0;
+   *(job->active) -= 1;
+   *(job->jobsdone) += 1;
+   *(job->trieflag) = TRIE_FREE;
+   pthread_cond_signal(job->monitor);
+   pthread_mutex_unlock(job->mutex);
+
+   return NULL;
+
+}
+
+
+void
+link_match
+(
+   useq_t          * query,
+   useq_t          * match,
+   int               dist,
+   int               tau,
+   pthread_mutex_t * qmutex,
+   pthread_mutex_t * mmutex
+)
+// SYNOPSIS:
+//   Record a pair of matching sequences for the clustering. For
+//   spheres and connected components, the match is recorded on both
+//   sequences. For message passing, it is recorded on the sequence
+//   with the smaller count (the child), and only if the counts are
+//   far enough apart. 'qmutex' and 'mmutex' protect the match records
+//   of 'query' and 'match' (they can be NULL if there is a single
+//   thread).
+{
+
+   // Define a constant to help the compiler recognize
+   // that only one of the two cases will ever be used.
+   const int bidir_match = (CLUSTERALG == SPHERES_CLUSTER || CLUSTERALG == COMPONENTS_CLUSTER);
+
+   if (bidir_match) {
+      // Make a bidirectional match reference.
+      // Add reference from query to matched node.
+      if (qmutex != NULL) pthread_mutex_lock(qmutex);
+      if (addmatch(query, match, dist, tau)) {
+         fprintf(stderr,
+               "Please contact guillaume.filion@gmail.com "
+               "for support with this issue.\n");
+         abort();
+      }
+      if (qmutex != NULL) pthread_mutex_unlock(qmutex);
+      // Add reference from matched node to query.
+      if (mmutex != NULL) pthread_mutex_lock(mmutex);
+      if (addmatch(match, query, dist, tau)) {
+         fprintf(stderr,
+               "Please contact guillaume.filion@gmail.com "
+               "for support with this issue.\n");
+         abort();
+      }
+      if (mmutex != NULL) pthread_mutex_unlock(mmutex);
+   }
+
+   else {
+      useq_t *parent = match->count > query->count ? match : query;
+      useq_t *child  = match->count > query->count ? query : match;
+      // If clustering is done by message passing, do not link
+      // pair if counts are on the same order of magnitude.
+      int mincount = child->count;
+      int maxcount = parent->count;
+      if (maxcount < CLUSTER_RATIO * mincount) return;
+      // The child is modified, use the child mutex.
+      pthread_mutex_t *mutex = match->count > query->count ?
+                               qmutex : mmutex;
+      if (mutex != NULL) pthread_mutex_lock(mutex);
+      if (addmatch(child, parent, dist, tau)) {
+         fprintf(stderr,
+               "Please contact guillaume.filion@gmail.com "
+               "for support with this issue.\n");
+         abort();
       }
+      if (mutex != NULL) pthread_mutex_unlock(mutex);
    }
-   
-   destroy_tower(hits);
-
-   // Flag trie, update thread count and signal scheduler.
-   // Use the general mutex. (job->mutex[0])
-   pthread_mutex_lock(job->mutex);
-   *(job->active) -= 1;
-   *(job->jobsdone) += 1;
-   *(job->trieflag) = TRIE_FREE;
-   pthread_cond_signal(job->monitor);
-   pthread_mutex_unlock(job->mutex);
-
-   return NULL;
 
 }
 
@@ -784,6 +2239,7 @@ plan_mt
     int       height,
     int       medianlen,
     int       ntries,
+    int       thrmax,
     gstack_t *useqS
 )
 // SYNOPSIS:                                                              
@@ -806,6 +2262,11 @@ plan_mt
 //   block and that each block is queried against every other exactly one 
 //   time (a query of block i in trie j is the same as a query of block j 
 //   in trie i).                                                          
+//
+//   Before the jobs are created, a single k-mer index of all the blocks
+//   is built and probed once per sequence, which gives the tries where
+//   each sequence can have a match. Query jobs where no sequence can
+//   match are skipped altogether.
 {
    // Initialize plan.
    mtplan_t *mtplan = malloc(sizeof(mtplan_t));
@@ -837,28 +2298,75 @@ plan_mt
    int *bounds = malloc((ntries+1) * sizeof(int));
    for (int i = 0 ; i < ntries+1 ; i++) bounds[i] = Q*i + min(i, R);
 
+   // Build the shared k-mer index (the block of trie 'i' is
+   // inserted as trie 'i') and compute the masks of the tries
+   // to search for every sequence, in parallel by blocks.
+   const int nwords = (ntries + 31) / 32;
+   lookup_t *lut = new_lookup(medianlen, height, tau, ntries);
+   uint32_t *masks = malloc((size_t) useqS->nitems * nwords *
+         sizeof(uint32_t));
+   int *nsearch = calloc(ntries * ntries, sizeof(int));
+   if (lut == NULL || masks == NULL || nsearch == NULL) {
+      alert();
+      krash();
+   }
+   for (int i = 0 ; i < ntries ; i++) {
+      for (int j = bounds[i] ; j < bounds[i+1] ; j++) {
+         if (lut_insert(lut, useqS->items[j], i)) {
+            alert();
+            krash();
+         }
+      }
+   }
+   int nthreads = max(1, min(thrmax, ntries));
+   pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+   maskargs_t *margs = malloc(nthreads * sizeof(maskargs_t));
+   if (threads == NULL || margs == NULL) {
+      alert();
+      krash();
+   }
+   for (int t = 0 ; t < nthreads ; t++) {
+      margs[t] = (maskargs_t) {
+         .lut = lut, .own = new_lookup(medianlen, height, tau, 1),
+         .items = (useq_t **) useqS->items,
+         .bounds = bounds, .masks = masks, .nsearch = nsearch,
+         .first = t, .step = nthreads,
+      };
+      if (margs[t].own == NULL) {
+         alert();
+         krash();
+      }
+      if (t > 0 && pthread_create(threads + t, NULL, mask_worker,
+               margs + t)) {
+         alert();
+         krash();
+      }
+   }
+   mask_worker(margs);
+   for (int t = 1 ; t < nthreads ; t++) pthread_join(threads[t], NULL);
+   for (int t = 0 ; t < nthreads ; t++) destroy_lookup(margs[t].own);
+   free(threads);
+   free(margs);
+   // The index is not needed anymore.
+   destroy_lookup(lut);
+
    // Preallocated tries.
    // Count with maxlen-1
    long *nnodes = malloc(ntries * sizeof(long));
    for (int i = 0; i < ntries; i++) nnodes[i] =
-      count_trie_nodes((useq_t **)useqS->items, bounds[i], bounds[i+1]);
+      count_trie_nodes((useq_t **)useqS->items, bounds[i], bounds[i+1],
+            height);
 
    // Create jobs for the tries.
    for (int i = 0 ; i < ntries; i++) {
       // Remember that 'ntries' is odd.
       int njobs = (ntries+1)/2;
       trie_t *local_trie  = new_trie(height);
+      trie_t *local_rtrie = SPLITSEARCH ? new_trie(height) : NULL;
       node_t *local_nodes = (node_t *) malloc(nnodes[i] * sizeof(node_t));
       mtjob_t *jobs = malloc(njobs * sizeof(mtjob_t));
-      if (local_trie == NULL || jobs == NULL) {
-         alert();
-         krash();
-      }
-
-      // Allocate lookup struct.
-      // TODO: Try only one lut as well. (It will always return 1 in the query step though).
-      lookup_t * local_lut = new_lookup(medianlen, height, tau);
-      if (local_lut == NULL) {
+      if (local_trie == NULL || jobs == NULL ||
+            (SPLITSEARCH && local_rtrie == NULL)) {
          alert();
          krash();
       }
@@ -877,11 +2385,15 @@ plan_mt
          jobs[j].start    = bounds[idx];
          jobs[j].end      = bounds[idx+1]-1;
          jobs[j].tau      = tau;
+         jobs[j].indels   = MAXINDELS;
          jobs[j].build    = only_if_first_job;
          jobs[j].useqS    = useqS;
          jobs[j].trie     = local_trie;
+         jobs[j].rtrie    = local_rtrie;
          jobs[j].node_pos = local_nodes;
-         jobs[j].lut      = local_lut;
+         jobs[j].masks    = masks;
+         jobs[j].nwords   = nwords;
+         jobs[j].nsearch  = nsearch[idx * ntries + i];
          jobs[j].mutex    = mutex;
          jobs[j].monitor  = monitor;
          jobs[j].jobsdone = &(mtplan->jobsdone);
@@ -894,10 +2406,14 @@ plan_mt
    }
 
    free(bounds);
+   free(nsearch);
+   free(nnodes);
 
    mtplan->active = 0;
    mtplan->ntries = ntries;
    mtplan->jobsdone = 0;
+   mtplan->lanes = NULL;
+   mtplan->masks = masks;
    mtplan->mutex = mutex;
    mtplan->monitor = monitor;
    mtplan->tries = mttries;
@@ -906,26 +2422,91 @@ plan_mt
 
 }
 
+void *
+mask_worker
+(
+   void * args
+)
+// SYNOPSIS:
+//   Probe the k-mer index for every sequence of the blocks assigned
+//   to the thread, store the masks of the tries where the sequences
+//   have to be searched and count them for every pair of block and
+//   trie (in 'nsearch[block * ntries + trie]').
+//
+//   In the trie of its own block, a sequence is only searched against
+//   the sequences inserted before it, so the bit of this trie is
+//   given by a private index where the block is inserted in order.
+{
+   maskargs_t *margs = (maskargs_t *) args;
+   lookup_t *own = margs->own;
+   const int ntries = margs->lut->ntries;
+   const int nwords = (ntries + 31) / 32;
+   for (int b = margs->first ; b < ntries ; b += margs->step) {
+      for (int k = 0 ; k < own->kmers ; k++) {
+         size_t nkmers = (size_t) 1 << (2 * max(0, own->klen[k]));
+         memset(own->lut[k], 0, nkmers / 8 + 9);
+      }
+      for (int i = margs->bounds[b] ; i < margs->bounds[b+1] ; i++) {
+         uint32_t *mask = margs->masks + (size_t) i * nwords;
+         uint32_t self;
+         lut_search(margs->lut, margs->items[i], b, mask);
+         if (lut_search(own, margs->items[i], -1, &self)) {
+            mask[b/32] |= 1u << (b%32);
+         }
+         if (lut_insert(own, margs->items[i], 0)) {
+            alert();
+            krash();
+         }
+         for (int t = 0 ; t < ntries ; t++) {
+            margs->nsearch[b * ntries + t] += (mask[t/32] >> (t%32)) & 1;
+         }
+      }
+   }
+   return NULL;
+}
+
+
 long
 count_trie_nodes
 (
  useq_t ** seqs,
  int     start,
- int     end
+ int     end,
+ int     height
 )
 {
-   int  seqlen = strlen(seqs[start]->seq) - 1;
-   long count = seqlen;
+   long count = height - 1;
    for (int i = start+1; i < end; i++) {
-      char * a = seqs[i-1]->seq;
-      char * b  = seqs[i]->seq;
-      int prefix = 0;
-      while (a[prefix] == b[prefix]) prefix++;
-      count += seqlen - prefix;
+      int prefix = padded_prefix(seqs[i-1]->seq, seqs[i]->seq, height);
+      count += height - 1 - prefix;
    }
    return count;
 }
 
+
+int
+padded_prefix
+(
+   const char * a,
+   const char * b,
+   int          height
+)
+// SYNOPSIS:
+//   Length of the common prefix of two different sequences once
+//   they are virtually left-padded to 'height' (see 'poucet()'
+//   in 'trie.c'). Sequences of different lengths share only the
+//   padding of the longer one.
+{
+   int alen = strlen(a);
+   int blen = strlen(b);
+   if (alen != blen) return height - max(alen, blen);
+   // The 'while' condition is guaranteed to be false before
+   // the end of the 'char' arrays because they are different.
+   int prefix = 0;
+   while (a[prefix] == b[prefix]) prefix++;
+   return height - alen + prefix;
+}
+
 void
 connected_components
 (
@@ -1255,11 +2836,430 @@ nukesort
 }
 
 
+sorter_t *
+new_sorter
+(
+   int runsize,
+   int thrmax
+)
+{
+
+   sorter_t *sorter = malloc(sizeof(sorter_t));
+   if (sorter == NULL) {
+      alert();
+      krash();
+   }
+   sorter->runsize = runsize;
+   sorter->thrmax = thrmax;
+   sorter->start = 0;
+   sorter->nruns = 0;
+   sorter->njoined = 0;
+   sorter->nslots = 16;
+   sorter->runs = malloc(sorter->nslots * sizeof(sortrun_t));
+   if (sorter->runs == NULL) {
+      alert();
+      krash();
+   }
+
+   return sorter;
+
+}
+
+
+void
+destroy_sorter
+(
+   sorter_t * sorter
+)
+{
+   if (sorter == NULL) return;
+   for (int r = 0 ; r < sorter->nruns ; r++) free(sorter->runs[r].items);
+   free(sorter->runs);
+   free(sorter);
+}
+
+
+void *
+sort_run
+(
+   void * args
+)
+// SYNOPSIS:
+//   Thread function that sorts and reduces a run with 'seqsort()'.
+{
+   sortrun_t *run = (sortrun_t *) args;
+   run->nuniq = seqsort(run->items, run->size, 1);
+   return NULL;
+}
+
+
+static void
+hand_off
+(
+   sorter_t * sorter,
+   gstack_t * uSQ
+)
+// SYNOPSIS:
+//   Start a run with the sequences of 'uSQ' that were not handed off
+//   yet. The pointers are copied because the stack may be reallocated
+//   by the reader. At most 'thrmax'-1 runs are sorted at the same time
+//   (the oldest is joined first); with a single thread the runs are
+//   sorted by the reader.
+{
+
+   int size = uSQ->nitems - sorter->start;
+   if (size < 1) return;
+
+   if (sorter->nruns == sorter->nslots) {
+      // The runs may be sorted by other threads, wait for them
+      // before they are moved.
+      while (sorter->njoined < sorter->nruns) {
+         sortrun_t *run = sorter->runs + sorter->njoined++;
+         if (run->threaded) pthread_join(run->thread, NULL);
+      }
+      sorter->nslots *= 2;
+      sorter->runs = realloc(sorter->runs,
+            sorter->nslots * sizeof(sortrun_t));
+      if (sorter->runs == NULL) {
+         alert();
+         krash();
+      }
+   }
+
+   sortrun_t *run = sorter->runs + sorter->nruns++;
+   run->size = size;
+   run->nuniq = 0;
+   run->threaded = 0;
+   run->items = malloc(size * sizeof(useq_t *));
+   if (run->items == NULL) {
+      alert();
+      krash();
+   }
+   memcpy(run->items, uSQ->items + sorter->start, size * sizeof(useq_t *));
+   sorter->start = uSQ->nitems;
+
+   if (sorter->thrmax < 2) {
+      sort_run(run);
+      sorter->njoined++;
+      return;
+   }
+
+   // The reader counts as one of the threads.
+   while (sorter->nruns - sorter->njoined >= sorter->thrmax) {
+      sortrun_t *old = sorter->runs + sorter->njoined++;
+      if (old->threaded) pthread_join(old->thread, NULL);
+   }
+   run->threaded = !pthread_create(&run->thread, NULL, sort_run, run);
+   if (!run->threaded) sort_run(run);
+
+}
+
+
+void
+sorter_feed
+(
+   sorter_t * sorter,
+   gstack_t * uSQ
+)
+// SYNOPSIS:
+//   Called by the readers after every new sequence. Hand off a run
+//   when 'runsize' sequences have accumulated. Does nothing if
+//   'sorter' is NULL.
+{
+   if (sorter == NULL) return;
+   if (uSQ->nitems - sorter->start >= sorter->runsize) {
+      hand_off(sorter, uSQ);
+   }
+}
+
+
+void
+sorter_flush
+(
+   sorter_t * sorter,
+   gstack_t * uSQ
+)
+// SYNOPSIS:
+//   Hand off the last (incomplete) run and wait until all the runs
+//   are sorted. Does nothing if 'sorter' is NULL.
+{
+   if (sorter == NULL) return;
+   hand_off(sorter, uSQ);
+   while (sorter->njoined < sorter->nruns) {
+      sortrun_t *run = sorter->runs + sorter->njoined++;
+      if (run->threaded) pthread_join(run->thread, NULL);
+   }
+}
+
+
+static int
+merge_pair
+(
+   useq_t ** l,
+   int       nl,
+   useq_t ** r,
+   int       nr,
+   useq_t ** dst
+)
+// SYNOPSIS:
+//   Merge two sorted and reduced runs, as in 'nukesort()': when two
+//   sequences are identical, the one on the left (which was read
+//   first) is kept and the other is destroyed. Return the size of
+//   the merged run.
+{
+
+   int i = 0;
+   int j = 0;
+   int idx = 0;
+
+   while (i < nl && j < nr) {
+      useq_t *ul = l[i];
+      useq_t *ur = r[j];
+      int sl = strlen(ul->seq);
+      int sr = strlen(ur->seq);
+      int cmp = sl == sr ? strcmp(ul->seq, ur->seq) : (sl < sr ? -1 : 1);
+      if (cmp == 0) {
+         ul->count += ur->count;
+         transfer_useq_ids(ul, ur);
+         destroy_useq(ur);
+         dst[idx++] = l[i++];
+         j++;
+      }
+      else if (cmp < 0) dst[idx++] = l[i++];
+      else              dst[idx++] = r[j++];
+   }
+   memcpy(dst+idx, l+i, (nl-i) * sizeof(useq_t *));
+   idx += nl-i;
+   memcpy(dst+idx, r+j, (nr-j) * sizeof(useq_t *));
+   idx += nr-j;
+
+   return idx;
+
+}
+
+
+void *
+merge_worker
+(
+   void * args
+)
+// SYNOPSIS:
+//   Thread function of 'merge_runs()'. Merge every 'step'-th pair
+//   of runs (runs 2k and 2k+1), starting from 'first'. The merged
+//   run replaces run 2k, at the same offset in 'dst'.
+{
+
+   mergeargs_t *margs = (mergeargs_t *) args;
+   for (int k = margs->first ; 2*k < margs->nruns ; k += margs->step) {
+      int a = 2*k;
+      int b = 2*k+1;
+      useq_t **dst = margs->dst + margs->start[a];
+      if (b == margs->nruns) {
+         memcpy(dst, margs->src + margs->start[a],
+               margs->len[a] * sizeof(useq_t *));
+         continue;
+      }
+      margs->len[a] = merge_pair(margs->src + margs->start[a], margs->len[a],
+            margs->src + margs->start[b], margs->len[b], dst);
+   }
+   return NULL;
+
+}
+
+
+int
+merge_runs
+(
+   sorter_t * sorter,
+   useq_t  ** data,
+   int        thrmax
+)
+// SYNOPSIS:
+//   Merge the sorted runs of 'sorter' in 'data' (which must have room
+//   for all of them). The runs are merged pairwise, in the order they
+//   were read, so that the result is the same as that of 'seqsort()'
+//   on the whole input. At every level the pairs are merged by up to
+//   'thrmax' threads. The runs are moved out of 'sorter'.
+//
+// RETURN:
+//   Number of unique elements.
+{
+
+   int nruns = sorter->nruns;
+   if (nruns == 0) return 0;
+
+   int *start = malloc(nruns * sizeof(int));
+   int *len = malloc(nruns * sizeof(int));
+   if (start == NULL || len == NULL) {
+      alert();
+      krash();
+   }
+
+   // Gather the runs back to back.
+   int total = 0;
+   for (int r = 0 ; r < nruns ; r++) {
+      sortrun_t *run = sorter->runs + r;
+      memcpy(data + total, run->items, run->nuniq * sizeof(useq_t *));
+      start[r] = total;
+      len[r] = run->nuniq;
+      total += run->nuniq;
+      free(run->items);
+   }
+   sorter->nruns = 0;
+
+   useq_t **buffer = malloc(total * sizeof(useq_t *));
+   if (buffer == NULL) {
+      alert();
+      krash();
+   }
+   useq_t **src = data;
+   useq_t **dst = buffer;
+
+   while (nruns > 1) {
+      int npairs = (nruns+1) / 2;
+      int nthreads = min(thrmax, npairs);
+      mergeargs_t args[nthreads];
+      pthread_t threads[nthreads];
+      int created[nthreads];
+      for (int t = 0 ; t < nthreads ; t++) {
+         args[t] = (mergeargs_t) { .src = src, .dst = dst, .start = start,
+            .len = len, .nruns = nruns, .first = t, .step = nthreads };
+      }
+      for (int t = 1 ; t < nthreads ; t++) {
+         created[t] = !pthread_create(threads+t, NULL, merge_worker, args+t);
+      }
+      merge_worker(args);
+      for (int t = 1 ; t < nthreads ; t++) {
+         if (created[t]) pthread_join(threads[t], NULL);
+         else            merge_worker(args+t);
+      }
+      // Keep the merged runs (2k) only.
+      for (int k = 0 ; k < npairs ; k++) {
+         start[k] = start[2*k];
+         len[k] = len[2*k];
+      }
+      nruns = npairs;
+      useq_t **tmp = src;
+      src = dst;
+      dst = tmp;
+   }
+
+   int nuniq = len[0];
+   if (src != data) memcpy(data, src, nuniq * sizeof(useq_t *));
+
+   free(buffer);
+   free(start);
+   free(len);
+
+   return nuniq;
+
+}
+
+
+int
+first_seqid
+(
+   useq_t * u
+)
+// SYNOPSIS:
+//   Return the first (smallest) sequence id of 'u' (see 'useq_t').
+{
+   return u->nids > 1 ? u->seqid[0] : (int)(unsigned long) u->seqid;
+}
+
+void
+shift_seqids
+(
+   useq_t * u,
+   int      offset
+)
+// SYNOPSIS:
+//   Add 'offset' to the sequence ids of 'u' (see 'read_files()').
+{
+   if (u->nids == 1) {
+      u->seqid = (void *)((unsigned long) u->seqid + offset);
+   }
+   else {
+      for (unsigned int i = 0 ; i < u->nids ; i++) u->seqid[i] += offset;
+   }
+}
+
+
+int
+ingest_seq
+(
+   char   * seq,
+   size_t   len
+)
+// SYNOPSIS:
+//   Validate and capitalize a DNA sequence in place, in a single pass.
+//   Only 'ACGTN' (either case) are allowed. Since all valid characters
+//   are letters, capitalization is the same as clearing bit 5, which
+//   maps a character to one of 'ACGTN' only if it was valid. This lets
+//   the vectorized loops check and capitalize 16 or 32 bytes at a time;
+//   the remainder is processed with the lookup tables.
+//
+// RETURN:
+//   0 if the sequence is valid, 1 otherwise (in which case it may be
+//   partially capitalized).
+{
+   size_t i = 0;
+
+#if defined(__AVX2__)
+   const __m256i fold = _mm256_set1_epi8((char) 0xDF);
+   const __m256i A = _mm256_set1_epi8('A');
+   const __m256i C = _mm256_set1_epi8('C');
+   const __m256i G = _mm256_set1_epi8('G');
+   const __m256i T = _mm256_set1_epi8('T');
+   const __m256i N = _mm256_set1_epi8('N');
+   for ( ; i + 32 <= len ; i += 32) {
+      __m256i v = _mm256_loadu_si256((__m256i *) (seq+i));
+      __m256i u = _mm256_and_si256(v, fold);
+      __m256i ok = _mm256_or_si256(
+         _mm256_or_si256(_mm256_cmpeq_epi8(u, A), _mm256_cmpeq_epi8(u, C)),
+         _mm256_or_si256(_mm256_cmpeq_epi8(u, G),
+            _mm256_or_si256(_mm256_cmpeq_epi8(u, T), _mm256_cmpeq_epi8(u, N)))
+      );
+      if (_mm256_movemask_epi8(ok) != -1) return 1;
+      _mm256_storeu_si256((__m256i *) (seq+i), u);
+   }
+#elif defined(__SSE2__)
+   const __m128i fold = _mm_set1_epi8((char) 0xDF);
+   const __m128i A = _mm_set1_epi8('A');
+   const __m128i C = _mm_set1_epi8('C');
+   const __m128i G = _mm_set1_epi8('G');
+   const __m128i T = _mm_set1_epi8('T');
+   const __m128i N = _mm_set1_epi8('N');
+   for ( ; i + 16 <= len ; i += 16) {
+      __m128i v = _mm_loadu_si128((__m128i *) (seq+i));
+      __m128i u = _mm_and_si128(v, fold);
+      __m128i ok = _mm_or_si128(
+         _mm_or_si128(_mm_cmpeq_epi8(u, A), _mm_cmpeq_epi8(u, C)),
+         _mm_or_si128(_mm_cmpeq_epi8(u, G),
+            _mm_or_si128(_mm_cmpeq_epi8(u, T), _mm_cmpeq_epi8(u, N)))
+      );
+      if (_mm_movemask_epi8(ok) != 0xFFFF) return 1;
+      _mm_storeu_si128((__m128i *) (seq+i), u);
+   }
+#endif
+
+   for ( ; i < len ; i++) {
+      uint8_t c = seq[i];
+      if (!valid_DNA_char[c]) return 1;
+      seq[i] = capitalize[c];
+   }
+
+   return 0;
+
+}
+
+
 gstack_t *
 read_rawseq
 (
    FILE     * inputf,
-   gstack_t * uSQ
+   gstack_t * uSQ,
+   sorter_t * sorter
 )
 {
 
@@ -1293,17 +3293,21 @@ read_rawseq
          fprintf(stderr, "offending sequence:\n%s\n", seq);
          abort();
       }
-      for (size_t i = 0 ; i < seqlen ; i++) {
-         if (!valid_DNA_char[(int)seq[i]]) {
-            fprintf(stderr, "invalid input\n");
-            fprintf(stderr, "offending sequence:\n%s\n", seq);
+      if (ingest_seq(seq, seqlen)) {
+         if (lineno == 1 && strncmp(seq, "CRAM", 4) == 0) {
+            fprintf(stderr, "CRAM input is not supported "
+                  "(convert it to BAM first)\n");
             abort();
          }
+         fprintf(stderr, "invalid input\n");
+         fprintf(stderr, "offending sequence:\n%s\n", seq);
+         abort();
       }
-      useq_t *new = new_useq(count, seq, NULL);
+      useq_t *new = new_useq_ingested(count, seq, seqlen, NULL);
       new->nids = 1;
       new->seqid = (void *)(unsigned long)uSQ->nitems+1;
       push(new, &uSQ);
+      sorter_feed(sorter, uSQ);
    }
 
    free(line);
@@ -1316,7 +3320,8 @@ gstack_t *
 read_fasta
 (
    FILE     * inputf,
-   gstack_t * uSQ
+   gstack_t * uSQ,
+   sorter_t * sorter
 )
 {
 
@@ -1345,14 +3350,12 @@ read_fasta
             fprintf(stderr, "offending sequence:\n%s\n", line);
             abort();
          }
-         for (size_t i = 0 ; i < seqlen ; i++) {
-            if (!valid_DNA_char[(int)line[i]]) {
-               fprintf(stderr, "invalid input\n");
-               fprintf(stderr, "offending sequence:\n%s\n", line);
-               abort();
-            }
+         if (ingest_seq(line, seqlen)) {
+            fprintf(stderr, "invalid input\n");
+            fprintf(stderr, "offending sequence:\n%s\n", line);
+            abort();
          }
-         useq_t *new = new_useq(1, line, header);
+         useq_t *new = new_useq_ingested(1, line, seqlen, header);
          new->nids = 1;
          new->seqid = (void *)(unsigned long)uSQ->nitems+1;
          if (new == NULL) {
@@ -1360,6 +3363,7 @@ read_fasta
             krash();
          }
          push(new, &uSQ);
+         sorter_feed(sorter, uSQ);
       }
       else if (readh) {
          header = strdup(line);
@@ -1380,7 +3384,8 @@ gstack_t *
 read_fastq
 (
    FILE     * inputf,
-   gstack_t * uSQ
+   gstack_t * uSQ,
+   sorter_t * sorter
 )
 {
 
@@ -1395,6 +3400,7 @@ read_fastq
    char seq[M] = {0};
    char header[M] = {0};
    char info[2*M] = {0};
+   size_t slen = 0;
    int lineno = 0;
 
    int const readh = OUTPUTT == NRED_OUTPUT;
@@ -1414,14 +3420,13 @@ read_fastq
             fprintf(stderr, "offending sequence:\n%s\n", line);
             abort();
          }
-         for (size_t i = 0 ; i < seqlen ; i++) {
-            if (!valid_DNA_char[(int)line[i]]) {
-               fprintf(stderr, "invalid input\n");
-               fprintf(stderr, "offending sequence:\n%s\n", line);
-               abort();
-            }
+         if (ingest_seq(line, seqlen)) {
+            fprintf(stderr, "invalid input\n");
+            fprintf(stderr, "offending sequence:\n%s\n", line);
+            abort();
          }
-         strncpy(seq, line, M);
+         memcpy(seq, line, seqlen+1);
+         slen = seqlen;
       }
       else if (lineno % 4 == 0) {
          if (readh) {
@@ -1431,7 +3436,7 @@ read_fastq
                krash();
             }
          }
-         useq_t *new = new_useq(1, seq, info);
+         useq_t *new = new_useq_ingested(1, seq, slen, info);
          new->nids = 1;
          new->seqid = (void *)(unsigned long)uSQ->nitems+1;
          if (new == NULL) {
@@ -1439,6 +3444,7 @@ read_fastq
             krash();
          }
          push(new, &uSQ);
+         sorter_feed(sorter, uSQ);
       }
    }
 
@@ -1453,7 +3459,8 @@ read_PE_fastq
 (
    FILE     * inputf1,
    FILE     * inputf2,
-   gstack_t * uSQ
+   gstack_t * uSQ,
+   sorter_t * sorter
 )
 {
 
@@ -1519,22 +3526,18 @@ read_PE_fastq
                   line1, line2);
             abort();
          }
-         for (size_t i = 0 ; i < seqlen1 ; i++) {
-            if (!valid_DNA_char[(int)line1[i]]) {
-               fprintf(stderr, "invalid input\n");
-               fprintf(stderr, "offending sequence:\n%s\n", line1);
-               abort();
-            }
+         if (ingest_seq(line1, seqlen1)) {
+            fprintf(stderr, "invalid input\n");
+            fprintf(stderr, "offending sequence:\n%s\n", line1);
+            abort();
          }
-         for (size_t i = 0 ; i < seqlen2 ; i++) {
-            if (!valid_DNA_char[(int)line2[i]]) {
-               fprintf(stderr, "invalid input\n");
-               fprintf(stderr, "offending sequence:\n%s\n", line2);
-               abort();
-            }
+         if (ingest_seq(line2, seqlen2)) {
+            fprintf(stderr, "invalid input\n");
+            fprintf(stderr, "offending sequence:\n%s\n", line2);
+            abort();
          }
-         strncpy(seq1, line1, M);
-         strncpy(seq2, line2, M);
+         memcpy(seq1, line1, seqlen1+1);
+         memcpy(seq2, line2, seqlen2+1);
       }
       else if (lineno % 4 == 0) {
          if (readh) {
@@ -1559,7 +3562,7 @@ read_PE_fastq
             alert();
             krash();
          }
-         useq_t *new = new_useq(1, seq, info);
+         useq_t *new = new_useq_ingested(1, seq, scheck, info);
          new->nids = 1;
          new->seqid = (void *)(unsigned long)uSQ->nitems+1;
          if (new == NULL) {
@@ -1567,6 +3570,7 @@ read_PE_fastq
             krash();
          }
          push(new, &uSQ);
+         sorter_feed(sorter, uSQ);
       }
    }
 
@@ -1577,65 +3581,450 @@ read_PE_fastq
 }
 
 
+gstack_t *
+read_bam
+(
+   FILE     * inputf,
+   gstack_t * uSQ,
+   sorter_t * sorter,
+   int        thrmax,
+   int      * paired
+)
+// SYNOPSIS:
+//   Read the primary records of a BAM file. The BGZF blocks are
+//   decompressed by up to 'thrmax' threads. The records are stored
+//   as if they were read from fastq files: if the reads are paired,
+//   read 1 and read 2 must follow each other (as in unaligned BAM
+//   files) and they are joined as in 'read_PE_fastq()'. The value
+//   pointed by 'paired' is set to 1 if the reads are paired, to 0
+//   if they are not, and to -1 if the file has no records.
+{
+
+   bam_t *bam = bam_open(inputf, thrmax);
+   if (bam == NULL) abort();
+
+   char seq1[M] = {0};
+   char seq[2*M+8] = {0};
+   char header1[M] = {0};
+   char qual1[M] = {0};
+   char info[4*M] = {0};
+   int mate = 0;
+
+   int const readh = OUTPUTT == NRED_OUTPUT;
+   char sep[STARCODE_MAX_TAU+2] = {0};
+   memset(sep, '-', STARCODE_MAX_TAU+1);
+
+   *paired = -1;
+
+   bamrec_t rec;
+   int status;
+   while ((status = bam_next(bam, &rec)) == 1) {
+      if (rec.len > MAXBRCDLEN) {
+         fprintf(stderr, "max sequence length exceeded (%d)\n",
+               MAXBRCDLEN);
+         fprintf(stderr, "offending sequence:\n%s\n", rec.seq);
+         abort();
+      }
+      if (ingest_seq(rec.seq, rec.len)) {
+         fprintf(stderr, "invalid input\n");
+         fprintf(stderr, "offending sequence:\n%s\n", rec.seq);
+         abort();
+      }
+
+      int pe = (rec.flag & BAM_FPAIRED) != 0;
+      if (*paired < 0) *paired = pe;
+      if (pe != *paired) {
+         fprintf(stderr, "BAM file mixes paired-end and single-end "
+               "reads\n");
+         abort();
+      }
+
+      if (!pe) {
+         char *useqinfo = NULL;
+         if (readh) {
+            int scheck = snprintf(info, 2*M, "@%s\n%s", rec.name, rec.qual);
+            if (scheck < 0 || scheck > 2*M-1) {
+               alert();
+               krash();
+            }
+            useqinfo = info;
+         }
+         useq_t *new = new_useq_ingested(1, rec.seq, rec.len, useqinfo);
+         new->nids = 1;
+         new->seqid = (void *)(unsigned long)uSQ->nitems+1;
+         push(new, &uSQ);
+         sorter_feed(sorter, uSQ);
+      }
+      else if (!mate && (rec.flag & BAM_FREAD1)) {
+         // Keep read 1 until read 2 is found.
+         memcpy(seq1, rec.seq, rec.len+1);
+         strncpy(header1, rec.name, M-1);
+         strncpy(qual1, rec.qual, M-1);
+         mate = 1;
+      }
+      else if (mate && (rec.flag & BAM_FREAD2) &&
+            strcmp(header1, rec.name) == 0) {
+         int scheck;
+         const int isize = readh ? 4*M : 2*M;
+         if (readh) {
+            scheck = snprintf(info, isize, "@%s/1\n%s\n@%s/2\n%s",
+                  header1, qual1, rec.name, rec.qual);
+         }
+         else {
+            scheck = snprintf(info, isize, "%s/%s", seq1, rec.seq);
+         }
+         if (scheck < 0 || scheck > isize-1) {
+            alert();
+            krash();
+         }
+         scheck = snprintf(seq, 2*M+8, "%s%s%s", seq1, sep, rec.seq);
+         if (scheck < 0 || scheck > 2*M+7) {
+            alert();
+            krash();
+         }
+         useq_t *new = new_useq_ingested(1, seq, scheck, info);
+         new->nids = 1;
+         new->seqid = (void *)(unsigned long)uSQ->nitems+1;
+         push(new, &uSQ);
+         sorter_feed(sorter, uSQ);
+         mate = 0;
+      }
+      else {
+         fprintf(stderr, "paired-end BAM records must be "
+               "grouped by name (read 1 then read 2)\n");
+         fprintf(stderr, "offending read:\n%s\n", rec.name);
+         abort();
+      }
+   }
+
+   if (status < 0) abort();
+   if (mate) {
+      fprintf(stderr, "missing read 2 in paired-end BAM file\n");
+      fprintf(stderr, "offending read:\n%s\n", header1);
+      abort();
+   }
+
+   bam_close(bam);
+   return uSQ;
+
+}
+
+
 gstack_t *
 read_file
 (
    FILE      * inputf1,
    FILE      * inputf2,
+   sorter_t  * sorter,
+   const int   thrmax,
    const int   verbose
 )
+// SYNOPSIS:
+//   Read and parse an input file (or a pair of paired-end files). If
+//   'sorter' is not NULL, runs of the input are sorted while reading,
+//   and the items of the stack must not be used before the runs are
+//   merged with 'merge_runs()'.
 {
 
    if (inputf2 != NULL) FORMAT = PE_FASTQ;
    else {
       // Read first line of the file to guess format.
       // Store in global variable FORMAT.
-      char c = fgetc(inputf1);
-      switch(c) {
-         case EOF:
-            // Empty file.
-            return NULL;
-         case '>':
-            FORMAT = FASTA;
-            if (verbose) fprintf(stderr, "FASTA format detected\n");
-            break;
-         case '@':
-            FORMAT = FASTQ;
-            if (verbose) fprintf(stderr, "FASTQ format detected\n");
-            break;
-         default:
-            FORMAT = RAW;
-            if (verbose) fprintf(stderr, "raw format detected\n");
+      FORMAT = guess_format(inputf1);
+      if (FORMAT == UNSET) return NULL;
+      if (verbose) {
+         fprintf(stderr, "%s format detected\n",
+               FORMAT == FASTA ? "FASTA" :
+               FORMAT == FASTQ ? "FASTQ" :
+               FORMAT == BAM   ? "BAM"   : "raw");
+      }
+   }
+
+   gstack_t *uSQ = new_gstack();
+   if (uSQ == NULL) {
+      alert();
+      krash();
+   }
+
+   if (FORMAT == BAM) {
+      // BAM records are processed as (paired-end) fastq.
+      int paired;
+      uSQ = read_bam(inputf1, uSQ, sorter, thrmax, &paired);
+      FORMAT = paired ? PE_FASTQ : FASTQ;
+   }
+   else if (FORMAT == RAW)   uSQ = read_rawseq(inputf1, uSQ, sorter);
+   else if (FORMAT == FASTA) uSQ = read_fasta(inputf1, uSQ, sorter);
+   else if (FORMAT == FASTQ) uSQ = read_fastq(inputf1, uSQ, sorter);
+   else uSQ = read_PE_fastq(inputf1, inputf2, uSQ, sorter);
+
+   sorter_flush(sorter, uSQ);
+   return uSQ;
+
+}
+
+
+format_t
+guess_format
+(
+   FILE * inputf
+)
+// SYNOPSIS:
+//   Guess the format of the input from its first character, which
+//   is put back in the stream. Return 'UNSET' if the file is empty.
+{
+
+   int c = fgetc(inputf);
+   if (c == EOF) return UNSET;
+   if (ungetc(c, inputf) == EOF) {
+      alert();
+      krash();
+   }
+
+   if (c == '>') return FASTA;
+   if (c == '@') return FASTQ;
+   // First byte of the gzip magic.
+   if (c == 0x1f) return BAM;
+   return RAW;
+
+}
+
+
+gstack_t *
+read_files
+(
+   FILE      ** inputf1,
+   FILE      ** inputf2,
+   const int    ninputs,
+   sorter_t   * sorter,
+   const int    thrmax,
+   const int    verbose
+)
+// SYNOPSIS:
+//   Read and parse several input files (or pairs of files) with up to
+//   'thrmax' threads, each file into its own stack. The stacks are then
+//   merged in the order of the files, and the sequence ids are shifted
+//   so that they are numbered as if the files had been concatenated.
+//   All the files must have the same format, which is stored in the
+//   global variable FORMAT. If 'sorter' is not NULL, the sorted runs
+//   of all the files are collected in it (see 'read_file()').
+{
+
+   if (ninputs == 1) {
+      return read_file(inputf1[0], inputf2 == NULL ? NULL : inputf2[0],
+            sorter, thrmax, verbose);
+   }
+
+   if (inputf2 != NULL) FORMAT = PE_FASTQ;
+   else {
+      // All the (non empty) files must have the same format.
+      FORMAT = UNSET;
+      for (int i = 0 ; i < ninputs ; i++) {
+         format_t format = guess_format(inputf1[i]);
+         if (format == UNSET) continue;
+         if (FORMAT != UNSET && format != FORMAT) {
+            fprintf(stderr, "input files have different formats\n");
+            abort();
+         }
+         FORMAT = format;
+      }
+      if (FORMAT == UNSET) return NULL;
+      if (verbose) {
+         fprintf(stderr, "%s format detected\n",
+               FORMAT == FASTA ? "FASTA" :
+               FORMAT == FASTQ ? "FASTQ" :
+               FORMAT == BAM   ? "BAM"   : "raw");
+      }
+   }
+
+   gstack_t **useqS = calloc(ninputs, sizeof(gstack_t *));
+   int *paired = malloc(ninputs * sizeof(int));
+   if (useqS == NULL || paired == NULL) {
+      alert();
+      krash();
+   }
+
+   // Every file has its own runs, with a share of the threads.
+   sorter_t **sorters = NULL;
+   if (sorter != NULL) {
+      sorters = malloc(ninputs * sizeof(sorter_t *));
+      if (sorters == NULL) {
+         alert();
+         krash();
       }
+      for (int i = 0 ; i < ninputs ; i++) {
+         sorters[i] = new_sorter(sorter->runsize, max(1, thrmax/ninputs));
+      }
+   }
 
-      if (ungetc(c, inputf1) == EOF) {
+   // Parse the files concurrently.
+   int next = 0;
+   pthread_mutex_t mutex;
+   pthread_mutex_init(&mutex, NULL);
+   readargs_t args = {
+      .inputf1 = inputf1,
+      .inputf2 = inputf2,
+      .useqS   = useqS,
+      .sorters = sorters,
+      .paired  = paired,
+      .ninputs = ninputs,
+      .thrmax  = thrmax,
+      .format  = FORMAT,
+      .next    = &next,
+      .mutex   = &mutex,
+   };
+
+   int nthreads = min(thrmax, ninputs);
+   pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+   if (threads == NULL) {
+      alert();
+      krash();
+   }
+   for (int i = 0 ; i < nthreads ; i++) {
+      if (pthread_create(threads+i, NULL, read_worker, &args)) {
          alert();
          krash();
       }
    }
+   for (int i = 0 ; i < nthreads ; i++) {
+      pthread_join(threads[i], NULL);
+   }
+   pthread_mutex_destroy(&mutex);
+   free(threads);
+
+   if (FORMAT == BAM) {
+      // All the (non empty) BAM files must be either
+      // paired-end or single-end.
+      int pe = -1;
+      for (int i = 0 ; i < ninputs ; i++) {
+         if (paired[i] < 0) continue;
+         if (pe >= 0 && paired[i] != pe) {
+            fprintf(stderr, "input BAM files mix paired-end "
+                  "and single-end reads\n");
+            abort();
+         }
+         pe = paired[i];
+      }
+      FORMAT = pe > 0 ? PE_FASTQ : FASTQ;
+   }
+   free(paired);
 
-   gstack_t *uSQ = new_gstack();
+   // Merge the stacks.
+   int total = 0;
+   for (int i = 0 ; i < ninputs ; i++) total += useqS[i]->nitems;
+
+   gstack_t *uSQ = malloc(gstack_size(total));
    if (uSQ == NULL) {
       alert();
       krash();
    }
+   uSQ->nslots = total;
+   uSQ->nitems = 0;
+
+   for (int i = 0 ; i < ninputs ; i++) {
+      const int offset = uSQ->nitems;
+      if (sorter != NULL) {
+         // Move the runs, the items of the stack are stale.
+         for (int r = 0 ; r < sorters[i]->nruns ; r++) {
+            sortrun_t run = sorters[i]->runs[r];
+            for (int j = 0 ; j < run.nuniq ; j++) {
+               shift_seqids(run.items[j], offset);
+            }
+            if (sorter->nruns == sorter->nslots) {
+               sorter->nslots *= 2;
+               sorter->runs = realloc(sorter->runs,
+                     sorter->nslots * sizeof(sortrun_t));
+               if (sorter->runs == NULL) {
+                  alert();
+                  krash();
+               }
+            }
+            sorter->runs[sorter->nruns++] = run;
+         }
+         sorters[i]->nruns = 0;
+         destroy_sorter(sorters[i]);
+         uSQ->nitems += useqS[i]->nitems;
+      }
+      else {
+         for (int j = 0 ; j < useqS[i]->nitems ; j++) {
+            useq_t *u = useqS[i]->items[j];
+            shift_seqids(u, offset);
+            uSQ->items[uSQ->nitems++] = u;
+         }
+      }
+      free(useqS[i]);
+   }
+   free(useqS);
+   free(sorters);
+
+   return uSQ;
+
+}
 
-   if (FORMAT == RAW)      return read_rawseq(inputf1, uSQ);
-   if (FORMAT == FASTA)    return read_fasta(inputf1, uSQ);
-   if (FORMAT == FASTQ)    return read_fastq(inputf1, uSQ);
-   if (FORMAT == PE_FASTQ) return read_PE_fastq(inputf1, inputf2, uSQ);
 
-   return NULL;
+void *
+read_worker
+(
+   void * args
+)
+// SYNOPSIS:
+//   Thread function of 'read_files()'. Take the next unread file (or
+//   pair of files) and parse it into its own stack, until none is left.
+{
+
+   readargs_t *readargs = (readargs_t *) args;
+   // The format is local to the thread that calls 'read_files()'.
+   const format_t format = readargs->format;
+
+   while (1) {
+      pthread_mutex_lock(readargs->mutex);
+      int i = (*readargs->next)++;
+      pthread_mutex_unlock(readargs->mutex);
+      if (i >= readargs->ninputs) return NULL;
+
+      gstack_t *uSQ = new_gstack();
+      if (uSQ == NULL) {
+         alert();
+         krash();
+      }
+
+      FILE *inputf1 = readargs->inputf1[i];
+      sorter_t *sorter = readargs->sorters ? readargs->sorters[i] : NULL;
+      readargs->paired[i] = -1;
+      if (format == PE_FASTQ) {
+         uSQ = read_PE_fastq(inputf1, readargs->inputf2[i], uSQ, sorter);
+      }
+      else if (guess_format(inputf1) != UNSET) {
+         if (format == RAW)   uSQ = read_rawseq(inputf1, uSQ, sorter);
+         if (format == FASTA) uSQ = read_fasta(inputf1, uSQ, sorter);
+         if (format == FASTQ) uSQ = read_fastq(inputf1, uSQ, sorter);
+         if (format == BAM) {
+            // Share the threads between the files.
+            int nthreads = readargs->thrmax / readargs->ninputs;
+            uSQ = read_bam(inputf1, uSQ, sorter, max(1, nthreads),
+                  readargs->paired + i);
+         }
+      }
+      sorter_flush(sorter, uSQ);
+
+      readargs->useqS[i] = uSQ;
+   }
 
 }
 
 
 int
-pad_useq
+useq_lengths
 (
    gstack_t * useqS,
    int      * median
 )
+// SYNOPSIS:
+//   Compute the maximum and the median length of the sequences.
+//   The sequences are not padded: the maximum length is the height
+//   of the tries, where shorter sequences are virtually padded.
+//
+// RETURN:
+//   The maximum length.
 {
 
    // Compute maximum length.
@@ -1648,30 +4037,14 @@ pad_useq
 
    // Alloc median bins. (Initializes to 0)
    int  * count = calloc((maxlen + 1), sizeof(int));
-   char * spaces = malloc((maxlen + 1) * sizeof(char));
-   if (spaces == NULL || count == NULL) {
+   if (count == NULL) {
       alert();
       krash();
    }
-   for (int i = 0 ; i < maxlen ; i++) spaces[i] = ' ';
-   spaces[maxlen] = '\0';
 
-   // Pad all sequences with spaces.
    for (int i = 0 ; i < useqS->nitems ; i++) {
       useq_t *u = useqS->items[i];
-      int len = strlen(u->seq);
-      count[len]++;
-      if (len == maxlen) continue;
-      // Create a new sequence with padding characters.
-      char *padded = malloc((maxlen + 1) * sizeof(char));
-      if (padded == NULL) {
-         alert();
-         krash();
-      }
-      memcpy(padded, spaces, maxlen + 1);
-      memcpy(padded+maxlen-len, u->seq, len);
-      free(u->seq);
-      u->seq = padded;
+      count[strlen(u->seq)]++;
    }
 
    // Compute median.
@@ -1683,38 +4056,11 @@ pad_useq
 
    // Free and return.
    free(count);
-   free(spaces);
    return maxlen;
 
 }
 
 
-void
-unpad_useq
-(
-   gstack_t *useqS
-)
-{
-   // Take the length of the first sequence (assume all
-   // sequences have the same length).
-   int len = strlen(((useq_t *) useqS->items[0])->seq);
-   for (int i = 0 ; i < useqS->nitems ; i++) {
-      useq_t *u = (useq_t *) useqS->items[i];
-      int pad = 0;
-      while (u->seq[pad] == ' ') pad++;
-      // Create a new sequence without paddings characters.
-      char *unpadded = malloc((len - pad + 1) * sizeof(char));
-      if (unpadded == NULL) {
-         alert();
-         krash();
-      }
-      memcpy(unpadded, u->seq + pad, len - pad + 1);
-      free(u->seq);
-      u->seq = unpadded;
-   }
-   return;
-}
-
 void
 transfer_useq_ids
 (
@@ -1794,13 +4140,11 @@ transfer_counts_and_update_canonicals
       if (matches->nitems > 0) break;
    }
 
-   // Distribute counts evenly among parents.
+   // Distribute counts evenly among parents. The remainder
+   // goes to the first parents, the matches are in sequence id
+   // order (see 'sort_matches()').
    int Q = useq->count / matches->nitems;
    int R = useq->count % matches->nitems;
-   // Depending on the order in which matches were made
-   // (which is more or less random), the transferred
-   // counts can differ by 1. For this reason, the output
-   // can be slightly different for different number of tries.
    for (int i = 0 ; i < matches->nitems ; i++) {
       useq_t *match = (useq_t *) matches->items[i];
       match->count += Q + (i < R);
@@ -1833,6 +4177,42 @@ transfer_counts_and_update_canonicals
 }
 
 
+int
+seqid_order
+(
+   const void *a,
+   const void *b
+)
+{
+   int id1 = first_seqid(*(useq_t **) a);
+   int id2 = first_seqid(*(useq_t **) b);
+   return (id1 > id2) - (id1 < id2);
+}
+
+
+void
+sort_matches
+(
+   gstack_t * uSQ
+)
+// SYNOPSIS:
+//   Sort the matches of every distance by sequence id, so that the
+//   clustering does not depend on the order of the search jobs (and
+//   thus on the number of threads). Sequence ids are unique.
+{
+   for (int i = 0 ; i < uSQ->nitems ; i++) {
+      useq_t *u = (useq_t *) uSQ->items[i];
+      if (u->matches == NULL) continue;
+      gstack_t *matches;
+      for (int j = 0 ; (matches = u->matches[j]) != TOWER_TOP ; j++) {
+         if (matches->nitems < 2) continue;
+         qsort(matches->items, matches->nitems, sizeof(useq_t *),
+               seqid_order);
+      }
+   }
+}
+
+
 int
 addmatch
 (
@@ -1873,11 +4253,12 @@ new_lookup
 (
  int slen,
  int maxlen,
- int tau
+ int tau,
+ int ntries
 )
 {
 
-   lookup_t * lut = (lookup_t *) malloc(2*sizeof(int) + sizeof(int *) +
+   lookup_t * lut = (lookup_t *) malloc(sizeof(lookup_t) +
          (tau+1)*sizeof(char *));
    if (lut == NULL) {
       alert();
@@ -1889,9 +4270,10 @@ new_lookup
    int rem = tau - slen % (tau + 1);
 
    // Set parameters.
-   lut->slen  = maxlen;
-   lut->kmers = tau + 1;
-   lut->klen  = malloc(lut->kmers * sizeof(int));
+   lut->slen   = maxlen;
+   lut->kmers  = tau + 1;
+   lut->ntries = ntries;
+   lut->klen   = malloc(lut->kmers * sizeof(int));
    
    // Compute k-mer lengths.
    if (k > MAX_K_FOR_LOOKUP)
@@ -1899,10 +4281,11 @@ new_lookup
    else
       for (int i = 0; i < tau + 1; i++) lut->klen[i] = k - (rem-- > 0);
 
-   // Allocate lookup tables.
+   // Allocate lookup tables. The extra 8 bytes allow to read a
+   // 64-bit word from any row (see 'lut_search()').
    for (int i = 0; i < tau + 1; i++) {
-      lut->lut[i] = calloc(1 << max(0,(2*lut->klen[i] - 3)),
-            sizeof(char));
+      size_t nkmers = (size_t) 1 << (2 * max(0, lut->klen[i]));
+      lut->lut[i] = calloc(nkmers * ntries / 8 + 9, sizeof(char));
       if (lut->lut[i] == NULL) {
          while (--i >= 0) {
             free(lut->lut[i]);
@@ -1934,45 +4317,74 @@ int
 lut_search
 (
  lookup_t * lut,
- useq_t   * query
+ useq_t   * query,
+ int        skip,
+ uint32_t * mask
 )
 // SYNOPSIS:
-//   Perform of a lookup search of the query and determine whether
-//   at least one of the k-mers extracted from the query was inserted
-//   in the lookup table. If this is not the case, the trie search can
-//   be skipped because the query cannot have a match for the given
-//   tau.
+//   Perform of a lookup search of the query and determine in which
+//   tries at least one of the k-mers extracted from the query was
+//   inserted. If this is not the case for a trie, the trie search
+//   can be skipped because the query cannot have a match for the
+//   given tau. Each probe reads the bits of all the tries at once.
 //   
 // ARGUMENTS:
 //   lut: the lookup table to search
 //   query: the query as a useq.
+//   skip: a trie to leave out of the search, or -1.
+//   mask: output bitmask of the tries ('(ntries+31)/32' words).
 //
 // RETURN:
 //   1 if any of the k-mers extracted from the query is in the
 //   lookup table, 0 if not, and -1 in case of failure.
 //
 // SIDE-EFFECTS:
-//   None.
+//   Overwrites 'mask'.
 {
 
+   const int ntries = lut->ntries;
+   const int nwords = (ntries + 31) / 32;
+   memset(mask, 0, nwords * sizeof(uint32_t));
+
+   int seqlen = strlen(query->seq);
+   // Shorter sequences are virtually padded to 'lut->slen'.
+   int pad = max(0, lut->slen - seqlen);
+
    // Start from the end of the sequence. This will avoid potential
    // misalignments on the first kmer due to insertions.
+   int found = 0;
    int offset = lut->slen;
    // Iterate for all k-mers and for ins/dels.
-   for (int i = lut->kmers - 1; i >= 0; i--) {
+   for (int i = lut->kmers - 1; i >= 0 && found == 0; i--) {
       offset -= lut->klen[i];
       for (int j = -(lut->kmers - 1 - i); j <= lut->kmers - 1 - i; j++) {
          // If sequence contains 'N' seq2id will return -1.
-         int seqid = seq2id(query->seq + offset + j, lut->klen[i]);
-         // Make sure to never proceed passed the end of string.
-         if (seqid == -2) return -1;
+         int seqid = padded_seq2id(query->seq, pad, offset + j,
+               lut->klen[i]);
+         // Make sure to never proceed passed the end of string (the
+         // query is then searched everywhere).
+         if (seqid == -2) {
+            memset(mask, 0xff, nwords * sizeof(uint32_t));
+            found = -1;
+            break;
+         }
          if (seqid == -1) continue;
-         // The lookup table proper is implemented as a bitmap.
-         if ((lut->lut[i][seqid/8] >> (seqid%8)) & 1) return 1;
+         // Read the row of the k-mer by words of 32 tries.
+         size_t row = (size_t) seqid * ntries;
+         for (int w = 0 ; w < nwords ; w++) {
+            size_t bit = row + 32*w;
+            uint64_t word;
+            memcpy(&word, lut->lut[i] + bit/8, sizeof(uint64_t));
+            mask[w] |= word >> (bit%8);
+         }
       }
    }
 
-   return 0;
+   if (ntries % 32) mask[nwords-1] &= (1u << (ntries % 32)) - 1;
+   if (skip >= 0) mask[skip/32] &= ~(1u << (skip%32));
+   if (found < 0) return -1;
+   for (int w = 0 ; w < nwords ; w++) found |= mask[w] != 0;
+   return found;
 
 }
 
@@ -1981,19 +4393,26 @@ int
 lut_insert
 (
    lookup_t * lut,
-   useq_t   * query
+   useq_t   * query,
+   int        trie
 )
 {
 
    int seqlen = strlen(query->seq);
-
+   // An empty sequence has no k-mer.
+   if (seqlen == 0) return 0;
+   // Shorter sequences are virtually padded to 'lut->slen'.
+   int pad = max(0, lut->slen - seqlen);
    int offset = lut->slen;
    for (int i = lut->kmers-1; i >= 0; i--) {
       offset -= lut->klen[i];
-      if (offset + lut->klen[i] > seqlen) continue;
-      int seqid = seq2id(query->seq + offset, lut->klen[i]);
+      if (offset + lut->klen[i] > pad + seqlen) continue;
+      int seqid = padded_seq2id(query->seq, pad, offset, lut->klen[i]);
       // The lookup table proper is implemented as a bitmap.
-      if (seqid >= 0) lut->lut[i][seqid/8] |= (1 << (seqid%8));
+      if (seqid >= 0) {
+         size_t bit = (size_t) seqid * lut->ntries + trie;
+         lut->lut[i][bit/8] |= (1 << (bit%8));
+      }
       // Make sure to never proceed passed the end of string.
       else if (seqid == -2) return 1;
    }
@@ -2030,6 +4449,24 @@ seq2id
 }
 
 
+int
+padded_seq2id
+(
+  char * seq,
+  int    pad,
+  int    pos,
+  int    slen
+)
+// SYNOPSIS:
+//   Same as 'seq2id()' for the k-mer at position 'pos' of 'seq'
+//   virtually left-padded with 'pad' spaces. The padding counts
+//   as 'A' (0), so it only shortens the k-mer.
+{
+   if (pos >= pad) return seq2id(seq + pos - pad, slen);
+   return seq2id(seq, max(0, slen - (pad - pos)));
+}
+
+
 useq_t *
 new_useq
 (
@@ -2041,15 +4478,40 @@ new_useq
    // Check input.
    if (seq == NULL) return NULL;
 
+   size_t slen = strlen(seq);
+   useq_t *new = new_useq_ingested(count, seq, slen, info);
+   for (size_t i = 0; i < slen; i++)
+      new->seq[i] = capitalize[(uint8_t)new->seq[i]];
+
+   return new;
+
+}
+
+
+useq_t *
+new_useq_ingested
+(
+   int      count,
+   char   * seq,
+   size_t   slen,
+   char   * info
+)
+// SYNOPSIS:
+//   Same as 'new_useq()' for a sequence of known length 'slen' that
+//   was already passed through 'ingest_seq()' (and is thus already
+//   capitalized). Used by the readers to avoid a second pass.
+{
    useq_t *new = calloc(1, sizeof(useq_t));
    if (new == NULL) {
       alert();
       krash();
    }
-   size_t slen = strlen(seq);
    new->seq = malloc(slen+1);
-   for (size_t i = 0; i < slen; i++)
-      new->seq[i] = capitalize[(uint8_t)seq[i]];
+   if (new->seq == NULL) {
+      alert();
+      krash();
+   }
+   memcpy(new->seq, seq, slen);
    new->seq[slen] = 0;
    new->count = count;
    new->nids  = 0;
@@ -24,7 +24,9 @@
 #ifndef _STARCODE_HEADER
 #define _STARCODE_HEADER
 
+#ifndef _GNU_SOURCE
 #define _GNU_SOURCE
+#endif
 #include <stdio.h>
 
 #define VERSION          "starcode-v1.0"
@@ -42,9 +44,31 @@ typedef enum {
    COMPONENTS_CLUSTER
 } cluster_t;
 
+// A cluster passed to the callbacks of 'starcode_stream()'. The
+// strings belong to starcode and are only valid during the call.
+typedef struct {
+   int            number;        // Rank in the output (0-based).
+   const char   * canonical;     // Canonical sequence.
+   int            canonical_id;  // First input id of the canonical.
+   int            count;         // Count of the cluster.
+   int            nmembers;      // Number of unique sequences.
+   const char  ** members;       // Unique sequences of the cluster.
+} starcode_cluster_t;
+
+// Callbacks of 'starcode_stream()', either can be NULL. A non-zero
+// return value stops the run. 'assign' is called for every input
+// read (ids are 1-based, as with '--seq-id') with the number of its
+// cluster, or -1 if the read is not assigned.
+typedef struct {
+   int   (*cluster) (const starcode_cluster_t *, void *);
+   int   (*assign)  (int, int, void *);
+   void  * data;
+} starcode_callbacks_t;
+
 int starcode(
-   FILE *inputf1,
-   FILE *inputf2,
+   FILE **inputf1,
+   FILE **inputf2,
+   const int ninputs,
    FILE *outputf1,
    FILE *outputf2,
          int tau,
@@ -54,7 +78,60 @@ int starcode(
          int parent_to_child,
    const int showclusters,
    const int showids,
-   const int outputt
+   const int outputt,
+   const int splitsearch,
+   const int longmode,
+   const int maxindels
+);
+
+int starcode_batch(
+   const char *manifest,
+         int tau,
+   const int verbose,
+   const int thrmax,
+   const int clusteralg,
+   const int parent_to_child,
+   const int showclusters,
+   const int showids,
+   const int outputt,
+   const int splitsearch,
+   const int longmode,
+   const int maxindels
+);
+
+int starcode_cluster(
+   const char *seqs,
+   const size_t width,
+   const int *counts,
+   const int nseq,
+         int tau,
+   const int thrmax,
+   const int clusteralg,
+   const int parent_to_child,
+         int *clusters,
+         int *canonicals,
+         int *sizes
+);
+
+int starcode_stream(
+   FILE **inputf1,
+   FILE **inputf2,
+   const int ninputs,
+         int tau,
+   const int verbose,
+   const int thrmax,
+   const int clusteralg,
+   const int parent_to_child,
+   const starcode_callbacks_t *callbacks
+);
+
+int starcode_serve(
+         FILE **inputf,
+   const int ninputs,
+   const char *socketpath,
+         int tau,
+   const int verbose,
+   const int thrmax
 );
 
 #endif
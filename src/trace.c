@@ -0,0 +1,225 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+
+#define TRACE_NAME_SIZE 32
+#define TRACE_ARGS_SIZE 192
+
+typedef struct tevent_t tevent_t;
+
+struct tevent_t {
+   char     name[TRACE_NAME_SIZE];
+   char     args[TRACE_ARGS_SIZE];   // JSON members (without braces).
+   int      lane;
+   double   start;                   // Microseconds.
+   double   end;
+};
+
+//    Global variables    //
+static FILE            * TRACEF  = NULL;
+static tevent_t        * EVENTS  = NULL;
+static int               NEVENTS = 0;
+static int               NSLOTS  = 0;
+static int               MAXLANE = 0;
+static double            ORIGIN  = 0.0;
+static pthread_mutex_t   TMUTEX  = PTHREAD_MUTEX_INITIALIZER;
+// Open stage on the main lane.
+static char              STAGE[TRACE_NAME_SIZE] = {0};
+static double            STAGE_START = 0.0;
+
+
+double
+trace_now
+(void)
+// SYNOPSIS:
+//   Time in microseconds since the trace was opened.
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3 - ORIGIN;
+}
+
+
+int
+trace_enabled
+(void)
+{
+   return TRACEF != NULL;
+}
+
+
+int
+trace_open
+(
+   const char * path
+)
+// SYNOPSIS:
+//   Start recording events. They are kept in memory and written
+//   to 'path' by 'trace_close()'.
+//
+// RETURN:
+//   0 upon success, 1 upon failure.
+{
+   TRACEF = fopen(path, "w");
+   if (TRACEF == NULL) return 1;
+   ORIGIN = 0.0;
+   ORIGIN = trace_now();
+   return 0;
+}
+
+
+void
+trace_event
+(
+   const char * name,
+   int          lane,
+   double       start,
+   double       end,
+   const char * fmt,
+   ...
+)
+// SYNOPSIS:
+//   Record a complete event on a lane. The arguments are given
+//   as a format for the members of a JSON object, e.g. "\"n\":%d".
+//   The format can be NULL. Thread safe.
+{
+   if (TRACEF == NULL) return;
+   pthread_mutex_lock(&TMUTEX);
+   if (NEVENTS == NSLOTS) {
+      int nslots = NSLOTS ? 2 * NSLOTS : 1024;
+      tevent_t *ptr = realloc(EVENTS, nslots * sizeof(tevent_t));
+      if (ptr == NULL) {
+         // Drop the event rather than fail the run.
+         pthread_mutex_unlock(&TMUTEX);
+         return;
+      }
+      EVENTS = ptr;
+      NSLOTS = nslots;
+   }
+   tevent_t *ev = EVENTS + NEVENTS++;
+   strncpy(ev->name, name, TRACE_NAME_SIZE-1);
+   ev->name[TRACE_NAME_SIZE-1] = '\0';
+   ev->args[0] = '\0';
+   if (fmt != NULL) {
+      va_list ap;
+      va_start(ap, fmt);
+      vsnprintf(ev->args, TRACE_ARGS_SIZE, fmt, ap);
+      va_end(ap);
+   }
+   ev->lane  = lane;
+   ev->start = start;
+   ev->end   = end;
+   if (lane > MAXLANE) MAXLANE = lane;
+   pthread_mutex_unlock(&TMUTEX);
+}
+
+
+void
+trace_stage
+(
+   const char * name
+)
+// SYNOPSIS:
+//   Close the current stage of the pipeline and open a new one
+//   called 'name' (or none if 'name' is NULL).
+{
+   if (TRACEF == NULL) return;
+   double now = trace_now();
+   if (STAGE[0] != '\0') {
+      trace_event(STAGE, TRACE_MAIN_LANE, STAGE_START, now, NULL);
+   }
+   STAGE[0] = '\0';
+   if (name != NULL) {
+      strncpy(STAGE, name, TRACE_NAME_SIZE-1);
+      STAGE_START = now;
+   }
+}
+
+
+static void
+write_json_string
+(
+   FILE       * f,
+   const char * str
+)
+// SYNOPSIS:
+//   Write 'str' as a JSON string, with quotes, backslashes and
+//   control characters escaped.
+{
+   fputc('"', f);
+   for ( ; *str != '\0' ; str++) {
+      unsigned char c = *str;
+      if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+      else if (c < 0x20) fprintf(f, "\\u%04x", c);
+      else fputc(c, f);
+   }
+   fputc('"', f);
+}
+
+
+int
+trace_close
+(void)
+// SYNOPSIS:
+//   Close the open stage, write the trace file and release the
+//   events.
+//
+// RETURN:
+//   0 upon success, 1 upon failure.
+{
+   if (TRACEF == NULL) return 0;
+   trace_stage(NULL);
+
+   fprintf(TRACEF, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+   // Lane names.
+   fprintf(TRACEF, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+         "\"tid\":0,\"args\":{\"name\":\"pipeline\"}}");
+   for (int i = 1 ; i <= MAXLANE ; i++) {
+      fprintf(TRACEF, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}", i, i);
+   }
+   for (int i = 0 ; i < NEVENTS ; i++) {
+      tevent_t *ev = EVENTS + i;
+      fprintf(TRACEF, ",\n{\"name\":");
+      write_json_string(TRACEF, ev->name);
+      fprintf(TRACEF, ",\"ph\":\"X\",\"pid\":1,"
+            "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{%s}}",
+            ev->lane, ev->start, ev->end - ev->start, ev->args);
+   }
+   fprintf(TRACEF, "\n]}\n");
+
+   int status = fclose(TRACEF) != 0;
+   TRACEF = NULL;
+   free(EVENTS);
+   EVENTS = NULL;
+   NEVENTS = NSLOTS = MAXLANE = 0;
+   return status;
+}
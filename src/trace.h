@@ -0,0 +1,42 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+#ifndef _STARCODE_TRACE_HEADER
+#define _STARCODE_TRACE_HEADER
+
+// Timeline of the pipeline stages and of the jobs, written in the
+// Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+// Stages are on lane 0, jobs on lanes 1 to 'thrmax'. All functions
+// do nothing unless 'trace_open()' was called.
+
+#define TRACE_MAIN_LANE 0
+
+int     trace_open (const char *);
+int     trace_close (void);
+int     trace_enabled (void);
+double  trace_now (void);
+void    trace_event (const char *, int, double, double, const char *, ...)
+           __attribute__ ((format (printf, 5, 6)));
+void    trace_stage (const char *);
+
+#endif
@@ -94,23 +94,73 @@ struct arg_t {
    int         seed_depth;
    int         height;
    int         err;
+   int         split;       // Depth down to which 'budget' applies.
+   char        budget;      // Max distance in the first 'split' levels.
+   int         indels;      // Half width of the band ('poucet_band()').
 };
 
+// Pending step of a query in 'search_batch()'. The cache is the
+// dynamic programming column of 'node' for this query, the trie
+// itself is not modified. A 'dashing' frame only checks that the
+// rest of the query is an exact suffix below 'node'.
+struct frame_t {
+   node_t * node;
+   int      depth;
+   char     dashing;
+   char     cache[2*TAU+1];
+};
+
+// State of a query in 'search_batch()'.
+struct lane_t {
+   int              * query;
+   gstack_t        ** hits;
+   struct frame_t   * frames;
+   int                nframes;
+};
+
+#define BATCH_LANES 8      // Queries interleaved by 'search_batch()'.
+
+void     batch_step (struct lane_t *, int, int);
 void     dash (node_t*, const int*, struct arg_t);
 void     destroy_from (node_t*, void(*)(void*), int, int, int);
-int      get_height (trie_t*);
 void     init_pebbles (node_t*);
 node_t * insert (node_t *, int);
 node_t * insert_wo_malloc (node_t *, int, node_t *);
 node_t * new_trienode (void);
 void     poucet (node_t*, int, struct arg_t);
+static inline void lower_arm (const char *, char *, int, int32_t,
+               const int *, int, int, int, char, int, int)
+               __attribute__ ((always_inline));
+static inline void poucet_kernel (node_t*, int, struct arg_t*, int, int)
+               __attribute__ ((always_inline));
+static inline void upper_arm (const char *, char *, int32_t, const int *,
+               int, int, int, int) __attribute__ ((always_inline));
+void     poucet_band (node_t*, int, struct arg_t);
+void     poucet_fixed (node_t*, int, struct arg_t);
 int      recursive_count_nodes (node_t * node, int, int);
+int      search_from (trie_t*, const char*, int, gstack_t**, int, int,
+               int, int, int);
 
 // Globals.
 int ERROR = 0;
 
 int get_height(trie_t *trie) { return trie->info->height; }
 
+// Prefetch a node for writing. The children and the cache may
+// be on two different cache lines, so both ends are fetched.
+static inline void
+prefetch_node
+(
+   node_t * node
+)
+{
+#if defined(__GNUC__)
+   if (node == NULL) return;
+   __builtin_prefetch(node, 1, 3);
+   __builtin_prefetch(node->cache + 2*TAU, 1, 3);
+#endif
+}
+
 // ------  SEARCH FUNCTIONS ------ //
 
 int
@@ -147,6 +197,177 @@ search
 //   array can be resized (which is why the address of the pointers is    
 //   passed as a parameter) and the trie is modified by the trailinng of  
 //   effect of the search.                                                
+{
+   return search_from(trie, query, tau, hits, start_depth, seed_depth,
+         0, tau, tau);
+}
+
+
+int
+search_band
+(
+         trie_t   *  trie,
+   const char     *  query,
+   const int         tau,
+   const int         indels,
+         gstack_t ** hits,
+         int         start_depth,
+   const int         seed_depth
+)
+// SYNOPSIS:                                                              
+//   Same as 'search()' with at most 'indels' positions of shift between
+//   the query and the hits. The alignments are restricted to a band of
+//   '2*indels+1' diagonals of the dynamic programming table instead of
+//   '2*tau+1', so up to 'tau' substitutions are allowed but the sum of
+//   insertions minus deletions never exceeds 'indels' in absolute value
+//   at any position. The search is much cheaper when 'indels' is small
+//   and 'tau' is large (see 'poucet_band()'). With 'indels' equal to 0
+//   the distance is the Hamming distance.
+//
+//   All the sequences must have the height of the trie because the
+//   band does not implement the "PAD exceptions" (see 'poucet()').
+//                                                                        
+// PARAMETERS:                                                            
+//   trie: the trie to query                                              
+//   query: the query as an ascii string                                  
+//   tau: the maximum edit distance                                       
+//   indels: the maximum shift between the query and the hits            
+//   hits: a hit stack to push the hits                                   
+//   start_depth: the depth to start the search                           
+//   seed_depth: how deep to seed pebbles                                 
+//                                                                        
+// RETURN:                                                                
+//   0 if everything went OK, the line of the last error otherwise.       
+//                                                                        
+// SIDE EFFECTS:                                                          
+//   Same as 'search()'. The caches written by 'poucet_band()' differ     
+//   from those of 'poucet()', so the pebbles must not be shared between
+//   'search_band()' and the other search functions.
+{
+
+   int height = get_height(trie);
+   if (strlen(query) != (size_t) height) {
+      fprintf(stderr, "error: band search requires length %d\n", height);
+      return __LINE__;
+   }
+   if (indels < 0) {
+      fprintf(stderr, "error: negative number of indels\n");
+      return __LINE__;
+   }
+
+   return search_from(trie, query, tau, hits, start_depth, seed_depth,
+         0, tau, min(indels, tau));
+
+}
+
+
+int
+search_split
+(
+         trie_t   *  trie,
+         trie_t   *  rtrie,
+   const char     *  query,
+   const int         tau,
+         gstack_t ** hits,
+         int         start_depth,
+   const int         seed_depth
+)
+// SYNOPSIS:                                                              
+//   Same as 'search()' with a second trie 'rtrie' holding the reversed
+//   sequences of 'trie'. The error budget is split between the two
+//   halves of the sequences: if the distance is at most 'tau', then
+//   either the first half has at most 'tau/2' errors, or the second
+//   half has at most 'tau - tau/2 - 1' (pigeonhole principle). The
+//   query is searched in 'trie' with the first budget down to half the
+//   height, and reversed in 'rtrie' with the second budget. The upper
+//   levels, where the tries are widest, are thus explored with half
+//   the errors, even if the errors are at the start of the sequences.
+//
+//   The hits found in both tries are reported once. Only the search
+//   in 'trie' uses the pebbles (the reversed queries are not sorted).
+//   All the sequences must have the height of the trie because the
+//   padding is not symmetric (see 'poucet()').
+//                                                                        
+// PARAMETERS:                                                            
+//   trie: the trie to query                                              
+//   rtrie: the trie of the reversed sequences                           
+//   query: the query as an ascii string                                  
+//   tau: the maximum edit distance                                       
+//   hits: a hit stack to push the hits                                   
+//   start_depth: the depth to start the search in 'trie'                
+//   seed_depth: how deep to seed pebbles in 'trie'                      
+//                                                                        
+// RETURN:                                                                
+//   0 if everything went OK, the line of the last error otherwise.       
+//                                                                        
+// SIDE EFFECTS:                                                          
+//   Same as 'search()' for both tries.                                  
+{
+
+   int height = get_height(trie);
+   int length = strlen(query);
+   if (length != height || get_height(rtrie) != height) {
+      fprintf(stderr, "error: split search requires length %d\n", height);
+      return __LINE__;
+   }
+
+   const int split = height / 2;
+   const int budget = tau / 2;
+   int err = search_from(trie, query, tau, hits, start_depth, seed_depth,
+         split, budget, tau);
+   if (err || tau == 0) return err;
+
+   // Remember the hits of the first search.
+   int nfirst[TAU+1];
+   for (int d = 0 ; d <= tau ; d++) nfirst[d] = hits[d]->nitems;
+
+   char reversed[M];
+   for (int i = 0 ; i < length ; i++) reversed[i] = query[length-1-i];
+   reversed[length] = '\0';
+   err = search_from(rtrie, reversed, tau, hits, 0, 0,
+         height - split, tau - budget - 1, tau);
+   if (err) return err;
+
+   // Remove the hits that were found twice.
+   for (int d = 0 ; d <= tau ; d++) {
+      gstack_t *stack = hits[d];
+      int n = nfirst[d];
+      for (int i = nfirst[d] ; i < stack->nitems ; i++) {
+         int seen = 0;
+         for (int j = 0 ; j < nfirst[d] ; j++) {
+            if (stack->items[j] == stack->items[i]) {
+               seen = 1;
+               break;
+            }
+         }
+         if (!seen) stack->items[n++] = stack->items[i];
+      }
+      stack->nitems = n;
+   }
+
+   return 0;
+
+}
+
+
+int
+search_from
+(
+         trie_t   *  trie,
+   const char     *  query,
+   const int         tau,
+         gstack_t ** hits,
+         int         start_depth,
+   const int         seed_depth,
+   const int         split,
+   const int         budget,
+   const int         indels
+)
+// SYNOPSIS:                                                              
+//   Back end of 'search()', 'search_split()' and 'search_band()'. Down
+//   to depth 'split', the branches with more than 'budget' errors are
+//   abandoned. If 'indels' is less than 'tau', the alignments are
+//   restricted to the band of 'poucet_band()'.
 {
    ERROR = 0;
 
@@ -173,11 +394,14 @@ search
 
    // Translate the query string. The first 'char' is kept to store
    // the length of the query, which shifts the array by 1 position.
+   // Queries shorter than the height are virtually prefixed with
+   // 'PAD' so that they end at the leaves of the trie.
+   int pad = height - length;
    int translated[M];
-   translated[0] = length;
-   translated[length+1] = EOS;
-   for (int i = max(0, start_depth-TAU) ; i < length ; i++) {
-      translated[i+1] = altranslate[(int) query[i]];
+   translated[0] = height;
+   translated[height+1] = EOS;
+   for (int i = max(0, start_depth-TAU) ; i < height ; i++) {
+      translated[i+1] = i < pad ? PAD : altranslate[(int) query[i-pad]];
    }
 
    // Set the search options.
@@ -188,13 +412,34 @@ search
       .pebbles = info->pebbles,
       .seed_depth    = seed_depth,
       .height  = height,
+      .split   = split,
+      .budget  = budget,
+      .indels  = indels,
    };
 
+   // When neither the query nor the trie is padded (all the sequences
+   // have the same length), the "PAD exceptions" of 'poucet()' never
+   // apply and the search runs in the leaner 'poucet_fixed()'.
+   // The split budget is only implemented in 'poucet_fixed()' (see
+   // 'search_split()').
+   // The band is only implemented in 'poucet_band()' (see
+   // 'search_band()').
+   void (*kernel)(node_t *, int, struct arg_t) =
+      indels < tau ? poucet_band :
+      (pad == 0 && trie->root->child[PAD] == NULL) || split > 0 ?
+      poucet_fixed : poucet;
+
    // Run recursive search from cached nodes.
    gstack_t *pebbles = info->pebbles[start_depth];
    for (int i = 0 ; i < pebbles->nitems ; i++) {
       node_t *start_node = (node_t *) pebbles->items[i];
-      poucet(start_node, start_depth + 1, arg);
+      // The pebbles are scattered in memory, fetch the next
+      // one while searching from this one.
+      if (i+1 < pebbles->nitems) {
+         node_t *next_node = (node_t *) pebbles->items[i+1];
+         prefetch_node(next_node);
+      }
+      kernel(start_node, start_depth + 1, arg);
    }
 
    // Return the error code of the process (the line of
@@ -204,6 +449,198 @@ search
 }
 
 
+static inline void
+upper_arm
+(
+   const  char    * pcache,
+          char    * common,
+   const  int32_t   path,
+   const  int     * query,
+   const  int       depth,
+   const  int       maxa,
+   const  int       band,
+   const  int       fixed
+)
+// SYNOPSIS:
+//   Upper arm of the L-shaped section of 'poucet()' (shared by all the
+//   children), written in 'common' down from the cell 'band' (which
+//   holds the value of the cells just outside the band).
+{
+   unsigned char mmatch;
+   unsigned char shift;
+   int a = band;
+   if (!fixed && band > 0) {
+      // Special initialization for first character. If the previous
+      // character was a PAD, there is no cost to start the alignment.
+      // This is the "PAD exeption" mentioned in the SYNOPSIS of 'poucet()'.
+      mmatch = (band == maxa && query[depth-1] == PAD ? 0 : pcache[band]) +
+         ((path >> 4*(band-1) & 15) != query[depth]);
+      shift = min(pcache[band-1], common[band]) + 1;
+      common[band-1] = min(mmatch, shift);
+      a--;
+   }
+   for ( ; a > 0 ; a--) {
+      mmatch = pcache[a] + ((path >> 4*(a-1) & 15) != query[depth]);
+      shift = min(pcache[a-1], common[a]) + 1;
+      common[a-1] = min(mmatch, shift);
+   }
+}
+
+static inline void
+lower_arm
+(
+   const  char    * pcache,
+          char    * ccache,
+   const  int       i,
+   const  int32_t   path,
+   const  int     * query,
+   const  int       depth,
+   const  int       maxa,
+   const  int       band,
+   const  char      edge,
+   const  int       fixed,
+   const  int       banded
+)
+// SYNOPSIS:
+//   Horizontal arm of the L-shaped section of 'poucet()' for the child
+//   'i' and center cell (need both arms to be computed).
+{
+   unsigned char mmatch;
+   unsigned char shift;
+   if (band > 0) {
+      // Same "PAD exeption" as in 'upper_arm()'.
+      mmatch = (!fixed && band == maxa && (path & 15) == PAD ?
+                  0 : pcache[-band]) + (i != query[depth-band]);
+      shift = min(pcache[1-band], edge) + 1;
+      ccache[-band] = min(mmatch, shift);
+      for (int a = band-1 ; a > 0 ; a--) {
+         mmatch = pcache[-a] + (i != query[depth-a]);
+         shift = min(pcache[1-a], ccache[-a-1]) + 1;
+         ccache[-a] = min(mmatch, shift);
+      }
+   }
+   else if (banded) {
+      // Without indels, only the diagonal is computed.
+      ccache[0] = pcache[0] + (i != query[depth]);
+      return;
+   }
+   // At depth 1, the cells around the center still hold their
+   // initial value 1.
+   mmatch = pcache[0] + (i != query[depth]);
+   shift = min(ccache[-1], ccache[1]) + 1;
+   ccache[0] = min(mmatch, shift);
+}
+
+static inline void
+poucet_kernel
+(
+          node_t * restrict node,
+   const  int      depth,
+   struct arg_t  * arg,
+   const  int      fixed,
+   const  int      banded
+)
+// SYNOPSIS:
+//   Body of 'poucet()', 'poucet_fixed()' and 'poucet_band()'. It is
+//   inlined in each of them with constant 'fixed' and 'banded', so the
+//   code of the options that are not used is removed.
+//   'arg' is passed by address so that the inlined body does not take
+//   a copy of it (the callers already have one).
+{
+
+   // Without padding, the 'PAD' child is always empty.
+   const int nchildren = fixed ? PAD : 6;
+
+   // The cache of every child is written below. Above 'height' the
+   // children are nodes (not leaf data), prefetch them while the
+   // common arm of the L is computed.
+   if (depth < arg->height) {
+      for (int i = 0 ; i < nchildren ; i++) prefetch_node(node->child[i]);
+   }
+
+   // This makes it easier to distinguish the part that goes upward,
+   // with positive index and requiring the path, from the part that
+   // goes horizontally, with negative index and requiring previous
+   // characters of the query.
+   char *pcache = node->cache + TAU;
+   // Risk of overflow at depth lower than 'tau'.
+   int maxa = min((depth-1), arg->tau);
+   // Half width of the band and value of the cells just outside.
+   int band = banded ? min(maxa, arg->indels) : maxa;
+   char edge = band < maxa ? arg->tau + 1 : maxa + 1;
+
+   // Part of the cache that is shared between all the children.
+   char common[9] = {1,2,3,4,5,6,7,8,9};
+   // Without the band, the cell 'maxa' already holds 'maxa+1'.
+   if (banded) common[band] = edge;
+
+   // The branch of the L that is identical among all children
+   // is computed separately. It will be copied later.
+   int32_t path = node->path;
+   upper_arm(pcache, common, path, arg->query, depth, maxa, band, fixed);
+
+   node_t *child;
+   for (int i = 0 ; i < nchildren ; i++) {
+      // Skip if current node has no child at this position.
+      if ((child = node->child[i]) == NULL) continue;
+
+      // Same remark as for parent cache.
+      char local_cache[] = {9,8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8,9};
+      char *ccache = depth == arg->height ?
+         local_cache + 9 : child->cache + TAU;
+      memcpy(ccache+1, common, TAU * sizeof(char));
+
+      lower_arm(pcache, ccache, i, path, arg->query, depth, maxa,
+            band, edge, fixed, banded);
+
+      // Stop searching if 'tau' is exceeded.
+      if (ccache[0] > arg->tau) continue;
+
+      // Stop searching if the budget of the upper levels is exceeded
+      // (see 'search_split()').
+      if (fixed && !banded && depth <= arg->split) {
+         char best = ccache[0];
+         for (int a = 1 ; a <= maxa ; a++) {
+            best = min(best, min(ccache[a], ccache[-a]));
+         }
+         if (best > arg->budget) continue;
+      }
+
+      // Reached height of the trie: it's a hit!
+      if (depth == arg->height) {
+         if (push(child, arg->hits + ccache[0])) ERROR = __LINE__;
+         continue;
+      }
+
+      // Cache nodes in pebbles when trailing.
+      if (depth <= arg->seed_depth) {
+         if (push(child, (arg->pebbles)+depth)) ERROR = __LINE__;
+      }
+
+      if (depth > arg->seed_depth) {
+         // Use 'dash()' if no more mismatches allowed.
+         int can_dash = 1;
+         for (int a = -band ; a < band+1 ; a++) {
+            if (ccache[a] < arg->tau) {
+               can_dash = 0;
+               break;
+            }
+         }
+         if (can_dash) {
+            dash(child, arg->query+depth+1, *arg);
+            continue;
+         }
+      }
+
+      if (banded)     poucet_band(child, depth+1, *arg);
+      else if (fixed) poucet_fixed(child, depth+1, *arg);
+      else            poucet(child, depth+1, *arg);
+
+   }
+
+}
+
+
 void
 poucet
 (
@@ -233,10 +670,13 @@ poucet
 //
 //   Since not all the sequences have the same length, they are prefixed
 //   with the 'PAD' character (value 5, printed as white space) so that
-//   the total length is equal to the height of the trie. This imposes
-//   an important modification to the recursion, indicated by the label
-//   "PAD exception" on two different lines of the code below. Without
-//   this modification, "AAAAATA" and "AAAAA" would be aligned this way.
+//   the total length is equal to the height of the trie. The padding is
+//   virtual: it is added on the fly by 'search()' and by
+//   'insert_string_wo_malloc()' and the sequences are never copied.
+//   This imposes an important modification to the recursion, indicated
+//   by the label "PAD exception" on two different lines of the code
+//   below. Without this modification, "AAAAATA" and "AAAAA" would be
+//   aligned this way.
 //
 //                               AAAAATA
 //                               x||||x|
@@ -263,104 +703,65 @@ poucet
 //   Same as 'search()', it modifies nodes of the trie and the node       
 //   array 'arg.hits' where hits are pushed.                              
 {
+   poucet_kernel(node, depth, &arg, 0, 0);
+}
 
-   // This makes it easier to distinguish the part that goes upward,
-   // with positive index and requiring the path, from the part that
-   // goes horizontally, with negative index and requiring previous
-   // characters of the query.
-   char *pcache = node->cache + TAU;
-   // Risk of overflow at depth lower than 'tau'.
-   int maxa = min((depth-1), arg.tau);
-
-   // Penalty for match/mismatch and insertion/deletion resepectively.
-   unsigned char mmatch;
-   unsigned char shift;
-
-   // Part of the cache that is shared between all the children.
-   char common[9] = {1,2,3,4,5,6,7,8,9};
-
-   // The branch of the L that is identical among all children
-   // is computed separately. It will be copied later.
-   int32_t path = node->path;
-   // Upper arm of the L (need the path).
-   if (maxa > 0) {
-      // Special initialization for first character. If the previous
-      // character was a PAD, there is no cost to start the alignment.
-      // This is the "PAD exeption" mentioned in the SYNOPSIS.
-      mmatch = (arg.query[depth-1] == PAD ? 0 : pcache[maxa]) +
-                  ((path >> 4*(maxa-1) & 15) != arg.query[depth]);
-      shift = min(pcache[maxa-1], common[maxa]) + 1;
-      common[maxa-1] = min(mmatch, shift);
-      for (int a = maxa-1 ; a > 0 ; a--) {
-         mmatch = pcache[a] + ((path >> 4*(a-1) & 15) != arg.query[depth]);
-         shift = min(pcache[a-1], common[a]) + 1;
-         common[a-1] = min(mmatch, shift);
-      }
-   }
-
-   node_t *child;
-   for (int i = 0 ; i < 6 ; i++) {
-      // Skip if current node has no child at this position.
-      if ((child = node->child[i]) == NULL) continue;
-
-      // Same remark as for parent cache.
-      char local_cache[] = {9,8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8,9};
-      char *ccache = depth == arg.height ?
-         local_cache + 9 : child->cache + TAU;
-      memcpy(ccache+1, common, TAU * sizeof(char));
-
-      // Horizontal arm of the L (need previous characters).
-      if (maxa > 0) {
-         // See comment above for initialization.
-         // This is the "PAD exeption" mentioned in the SYNOPSIS.
-         mmatch = ((path & 15) == PAD ? 0 : pcache[-maxa]) +
-                     (i != arg.query[depth-maxa]);
-         shift = min(pcache[1-maxa], maxa+1) + 1;
-         ccache[-maxa] = min(mmatch, shift);
-         for (int a = maxa-1 ; a > 0 ; a--) {
-            mmatch = pcache[-a] + (i != arg.query[depth-a]);
-            shift = min(pcache[1-a], ccache[-a-1]) + 1;
-            ccache[-a] = min(mmatch, shift);
-         }
-      }
-      // Center cell (need both arms to be computed).
-      mmatch = pcache[0] + (i != arg.query[depth]);
-      shift = min(ccache[-1], ccache[1]) + 1;
-      ccache[0] = min(mmatch, shift);
-
-      // Stop searching if 'tau' is exceeded.
-      if (ccache[0] > arg.tau) continue;
-
-      // Reached height of the trie: it's a hit!
-      if (depth == arg.height) {
-         if (push(child, arg.hits + ccache[0])) ERROR = __LINE__;
-         continue;
-      }
-
-      // Cache nodes in pebbles when trailing.
-      if (depth <= arg.seed_depth) {
-         if (push(child, (arg.pebbles)+depth)) ERROR = __LINE__;
-      }
-
-      if (depth > arg.seed_depth) {
-         // Use 'dash()' if no more mismatches allowed.
-         int can_dash = 1;
-         for (int a = -maxa ; a < maxa+1 ; a++) {
-            if (ccache[a] < arg.tau) {
-               can_dash = 0;
-               break;
-            }
-         }
-         if (can_dash) {
-            dash(child, arg.query+depth+1, arg);
-            continue;
-         }
-      }
 
-      poucet(child, depth+1, arg);
+void
+poucet_fixed
+(
+          node_t * restrict node,
+   const  int      depth,
+   struct arg_t    arg
+)
+// SYNOPSIS:                                                              
+//   Same as 'poucet()' for tries and queries without padding, i.e.      
+//   when all the sequences have the same length. The "PAD exceptions"  
+//   are removed and the empty 'PAD' child is never visited. The values 
+//   written in the caches are the same as with 'poucet()', so pebbles  
+//   seeded by either function can be used by the other.                
+//                                                                        
+// PARAMETERS:                                                            
+//   node: the focus node in the trie                                     
+//   depth: the depth of the children in the trie.                        
+//                                                                        
+// RETURN:                                                                
+//   'void'.                                                              
+//                                                                        
+// SIDE EFFECTS:                                                          
+//   Same as 'poucet()'.                                                  
+{
+   poucet_kernel(node, depth, &arg, 1, 0);
+}
 
-   }
 
+void
+poucet_band
+(
+          node_t * restrict node,
+   const  int      depth,
+   struct arg_t    arg
+)
+// SYNOPSIS:                                                              
+//   Same as 'poucet_fixed()' with the dynamic programming restricted to
+//   the 'arg.indels' cells on either side of the center of the cache.
+//   The cells outside the band are considered to be greater than 'tau',
+//   so the alignments never leave the band. When 'arg.indels' is small,
+//   most of the L-shaped section is skipped, which is where 'poucet()'
+//   spends its time for large values of 'tau'. As long as the depth is
+//   within the band, the values are the same as with 'poucet_fixed()'.
+//                                                                        
+// PARAMETERS:                                                            
+//   node: the focus node in the trie                                     
+//   depth: the depth of the children in the trie.                        
+//                                                                        
+// RETURN:                                                                
+//   'void'.                                                              
+//                                                                        
+// SIDE EFFECTS:                                                          
+//   Same as 'poucet()'.                                                  
+{
+   poucet_kernel(node, depth, &arg, 1, 1);
 }
 
 
@@ -403,6 +804,218 @@ dash
 }
 
 
+int
+search_batch
+(
+         trie_t    *  trie,
+   const char      ** queries,
+   const int          nqueries,
+   const int          tau,
+         gstack_t  ** hits[]
+)
+// SYNOPSIS:                                                              
+//   Front end query of a trie with several queries at the same time.    
+//   The result is the same as 'search()' from the root for each query, 
+//   but the traversals are interleaved: every query has its own stack  
+//   of pending nodes and the queries are advanced one step at a time   
+//   in turn. The nodes pushed for a query are prefetched, so that they  
+//   are (hopefully) in cache when the query gets its turn again. This  
+//   hides part of the memory latency on large tries.                   
+//                                                                        
+//   The dynamic programming columns are kept on the stacks instead of   
+//   the nodes, so the trie is not modified and pebbles are not used.   
+//   This is the right choice for independent queries; sorted queries  
+//   sharing long prefixes are better served by 'search()'.             
+//                                                                        
+// PARAMETERS:                                                            
+//   trie: the trie to query                                              
+//   queries: the queries as ascii strings                                
+//   nqueries: the number of queries                                      
+//   tau: the maximum edit distance                                       
+//   hits: one hit tower per query (see 'search()')                       
+//                                                                        
+// RETURN:                                                                
+//   0 if everything went OK, the line of the last error otherwise.       
+//                                                                        
+// SIDE EFFECTS:                                                          
+//   The hit towers are modified.                                         
+{
+   ERROR = 0;
+
+   int height = get_height(trie);
+   if (tau > TAU) {
+      fprintf(stderr, "error: requested tau greater than %d\n", TAU);
+      return __LINE__;
+   }
+   for (int q = 0 ; q < nqueries ; q++) {
+      if ((int) strlen(queries[q]) > height) {
+         fprintf(stderr, "error: query longer than allowed max\n");
+         return __LINE__;
+      }
+   }
+
+   // A stack never holds more than 5 siblings per level plus the
+   // node being expanded.
+   const int nlanes = min(nqueries, BATCH_LANES);
+   const int maxframes = 5*height + 1;
+   struct lane_t lanes[BATCH_LANES];
+   int *translated = malloc(nlanes * (height+2) * sizeof(int));
+   struct frame_t *frames =
+      malloc(nlanes * maxframes * sizeof(struct frame_t));
+   if (translated == NULL || frames == NULL) {
+      fprintf(stderr, "error: could not allocate batch\n");
+      free(translated);
+      free(frames);
+      return __LINE__;
+   }
+
+   const char init[] = {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8};
+   int next = 0;
+   int active = 0;
+   for (int l = 0 ; l < nlanes ; l++) {
+      lanes[l].query = translated + l * (height+2);
+      lanes[l].frames = frames + l * maxframes;
+      lanes[l].nframes = 0;
+   }
+
+   while (next < nqueries || active > 0) {
+      active = 0;
+      for (int l = 0 ; l < nlanes ; l++) {
+         struct lane_t *lane = lanes + l;
+         if (lane->nframes == 0) {
+            if (next == nqueries) continue;
+            // Load the next query in the lane, virtually padded
+            // as in 'search()', and start from the root.
+            const char *query = queries[next];
+            int pad = height - strlen(query);
+            lane->query[0] = height;
+            lane->query[height+1] = EOS;
+            for (int i = 0 ; i < height ; i++) {
+               lane->query[i+1] =
+                  i < pad ? PAD : altranslate[(int) query[i-pad]];
+            }
+            lane->hits = hits[next++];
+            lane->frames[0].node = trie->root;
+            lane->frames[0].depth = 1;
+            lane->frames[0].dashing = 0;
+            memcpy(lane->frames[0].cache, init, 2*TAU+1);
+            lane->nframes = 1;
+         }
+         batch_step(lane, tau, height);
+         active += lane->nframes > 0;
+      }
+   }
+
+   free(translated);
+   free(frames);
+
+   return check_trie_error_and_reset();
+
+}
+
+
+void
+batch_step
+(
+   struct lane_t * lane,
+   const  int      tau,
+   const  int      height
+)
+// SYNOPSIS:                                                              
+//   Back end of 'search_batch()'. Pops the top frame of the lane and     
+//   expands it exactly the way 'poucet()' (or 'dash()' for dashing      
+//   frames) would, except that the columns of the children are pushed  
+//   on the stack of the lane instead of being written in the trie. The  
+//   children are pushed in reverse order so that the traversal (and    
+//   the order of the hits) is the same as with 'poucet()'.             
+//                                                                        
+// RETURN:                                                                
+//   'void'.                                                              
+//                                                                        
+// SIDE EFFECTS:                                                          
+//   Modifies the stack and the hits of the lane.                         
+{
+
+   struct frame_t *frame = lane->frames + --lane->nframes;
+   node_t *node = frame->node;
+   const int depth = frame->depth;
+   const int *query = lane->query;
+
+   if (frame->dashing) {
+      // One step of 'dash()'.
+      int c = query[depth];
+      if (c == EOS) {
+         if (push(node, lane->hits + tau)) ERROR = __LINE__;
+         return;
+      }
+      node_t *child;
+      if ((c > 4) || (child = (node_t *) node->child[c]) == NULL) return;
+      struct frame_t *top = lane->frames + lane->nframes++;
+      top->node = child;
+      top->depth = depth+1;
+      top->dashing = 1;
+      if (depth < height) prefetch_node(child);
+      return;
+   }
+
+   // Same as 'poucet()' with the column of the node in the frame.
+   char pcache_[2*TAU+1];
+   memcpy(pcache_, frame->cache, 2*TAU+1);
+   char *pcache = pcache_ + TAU;
+   int maxa = min((depth-1), tau);
+   char common[9] = {1,2,3,4,5,6,7,8,9};
+
+   int32_t path = node->path;
+   upper_arm(pcache, common, path, query, depth, maxa, maxa, 0);
+
+   // Surviving children, pushed in reverse order below.
+   node_t *next[6];
+   char    cols[6][2*TAU+1];
+   char    dashing[6];
+   int     nnext = 0;
+
+   for (int i = 0 ; i < 6 ; i++) {
+      node_t *child = node->child[i];
+      if (child == NULL) continue;
+
+      // Untouched cells keep the values of a new node.
+      char *ccache = cols[nnext] + TAU;
+      const char init[] = {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8};
+      memcpy(cols[nnext], init, 2*TAU+1);
+      memcpy(ccache+1, common, TAU * sizeof(char));
+      lower_arm(pcache, ccache, i, path, query, depth, maxa, maxa,
+            maxa+1, 0, 0);
+
+      if (ccache[0] > tau) continue;
+
+      if (depth == height) {
+         if (push(child, lane->hits + ccache[0])) ERROR = __LINE__;
+         continue;
+      }
+
+      int can_dash = 1;
+      for (int a = -maxa ; a < maxa+1 ; a++) {
+         if (ccache[a] < tau) {
+            can_dash = 0;
+            break;
+         }
+      }
+      dashing[nnext] = can_dash;
+      next[nnext++] = child;
+   }
+
+   for (int j = nnext-1 ; j >= 0 ; j--) {
+      struct frame_t *top = lane->frames + lane->nframes++;
+      top->node = next[j];
+      top->depth = depth+1;
+      top->dashing = dashing[j];
+      if (!dashing[j]) memcpy(top->cache, cols[j], 2*TAU+1);
+      prefetch_node(next[j]);
+   }
+
+}
+
+
 // ------  TRIE CONSTRUCTION AND DESTRUCTION  ------ //
 
 
@@ -453,7 +1066,8 @@ new_trie
 
    // Set the values of the meta information.
    info->height = height;
-   info->pebbles = new_tower(M);
+   // The pebbles are seeded above the leaves, one level per depth.
+   info->pebbles = new_tower(height+1);
 
    // Push the root to the ground level of 'pebbles'.
    // This will be the only node at this level for
@@ -606,28 +1220,42 @@ insert_string_wo_malloc
    const char    * string,
          node_t ** from_addr
 )
-// TODO: document the function, explain that 'from_addr' is
-// incremented.
 // SYNOPSIS:                                                              
+//   Front end function to fill in a trie with preallocated nodes. Insert 
+//   a string from root, or simply return the node at the end of the      
+//   string path if it already exists. Strings shorter than the height   
+//   of the trie are virtually prefixed with 'PAD' (see 'poucet()').      
+//                                                                        
+// PARAMETERS:                                                            
+//   trie: the trie to fill in                                            
+//   string: the string to insert                                         
+//   from_addr: address of the next free preallocated node                
 //                                                                        
 // RETURN:                                                                
+//   The address of the leaf pointer in case of success, 'NULL'           
+//   otherwise.                                                           
+//                                                                        
+// SIDE EFFECTS:                                                          
+//   '*from_addr' is incremented for every node appended to the trie.     
 {
 
    int i;
 
+   int height = get_height(trie);
    int nchar = strlen(string);
-   if (nchar != get_height(trie)) {
-      fprintf(stderr, "error: can only insert string of length %d\n",
-            get_height(trie));
+   if (nchar > height) {
+      fprintf(stderr, "error: cannot insert string longer than %d\n",
+            height);
       ERROR = __LINE__;
       return NULL;
    }
+   int pad = height - nchar;
    
    // Find existing path.
    node_t *node = trie->root;
-   for (i = 0 ; i < nchar-1; i++) {
+   for (i = 0 ; i < height-1; i++) {
       node_t *child;
-      int c = translate[(int) string[i]];
+      int c = i < pad ? PAD : translate[(int) string[i-pad]];
       if ((child = (node_t *) node->child[c]) == NULL) {
          break;
       }
@@ -635,13 +1263,13 @@ insert_string_wo_malloc
    }
 
    // Append more nodes.
-   for ( ; i < nchar-1 ; i++) {
-      int c = translate[(int) string[i]];
+   for ( ; i < height-1 ; i++) {
+      int c = i < pad ? PAD : translate[(int) string[i-pad]];
       node = insert_wo_malloc(node, c, *from_addr);
       (*from_addr)++; 
    }
 
-   return node->child + translate[(int) string[nchar-1]];
+   return node->child + (i < pad ? PAD : translate[(int) string[i-pad]]);
 
 }
 
@@ -60,6 +60,7 @@ int         check_trie_error_and_reset (void);
 int         count_nodes (trie_t*);
 void        destroy_tower (gstack_t **);
 void        destroy_trie (trie_t*, int, void(*)(void *));
+int         get_height (trie_t*);
 void     ** insert_string_wo_malloc (trie_t *, const char *, node_t **);
 void     ** insert_string (trie_t*, const char*);
 gstack_t *  new_gstack (void);
@@ -67,6 +68,11 @@ gstack_t ** new_tower (int);
 trie_t   *  new_trie (unsigned int);
 int         push (void*, gstack_t**);
 int         search (trie_t*, const char*, int, gstack_t**, int, int);
+int         search_band (trie_t*, const char*, int, int, gstack_t**,
+                  int, int);
+int         search_batch (trie_t*, const char**, int, int, gstack_t***);
+int         search_split (trie_t*, trie_t*, const char*, int, gstack_t**,
+                  int, int);
 
 struct trie_t
 {
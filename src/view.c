@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include <errno.h>
@@ -8,6 +9,9 @@
 #include <execinfo.h>
 #include <signal.h>
 #include <unistd.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include "starcode.h"
 #include "view.h"
 
@@ -209,7 +213,7 @@ norm
    double y_coord
 )
 {
-   return sqrt(pow(x_coord, 2) + pow(y_coord, 2));
+   return sqrt(x_coord * x_coord + y_coord * y_coord);
 }
 
 double
@@ -220,9 +224,8 @@ electric
    double   dist
 )
 {
-   double ke = 5.0e1;
    // Coulomb's law.
-   return ke * ball1->size * ball2->size / pow(dist, 2);
+   return KE * ball1->size * ball2->size / (dist * dist);
 }
 
 double
@@ -231,55 +234,244 @@ elastic
    double dist
 )
 {
-   double k = 10.0;
    // Hooke's law.
-   return -k * dist;
+   return -KH * dist;
+}
+
+world_t *
+new_world
+(
+   int       n_balls,
+   ball_t ** ball_list
+)
+// SYNOPSIS:
+//   Copy the balls to a structure of arrays. The balls are
+//   grouped by star (keeping the order of the list within a
+//   star), so that the balls of the same star are contiguous
+//   and the electric forces can be computed on vectors.
+{
+   world_t * world = malloc(sizeof(world_t));
+   if (world == NULL) {
+      fprintf(stderr, "Error in world malloc: %s\n", strerror(errno));
+      exit(1);
+   }
+   world->n_balls  = n_balls;
+   world->n_bonds  = 0;
+   world->x        = malloc(n_balls * sizeof(double));
+   world->y        = malloc(n_balls * sizeof(double));
+   world->fx       = malloc(n_balls * sizeof(double));
+   world->fy       = malloc(n_balls * sizeof(double));
+   world->size     = malloc(n_balls * sizeof(double));
+   world->star_end = malloc(n_balls * sizeof(int));
+   world->ball     = malloc(n_balls * sizeof(ball_t *));
+   int n_bonds = 0;
+   for (int i = 0; i < n_balls; i++) n_bonds += ball_list[i]->n_children;
+   world->bond = malloc((2*n_bonds + 1) * sizeof(int));
+   if (world->x == NULL || world->y == NULL || world->fx == NULL ||
+       world->fy == NULL || world->size == NULL ||
+       world->star_end == NULL || world->ball == NULL ||
+       world->bond == NULL) {
+      fprintf(stderr, "Error in world malloc: %s\n", strerror(errno));
+      exit(1);
+   }
+
+   // Group the balls by star.
+   int n = 0;
+   for (int i = 0; i < n_balls; i++) {
+      if (ball_list[i] != ball_list[i]->root) continue;
+      int start = n;
+      for (int j = 0; j < n_balls; j++) {
+         if (ball_list[j]->root != ball_list[i]) continue;
+         world->ball[n++] = ball_list[j];
+      }
+      for (int j = start; j < n; j++) world->star_end[j] = n;
+   }
+
+   for (int i = 0; i < n_balls; i++) {
+      ball_t * ball = world->ball[i];
+      world->x[i] = ball->position[0];
+      world->y[i] = ball->position[1];
+      world->size[i] = ball->size;
+   }
+
+   // Parent-child bonds, as pairs of indices. The children
+   // belong to the star of the parent, so it is enough to
+   // look for them between the root and the end of the star.
+   int root = 0;
+   for (int i = 0; i < n_balls; i++) {
+      ball_t * ball = world->ball[i];
+      if (ball == ball->root) root = i;
+      for (int j = 0; j < ball->n_children; j++) {
+         int k = root;
+         while (k < world->star_end[i] &&
+               world->ball[k] != ball->children[j]) k++;
+         if (k == world->star_end[i]) continue;
+         world->bond[2*world->n_bonds]   = i;
+         world->bond[2*world->n_bonds+1] = k;
+         world->n_bonds++;
+      }
+   }
+
+   return world;
 }
 
 void
-compute_force
+destroy_world
 (
-   ball_t * ball1,
-   ball_t * ball2,
-   int      force_type
+   world_t * world
 )
 {
-   // Relative ball positions determine the sign (+/-) of the unit vector.
-   double x_dist = ball2->position[0] - ball1->position[0];
-   double y_dist = ball2->position[1] - ball1->position[1];
-   double v_norm = norm(x_dist, y_dist);
-   double force;
-   if (force_type == 0) {
-      force = elastic(v_norm);
-   } else if (force_type == 1) {
-      force = electric(ball1, ball2, v_norm);
+   free(world->x);
+   free(world->y);
+   free(world->fx);
+   free(world->fy);
+   free(world->size);
+   free(world->star_end);
+   free(world->bond);
+   free(world->ball);
+   free(world);
+}
+
+void
+elastic_forces
+(
+   world_t * world
+)
+{
+   // Hooke's law: the force is -KH * dist along the unit vector,
+   // so the projections are -KH * x_dist and -KH * y_dist and no
+   // norm needs to be computed.
+   for (int b = 0; b < world->n_bonds; b++) {
+      int i = world->bond[2*b];
+      int j = world->bond[2*b+1];
+      double x_force = -KH * (world->x[j] - world->x[i]);
+      double y_force = -KH * (world->y[j] - world->y[i]);
+      world->fx[i] -= x_force;
+      world->fx[j] += x_force;
+      world->fy[i] -= y_force;
+      world->fy[j] += y_force;
+   }
+}
+
+void
+electric_forces
+(
+   world_t * world
+)
+// SYNOPSIS:
+//   Coulomb forces between all the pairs of balls of the same star.
+//   The force along the unit vector is KE * s1 * s2 / d^2, so the
+//   projection on x is KE * s1 * s2 * x_dist / d^3. The inner loop
+//   runs over the contiguous balls of the star and is vectorized
+//   with AVX2 when available.
+{
+   double * restrict x  = world->x;
+   double * restrict y  = world->y;
+   double * restrict fx = world->fx;
+   double * restrict fy = world->fy;
+   double * restrict sz = world->size;
+
+   for (int i = 0; i < world->n_balls; i++) {
+      const int end = world->star_end[i];
+      const double xi = x[i];
+      const double yi = y[i];
+      const double ki = KE * sz[i];
+      double fxi = 0.0;
+      double fyi = 0.0;
+      int j = i+1;
+#ifdef __AVX2__
+      const __m256d vxi = _mm256_set1_pd(xi);
+      const __m256d vyi = _mm256_set1_pd(yi);
+      const __m256d vki = _mm256_set1_pd(ki);
+      __m256d vfxi = _mm256_setzero_pd();
+      __m256d vfyi = _mm256_setzero_pd();
+      for ( ; j + 4 <= end; j += 4) {
+         __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x+j), vxi);
+         __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y+j), vyi);
+         __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx),
+                                    _mm256_mul_pd(dy, dy));
+         __m256d d3 = _mm256_mul_pd(d2, _mm256_sqrt_pd(d2));
+         __m256d f  = _mm256_div_pd(
+               _mm256_mul_pd(vki, _mm256_loadu_pd(sz+j)), d3);
+         __m256d x_force = _mm256_mul_pd(f, dx);
+         __m256d y_force = _mm256_mul_pd(f, dy);
+         _mm256_storeu_pd(fx+j, _mm256_add_pd(_mm256_loadu_pd(fx+j), x_force));
+         _mm256_storeu_pd(fy+j, _mm256_add_pd(_mm256_loadu_pd(fy+j), y_force));
+         vfxi = _mm256_sub_pd(vfxi, x_force);
+         vfyi = _mm256_sub_pd(vfyi, y_force);
+      }
+      double hx[4], hy[4];
+      _mm256_storeu_pd(hx, vfxi);
+      _mm256_storeu_pd(hy, vfyi);
+      fxi = (hx[0] + hx[1]) + (hx[2] + hx[3]);
+      fyi = (hy[0] + hy[1]) + (hy[2] + hy[3]);
+#endif
+      // Scalar loop (remainder of the vector loop).
+      for ( ; j < end; j++) {
+         double dx = x[j] - xi;
+         double dy = y[j] - yi;
+         double d2 = dx * dx + dy * dy;
+         double f  = ki * sz[j] / (d2 * sqrt(d2));
+         fx[j] += f * dx;
+         fy[j] += f * dy;
+         fxi -= f * dx;
+         fyi -= f * dy;
+      }
+      fx[i] += fxi;
+      fy[i] += fyi;
    }
-   double u_vect[2] = { x_dist / v_norm, y_dist / v_norm };
-   double x_force = force * u_vect[0];
-   double y_force = force * u_vect[1];
-   ball1->force[0] += -x_force;
-   ball2->force[0] +=  x_force;
-   ball1->force[1] += -y_force;
-   ball2->force[1] +=  y_force;
 }
 
 double
-move_ball
+move_balls
 (
-   ball_t * ball
+   world_t * world
 )
+// SYNOPSIS:
+//   Move all the balls according to the forces and return the
+//   total movement. The movement is limited to a "terminal
+//   velocity" on each axis to prevent diverging.
 {
-   double x_movement = ball->force[0] / ball->size;
-   double y_movement = ball->force[1] / ball->size;
-   // Limit movement to a "terminal velocity" to prevent diverging.
-   double tv = 1;
-   if (x_movement > tv) x_movement = tv;
-   else if (x_movement < -tv) x_movement = -tv;
-   if (y_movement > tv) y_movement = tv;
-   else if (y_movement < -tv) y_movement = -tv;
-   ball->position[0] += x_movement;
-   ball->position[1] += y_movement;
-   return norm(x_movement, y_movement);
+   double * restrict x  = world->x;
+   double * restrict y  = world->y;
+   double * restrict fx = world->fx;
+   double * restrict fy = world->fy;
+   double * restrict sz = world->size;
+   const int n = world->n_balls;
+
+   double movement = 0.0;
+   int i = 0;
+#ifdef __AVX2__
+   const __m256d vtv  = _mm256_set1_pd(TV);
+   const __m256d vntv = _mm256_set1_pd(-TV);
+   __m256d vmov = _mm256_setzero_pd();
+   for ( ; i + 4 <= n; i += 4) {
+      __m256d s  = _mm256_loadu_pd(sz+i);
+      __m256d mx = _mm256_div_pd(_mm256_loadu_pd(fx+i), s);
+      __m256d my = _mm256_div_pd(_mm256_loadu_pd(fy+i), s);
+      mx = _mm256_max_pd(_mm256_min_pd(mx, vtv), vntv);
+      my = _mm256_max_pd(_mm256_min_pd(my, vtv), vntv);
+      _mm256_storeu_pd(x+i, _mm256_add_pd(_mm256_loadu_pd(x+i), mx));
+      _mm256_storeu_pd(y+i, _mm256_add_pd(_mm256_loadu_pd(y+i), my));
+      vmov = _mm256_add_pd(vmov, _mm256_sqrt_pd(
+               _mm256_add_pd(_mm256_mul_pd(mx, mx), _mm256_mul_pd(my, my))));
+   }
+   double h[4];
+   _mm256_storeu_pd(h, vmov);
+   movement = (h[0] + h[1]) + (h[2] + h[3]);
+#endif
+   for ( ; i < n; i++) {
+      double x_movement = fx[i] / sz[i];
+      double y_movement = fy[i] / sz[i];
+      if (x_movement > TV) x_movement = TV;
+      else if (x_movement < -TV) x_movement = -TV;
+      if (y_movement > TV) y_movement = TV;
+      else if (y_movement < -TV) y_movement = -TV;
+      x[i] += x_movement;
+      y[i] += y_movement;
+      movement += norm(x_movement, y_movement);
+   }
+   return movement;
 }
 
 void
@@ -291,32 +483,24 @@ physics_loop
    double  * movement_list
 )
 {
+   world_t * world = new_world(n_balls, ball_list);
    for (int k = 0; k < moves; k++) {
       // Reinitialize forces at each iteration.
-      for (int i = 0; i < n_balls; i++) {
-         ball_list[i]->force[0] = 0.0;
-         ball_list[i]->force[1] = 0.0;
-      }
-      // Compute the forces among the balls.
-      for (int i = 0; i < n_balls; i++) {
-         ball_t * ball = ball_list[i];
-         // Compute elastic... 
-         for (int j = 0; j < ball->n_children; j++) {
-            compute_force(ball, ball->children[j], 0);
-         }
-         // ...and electric forces.
-         for (int k = i+1; k < n_balls; k++) {
-            // Isolate the physics of different stars.
-            if (ball->root == ball_list[k]->root) {
-               compute_force(ball, ball_list[k], 1);
-            }
-         }
-      }
-      movement_list[k] = 0.0;
-      for (int i = 0; i < n_balls; i++) {
-         movement_list[k] += move_ball(ball_list[i]);
-      }
+      memset(world->fx, 0, n_balls * sizeof(double));
+      memset(world->fy, 0, n_balls * sizeof(double));
+      // Compute elastic and electric forces.
+      elastic_forces(world);
+      electric_forces(world);
+      movement_list[k] = move_balls(world);
+   }
+   // Copy back positions and forces to the balls.
+   for (int i = 0; i < n_balls; i++) {
+      world->ball[i]->position[0] = world->x[i];
+      world->ball[i]->position[1] = world->y[i];
+      world->ball[i]->force[0] = world->fx[i];
+      world->ball[i]->force[1] = world->fy[i];
    }
+   destroy_world(world);
 }
 
 void
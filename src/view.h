@@ -4,12 +4,17 @@
 #define CANVAS_SIZE 600.0
 #define RAND_FACTOR CANVAS_SIZE / RAND_MAX
 #define PI 3.141592653589793238462643383279502884L
+#define KE 5.0e1 // Coulomb constant.
+#define KH 10.0  // Hooke constant.
+#define TV 1.0   // Terminal velocity.
 
 struct ball_t;
 struct star_t;
+struct world_t;
 
 typedef struct ball_t ball_t;
 typedef struct star_t star_t;
+typedef struct world_t world_t;
 
 struct ball_t {
    int      size;        // # of barcodes
@@ -27,14 +32,33 @@ struct star_t {
    double   radius;          // distance to most distant ball + its radius
 };
 
+// Structure of arrays used by the physics loop. The balls are
+// reordered so that the balls of a star are contiguous, which
+// allows to vectorize the electric force over a star.
+struct world_t {
+   int       n_balls;  // # of balls
+   int       n_bonds;  // # of parent-child bonds
+   double  * x;        // x positions
+   double  * y;        // y positions
+   double  * fx;       // x forces
+   double  * fy;       // y forces
+   double  * size;     // # of barcodes (as double)
+   int     * star_end; // index past the last ball of the star
+   int     * bond;     // (parent, child) pairs of ball indices
+   ball_t ** ball;     // balls in the order of the arrays
+};
+
 void      force_directed_drawing(int, ball_t **);
 //ball_t ** list_balls(FILE *, int *);
 //ball_t ** new_ball(char *);
 double    norm(double, double);
 double    electric(ball_t *, ball_t *, double);
 double    elastic(double);
-void      compute_force(ball_t *, ball_t *, int);
-double    move_ball(ball_t *);
+world_t * new_world(int, ball_t **);
+void      destroy_world(world_t *);
+void      elastic_forces(world_t *);
+void      electric_forces(world_t *);
+double    move_balls(world_t *);
 void      physics_loop(int, ball_t **, int, double *);
 void      regression(int, double *, double *);
 int       compar(const void *, const void *);
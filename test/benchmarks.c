@@ -0,0 +1,496 @@
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "starcode.c"
+
+// Micro-benchmarks of the starcode kernels. The binary is built with
+// optimization flags and without coverage ('make bench'). Every
+// benchmark is calibrated so that one repetition lasts at least
+// MIN_REP_NS, then repeated and summarized by the median, the minimum
+// and the median absolute deviation (in percent of the median).
+//
+// Usage: ./bench [-f] [-n nseq] [-r repeats] [name filter]
+//   -f  all the sequences have the same length (default 28-30)
+
+#define MIN_REP_NS   50000000.0
+#define SEQLEN       30
+
+typedef void (*bench_t)(long);
+
+// Parameters of the run.
+static int  NSEQ    = 20000;
+static int  REPEATS = 11;
+static int  FIXED   = 0;
+
+// Shared generated data.
+static gstack_t  * SEQS  = NULL;   // Sorted useqs.
+static gstack_t  * QRYS  = NULL;   // Sorted mutated queries.
+static int       * ORDER = NULL;   // Random order of the queries.
+static trie_t    * TRIE  = NULL;
+static node_t    * NODES = NULL;
+static lookup_t  * LUT   = NULL;
+static gstack_t ** HITS  = NULL;
+static int         DIST   = 0;
+static int         HEIGHT = 0;
+static int         MEDIAN = 0;
+static uint64_t    RSTATE = 88172645463325252ULL;
+
+// Time spent in preparation steps, excluded from the measure.
+static double      PAUSED = 0.0;
+
+uint64_t
+xorshift
+(void)
+{
+   RSTATE ^= RSTATE << 13;
+   RSTATE ^= RSTATE >> 7;
+   RSTATE ^= RSTATE << 17;
+   return RSTATE;
+}
+
+double
+now_ns
+(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+double_ascending
+(
+   const void *a,
+   const void *b
+)
+{
+   double x = *(double *) a;
+   double y = *(double *) b;
+   return x < y ? -1 : x > y;
+}
+
+void
+random_seq
+(
+   char * seq,
+   int    len
+)
+{
+   for (int i = 0 ; i < len ; i++) seq[i] = "ACGT"[xorshift() & 3];
+   seq[len] = '\0';
+}
+
+gstack_t *
+random_useqs
+(
+   int n,
+   int len,
+   int dup
+)
+// Generate 'n' random sequences of length between 'len'-2 and
+// 'len' (or 'len' with '-f'), one in 'dup' being the copy of an
+// earlier sequence.
+{
+   char seq[M];
+   gstack_t *useqS = new_gstack();
+   for (int i = 0 ; i < n ; i++) {
+      if (dup > 0 && i > 0 && xorshift() % dup == 0) {
+         useq_t *u = useqS->items[xorshift() % i];
+         strcpy(seq, u->seq);
+      }
+      else {
+         random_seq(seq, FIXED ? len : len - (int)(xorshift() % 3));
+      }
+      useq_t *u = new_useq(1, seq, NULL);
+      u->nids = 1;
+      u->seqid = (void *)(unsigned long)(i+1);
+      push(u, &useqS);
+   }
+   return useqS;
+}
+
+void
+mutate
+(
+   char * seq,
+   int    nerr
+)
+// Introduce 'nerr' substitutions.
+{
+   int len = strlen(seq);
+   for (int e = 0 ; e < nerr ; e++) {
+      int pos = xorshift() % len;
+      seq[pos] = "ACGT"[(strchr("ACGT", seq[pos]) - "ACGT" + 1 +
+            xorshift() % 3) % 4];
+   }
+}
+
+void
+setup_data
+(void)
+{
+   SEQS = random_useqs(NSEQ, SEQLEN, 0);
+   SEQS->nitems = seqsort((useq_t **) SEQS->items, SEQS->nitems, 1);
+   HEIGHT = useq_lengths(SEQS, &MEDIAN);
+
+   // Queries are mutated copies of the sequences, so that
+   // every search has some hits.
+   QRYS = new_gstack();
+   for (int i = 0 ; i < SEQS->nitems ; i++) {
+      useq_t *u = SEQS->items[i];
+      useq_t *q = new_useq(1, u->seq, NULL);
+      mutate(q->seq, 1 + i % 3);
+      push(q, &QRYS);
+   }
+   QRYS->nitems = seqsort((useq_t **) QRYS->items, QRYS->nitems, 1);
+   ORDER = malloc(QRYS->nitems * sizeof(int));
+   for (int i = 0 ; i < QRYS->nitems ; i++) ORDER[i] = i;
+   for (int i = QRYS->nitems - 1 ; i > 0 ; i--) {
+      int j = xorshift() % (i+1);
+      int tmp = ORDER[i];
+      ORDER[i] = ORDER[j];
+      ORDER[j] = tmp;
+   }
+
+   // Trie built from all the sequences.
+   TRIE = new_trie(HEIGHT);
+   NODES = malloc(count_trie_nodes((useq_t **) SEQS->items, 0,
+            SEQS->nitems, HEIGHT) * sizeof(node_t));
+   node_t *pos = NODES;
+   for (int i = 0 ; i < SEQS->nitems ; i++) {
+      useq_t *u = SEQS->items[i];
+      void **data = insert_string_wo_malloc(TRIE, u->seq, &pos);
+      if (data == NULL) {
+         fprintf(stderr, "bench error: %s:%d\n", __FILE__, __LINE__);
+         abort();
+      }
+      *data = u;
+   }
+   HITS = new_tower(STARCODE_MAX_TAU+1);
+}
+
+
+// ------  BENCHMARKS ------ //
+// Each function runs the kernel 'nops' times.
+
+void
+bench_search
+(
+   long nops
+)
+// Search queries in sorted order, seeding pebbles the way
+// 'do_query()' does. The operation is one query.
+{
+   static long next = 0;
+   static int last_tau = -1;
+   static useq_t *last = NULL;
+   // The pebbles depend on 'tau', restart from the root.
+   if (DIST != last_tau) last = NULL;
+   last_tau = DIST;
+   for (long n = 0 ; n < nops ; n++) {
+      int i = next++ % QRYS->nitems;
+      useq_t *query = QRYS->items[i];
+      if (i == 0) last = NULL;
+      int trail = 0;
+      if (i < QRYS->nitems - 1) {
+         useq_t *next_query = QRYS->items[i+1];
+         trail = padded_prefix(query->seq, next_query->seq, HEIGHT);
+      }
+      int start = 0;
+      if (last != NULL) {
+         start = padded_prefix(query->seq, last->seq, HEIGHT);
+      }
+      for (int j = 0 ; HITS[j] != TOWER_TOP ; j++) HITS[j]->nitems = 0;
+      if (search(TRIE, query->seq, DIST, HITS, start, trail)) {
+         fprintf(stderr, "bench error: %s:%d\n", __FILE__, __LINE__);
+         abort();
+      }
+      last = query;
+   }
+}
+
+void
+bench_search_root
+(
+   long nops
+)
+// Search queries in random order from the root, one at a time.
+// The operation is one query.
+{
+   static long next = 0;
+   for (long n = 0 ; n < nops ; n++) {
+      useq_t *query = QRYS->items[ORDER[next++ % QRYS->nitems]];
+      for (int j = 0 ; HITS[j] != TOWER_TOP ; j++) HITS[j]->nitems = 0;
+      if (search(TRIE, query->seq, DIST, HITS, 0, 0)) {
+         fprintf(stderr, "bench error: %s:%d\n", __FILE__, __LINE__);
+         abort();
+      }
+   }
+}
+
+void
+bench_search_batch
+(
+   long nops
+)
+// Same queries as 'bench_search_root()' with 'search_batch()' in
+// batches of 64. The operation is one query.
+{
+   static long next = 0;
+   const char *queries[64];
+   gstack_t **hits[64];
+   for (int q = 0 ; q < 64 ; q++) hits[q] = new_tower(DIST+1);
+   for (long n = 0 ; n < nops ; n += 64) {
+      int nq = min(64, nops - n);
+      for (int q = 0 ; q < nq ; q++) {
+         useq_t *query = QRYS->items[ORDER[next++ % QRYS->nitems]];
+         queries[q] = query->seq;
+         for (int j = 0 ; hits[q][j] != TOWER_TOP ; j++) {
+            hits[q][j]->nitems = 0;
+         }
+      }
+      if (search_batch(TRIE, queries, nq, DIST, hits)) {
+         fprintf(stderr, "bench error: %s:%d\n", __FILE__, __LINE__);
+         abort();
+      }
+   }
+   for (int q = 0 ; q < 64 ; q++) destroy_tower(hits[q]);
+}
+
+void
+bench_insert
+(
+   long nops
+)
+// Build tries from scratch. The operation is one sequence.
+{
+   long done = 0;
+   while (done < nops) {
+      trie_t *trie = new_trie(HEIGHT);
+      node_t *pos = NODES;
+      for (int i = 0 ; i < SEQS->nitems && done < nops ; i++, done++) {
+         useq_t *u = SEQS->items[i];
+         void **data = insert_string_wo_malloc(trie, u->seq, &pos);
+         *data = u;
+      }
+      destroy_trie(trie, DESTROY_NODES_NO, NULL);
+   }
+   // Restore the shared trie, which uses the same nodes.
+   destroy_trie(TRIE, DESTROY_NODES_NO, NULL);
+   TRIE = new_trie(HEIGHT);
+   node_t *pos = NODES;
+   for (int i = 0 ; i < SEQS->nitems ; i++) {
+      useq_t *u = SEQS->items[i];
+      *insert_string_wo_malloc(TRIE, u->seq, &pos) = u;
+   }
+}
+
+void
+bench_lut_insert
+(
+   long nops
+)
+{
+   for (long n = 0 ; n < nops ; n++) {
+      lut_insert(LUT, SEQS->items[n % SEQS->nitems], 0);
+   }
+}
+
+void
+bench_lut_search
+(
+   long nops
+)
+{
+   volatile int found = 0;
+   uint32_t mask;
+   for (long n = 0 ; n < nops ; n++) {
+      found += lut_search(LUT, QRYS->items[n % QRYS->nitems], -1, &mask);
+   }
+}
+
+void
+bench_seq2id
+(
+   long nops
+)
+{
+   volatile int sum = 0;
+   for (long n = 0 ; n < nops ; n++) {
+      useq_t *u = SEQS->items[n % SEQS->nitems];
+      sum += seq2id(u->seq + strlen(u->seq) - 12, 12);
+   }
+}
+
+void
+bench_nukesort
+(
+   long nops
+)
+// Sort (and reduce) fresh arrays of useqs, one in four being a
+// duplicate. The operation is one sequence. Generation is
+// excluded from the time through the 'pause' mechanism.
+{
+   long done = 0;
+   while (done < nops) {
+      int n = min(nops - done, NSEQ);
+      double t0 = now_ns();
+      gstack_t *useqS = random_useqs(n, SEQLEN, 4);
+      PAUSED += now_ns() - t0;
+      int nu = seqsort((useq_t **) useqS->items, n, 1);
+      t0 = now_ns();
+      for (int i = 0 ; i < nu ; i++) destroy_useq(useqS->items[i]);
+      free(useqS);
+      PAUSED += now_ns() - t0;
+      done += n;
+   }
+}
+
+void
+bench_transfer_ids
+(
+   long nops
+)
+// Merge the ID list of a 64-ID useq into a growing useq. The
+// operation is one transfer.
+{
+   useq_t *src = new_useq(1, "A", NULL);
+   src->nids = 1;
+   src->seqid = (void *) 1UL;
+   for (int i = 0 ; i < 63 ; i++) {
+      useq_t *tmp = new_useq(1, "A", NULL);
+      tmp->nids = 1;
+      tmp->seqid = (void *)(unsigned long)(2 + 2*i);
+      transfer_useq_ids(src, tmp);
+      destroy_useq(tmp);
+   }
+   long done = 0;
+   while (done < nops) {
+      useq_t *dst = new_useq(1, "A", NULL);
+      dst->nids = 1;
+      dst->seqid = (void *) 3UL;
+      for (int i = 0 ; i < 256 && done < nops ; i++, done++) {
+         transfer_useq_ids(dst, src);
+      }
+      double t0 = now_ns();
+      destroy_useq(dst);
+      PAUSED += now_ns() - t0;
+   }
+   destroy_useq(src);
+}
+
+
+// ------  DRIVER ------ //
+
+double
+run_timed
+(
+   bench_t bench,
+   long    nops
+)
+{
+   PAUSED = 0.0;
+   double t0 = now_ns();
+   bench(nops);
+   return now_ns() - t0 - PAUSED;
+}
+
+void
+run_bench
+(
+   const char * name,
+   const char * filter,
+   bench_t      bench,
+   double       bytes_per_op
+)
+{
+   if (filter != NULL && strstr(name, filter) == NULL) return;
+
+   // Warm up and calibrate the number of operations.
+   long nops = 1;
+   while (run_timed(bench, nops) < MIN_REP_NS && nops < (1L << 40)) {
+      nops *= 2;
+   }
+
+   double *ns = malloc(REPEATS * sizeof(double));
+   for (int r = 0 ; r < REPEATS ; r++) {
+      ns[r] = run_timed(bench, nops) / nops;
+   }
+   qsort(ns, REPEATS, sizeof(double), double_ascending);
+   double median = ns[REPEATS/2];
+   double *dev = malloc(REPEATS * sizeof(double));
+   for (int r = 0 ; r < REPEATS ; r++) dev[r] = fabs(ns[r] - median);
+   qsort(dev, REPEATS, sizeof(double), double_ascending);
+   double mad = dev[REPEATS/2];
+
+   fprintf(stdout, "%-22s %12.1f %12.1f %7.2f%% %14.0f",
+         name, median, ns[0], 100 * mad / median, 1e9 / median);
+   if (bytes_per_op > 0) {
+      fprintf(stdout, " %9.1f MB/s", bytes_per_op * 1e3 / median);
+   }
+   fprintf(stdout, "\n");
+   fflush(stdout);
+
+   free(dev);
+   free(ns);
+}
+
+int
+main
+(
+   int argc,
+   char **argv
+)
+{
+   const char *filter = NULL;
+   int c;
+   while ((c = getopt(argc, argv, "fn:r:")) != -1) {
+      switch (c) {
+         case 'f': FIXED = 1; break;
+         case 'n': NSEQ = atoi(optarg); break;
+         case 'r': REPEATS = atoi(optarg); break;
+         default:
+            fprintf(stderr, "usage: %s [-f] [-n nseq] [-r repeats] "
+                  "[filter]\n", argv[0]);
+            return 1;
+      }
+   }
+   if (optind < argc) filter = argv[optind];
+   if (NSEQ < 2 || REPEATS < 1) {
+      fprintf(stderr, "invalid parameters\n");
+      return 1;
+   }
+
+   setup_data();
+   fprintf(stdout, "%d sequences of length %d-%d, %d repeats\n",
+         SEQS->nitems, FIXED ? SEQLEN : SEQLEN-2, SEQLEN, REPEATS);
+   fprintf(stdout, "%-22s %12s %12s %8s %14s\n",
+         "benchmark", "ns/op", "min ns/op", "mad", "ops/s");
+
+   char name[64];
+   for (DIST = 0 ; DIST <= STARCODE_MAX_TAU ; DIST++) {
+      snprintf(name, 64, "search/tau=%d", DIST);
+      run_bench(name, filter, bench_search, 0);
+   }
+   for (DIST = 1 ; DIST <= 3 ; DIST++) {
+      snprintf(name, 64, "search_root/tau=%d", DIST);
+      run_bench(name, filter, bench_search_root, 0);
+      snprintf(name, 64, "search_batch/tau=%d", DIST);
+      run_bench(name, filter, bench_search_batch, 0);
+   }
+   run_bench("insert_string_wo_malloc", filter, bench_insert, HEIGHT);
+
+   for (DIST = 1 ; DIST <= 4 ; DIST += 3) {
+      LUT = new_lookup(MEDIAN, HEIGHT, DIST, 1);
+      snprintf(name, 64, "lut_insert/tau=%d", DIST);
+      run_bench(name, filter, bench_lut_insert, HEIGHT);
+      snprintf(name, 64, "lut_search/tau=%d", DIST);
+      run_bench(name, filter, bench_lut_search, HEIGHT);
+      destroy_lookup(LUT);
+   }
+   run_bench("seq2id/k=12", filter, bench_seq2id, 12);
+   run_bench("nukesort", filter, bench_nukesort, SEQLEN);
+   run_bench("transfer_useq_ids/64", filter, bench_transfer_ids, 0);
+
+   return 0;
+}
@@ -6,6 +6,47 @@
    tr -d "\r\n" | \
    grep -q "AGGGCTTACAAGTATAGGCC[[:space:]]6AGGGCTTACAAGTATAGGCA[[:space:]]2"
 
+# Message passing in batch mode.
+printf "test_file_spheres.fastq\tbatch_output.txt\n" > batch_manifest.txt
+../starcode --batch batch_manifest.txt 2>/dev/null
+tr -d "\r\n" < batch_output.txt | \
+   grep -q "AGGGCTTACAAGTATAGGCC[[:space:]]6AGGGCTTACAAGTATAGGCA[[:space:]]2"
+rm -f batch_manifest.txt batch_output.txt
+
+# Metrics of the run.
+../starcode --metrics metrics.prom test_file_spheres.fastq >/dev/null 2>&1
+grep -q '^starcode_stage{stage="done"} 1$' metrics.prom
+grep -q '^starcode_jobs_done_total 1$' metrics.prom
+rm -f metrics.prom
+
+# Trace of a run with several threads (more sequences than
+# 'SMALL_INPUT' so that the jobs run on the threads).
+awk 'BEGIN { srand(1); for (i = 0 ; i < 6000 ; i++) { s = "";
+   for (j = 0 ; j < 20 ; j++) s = s substr("ACGT", int(rand()*4)+1, 1);
+   print s } }' > trace_input.txt
+../starcode -t 4 -d 2 --trace trace.json trace_input.txt >/dev/null 2>&1
+python3 -m json.tool trace.json >/dev/null || exit 1
+for event in '"name":"build","ph":"X"' '"name":"query","ph":"X"' \
+      '"name":"search","ph":"X","pid":1,"tid":0' \
+      '"name":"cluster","ph":"X","pid":1,"tid":0' ; do
+   grep -qF "$event" trace.json || exit 1
+done
+rm -f trace_input.txt trace.json
+
+# Sequences shorter than a window of minimizers fall back to
+# the trie search with --long.
+printf "ACGTACGTACGTACGT\t10\nACGTACGTACGTACGA\t1\n" > long_input.txt
+../starcode -d 1 --long long_input.txt 2>long_err.txt | \
+   grep -q "ACGTACGTACGTACGT[[:space:]]11" || exit 1
+grep -q "warning: .* --long disabled" long_err.txt || exit 1
+rm -f long_input.txt long_err.txt
+
+# Compressed output.
+../starcode test_file_spheres.fastq -o output.txt.gz 2>/dev/null
+gzip -dc output.txt.gz | tr -d "\r\n" | \
+   grep -q "AGGGCTTACAAGTATAGGCC[[:space:]]6AGGGCTTACAAGTATAGGCA[[:space:]]2"
+rm -f output.txt.gz
+
 # Sphere clustering.
 ../starcode --sphere test_file_spheres.fastq 2>/dev/null | \
    tr -d "\r\n" | \
@@ -0,0 +1,726 @@
+#include <time.h>
+#include <unistd.h>
+#include "starcode.c"
+
+// Differential test of the search engines against a brute-force
+// all-pairs reference. Datasets are generated at random (clusters of
+// mutated copies of random seeds, with variable lengths, 'N' and
+// padding), every engine computes the edges of the dataset for 'tau'
+// from 0 to 8 and the edge sets are compared to the reference. The
+// run also prints the time spent by each engine.
+//
+// The reference is the distance of the trie between the sequences
+// padded to the longest: a Levenshtein distance in a band of width
+// 'tau' where 'N' is a mismatch with every character (including 'N')
+// and with the "PAD exceptions" of 'poucet()'. It is computed by full
+// dynamic programming, without the shortcuts of the trie.
+//
+// One shortcut changes the result: 'dash()' looks for an exact suffix
+// as soon as the band reaches 'tau', but the "PAD exceptions" can
+// still lower the band below. This only happens below the seed depth
+// of the query, which depends on the order of the queries, so such
+// edges may be missing or at distance 'tau'. They are counted as
+// "known" instead of errors.
+//
+// The engine of '--long' computes the plain Levenshtein distance (with
+// 'N' as a mismatch). Its filter only guarantees the pairs that share
+// a minimizer and lose at most 'LONG_E' minimizers per error on each
+// side, the other pairs may be missing and they are "known".
+//
+// With '--max-indels k', the alignments cannot leave the 2k+1 central
+// diagonals. The reference is the Levenshtein distance in this band
+// (on sequences of the same length).
+//
+// Usage: ./oracle [-n nseq] [-r rounds] [-s seed] [-v]
+//
+// Exit status is 1 if any engine disagrees with the reference.
+
+typedef void (*engine_fun_t)(gstack_t *, int);
+
+typedef enum {
+   REF_TRIE,    // Distance of the trie (see above).
+   REF_LONG,    // Plain Levenshtein distance (see below).
+   REF_BAND,    // Shift of at most 'BAND_INDELS' (see below).
+   NREFS,
+} ref_t;
+
+typedef struct {
+   const char   * name;
+   engine_fun_t   run;
+   ref_t          ref;
+   int            minlen; // Only for sequences at least that long.
+   int            fixed;  // Only for sequences of the same length.
+   double         time;
+   long           errors;
+   long           known;
+} engine_t;
+
+typedef struct {
+   int   i;      // Lower seqid.
+   int   j;      // Higher seqid.
+   int   dist;
+   int   known;  // Depends on 'dash()' (see above).
+} edge_t;
+
+typedef struct {
+   const char * name;
+   int          minlen;
+   int          maxlen;
+   double       nrate;  // Probability of 'N' at each position.
+} dataset_t;
+
+static int      NSEQ    = 600;
+static int      ROUNDS  = 2;
+static int      VERBOSE = 0;
+static uint64_t RSTATE  = 88172645463325252ULL;
+
+uint64_t
+xorshift
+(void)
+{
+   RSTATE ^= RSTATE << 13;
+   RSTATE ^= RSTATE >> 7;
+   RSTATE ^= RSTATE << 17;
+   return RSTATE;
+}
+
+double
+now_sec
+(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// ------  REFERENCE ------ //
+
+#define REF_PAD 5
+#define BAND_INDELS 1
+
+void
+reference_codes
+(
+   const char * seq,
+   int          height,
+   int          query,
+   int        * codes
+)
+// Codes of the sequence padded to 'height' (1-based as in 'search()').
+// 'N' is 0 in the trie and 6 in the query, so that it never matches.
+{
+   int pad = height - strlen(seq);
+   for (int i = 0 ; i < height ; i++) {
+      char c = i < pad ? ' ' : seq[i-pad];
+      codes[i+1] = c == ' ' ? REF_PAD : c == 'A' ? 1 : c == 'C' ? 2 :
+         c == 'G' ? 3 : c == 'T' ? 4 : query ? 6 : 0;
+   }
+}
+
+int
+reference_distance
+(
+   const int * q,
+   const int * t,
+   int         tau,
+   int         height,
+   int       * known
+)
+// Dynamic programming of 'poucet()' between the query 'q' and the
+// sequence of the trie 't' (codes from 'reference_codes()'). As in
+// the caches of the trie, 'up[a]' is the cell of the query position
+// 'depth' and of the trie position 'depth-a', 'lo[a]' is the other
+// way around, cells out of the band have value 'a'. Returns 'tau'+1
+// if the distance is greater than 'tau'. Sets 'known' if 'dash()'
+// can give a different result.
+{
+   int up[TAU+2], lo[TAU+2], pup[TAU+2], plo[TAU+2];
+   for (int a = 0 ; a <= TAU+1 ; a++) up[a] = lo[a] = a;
+   // Outcomes of 'dash()' at the depths where it applies (the trie
+   // uses the first one below the seed depth).
+   int dash_hit = 0;
+   int dash_miss = 0;
+   for (int depth = 1 ; depth <= height ; depth++) {
+      memcpy(pup, up, sizeof(up));
+      memcpy(plo, lo, sizeof(lo));
+      int maxa = min(depth-1, tau);
+      for (int a = maxa ; a > 0 ; a--) {
+         // "PAD exceptions" on the edges of the band.
+         int diag = a == maxa && q[depth-1] == REF_PAD ? 0 : pup[a];
+         int mmatch = diag + (t[depth-a] != q[depth]);
+         up[a] = min(mmatch, min(pup[a-1], up[a+1]) + 1);
+         diag = a == maxa && t[depth-1] == REF_PAD ? 0 : plo[a];
+         mmatch = diag + (t[depth] != q[depth-a]);
+         lo[a] = min(mmatch, min(plo[a-1], lo[a+1]) + 1);
+      }
+      up[0] = lo[0] = min(pup[0] + (t[depth] != q[depth]),
+            min(up[1], lo[1]) + 1);
+      if (up[0] > tau) break;
+      if (depth == height) break;
+      int can_dash = 1;
+      for (int a = 0 ; a <= maxa ; a++) {
+         if (up[a] < tau || lo[a] < tau) can_dash = 0;
+      }
+      if (can_dash) {
+         // 'dash()' reports distance 'tau' on an exact suffix.
+         int exact = 1;
+         for (int i = depth+1 ; i <= height ; i++) exact &= t[i] == q[i];
+         dash_hit |= exact;
+         dash_miss |= !exact;
+      }
+   }
+   int d = up[0] > tau ? tau+1 : up[0];
+   *known = (dash_hit && d != tau) || (dash_miss && d <= tau);
+   return d;
+}
+
+int
+plain_distance
+(
+   const char * a,
+   const char * b,
+   int          tau,
+   int          band
+)
+// Levenshtein distance where 'N' is a mismatch with every character,
+// in 'band' diagonals on each side. Returns 'tau'+1 if it is greater.
+{
+   int la = strlen(a);
+   int lb = strlen(b);
+   if (abs(la - lb) > band) return tau+1;
+   int *prev = malloc((lb+1) * sizeof(int));
+   int *cur = malloc((lb+1) * sizeof(int));
+   for (int j = 0 ; j <= lb ; j++) prev[j] = j <= band ? j : tau+1;
+   for (int i = 1 ; i <= la ; i++) {
+      for (int j = 0 ; j <= lb ; j++) cur[j] = tau+1;
+      if (i <= band) cur[0] = min(i, tau+1);
+      for (int j = max(1, i-band) ; j <= min(lb, i+band) ; j++) {
+         int mm = a[i-1] != b[j-1] || a[i-1] == 'N';
+         cur[j] = min(prev[j-1] + mm, min(prev[j], cur[j-1]) + 1);
+         cur[j] = min(cur[j], tau+1);
+      }
+      int *tmp = prev; prev = cur; cur = tmp;
+   }
+   int d = prev[lb];
+   free(prev);
+   free(cur);
+   return d;
+}
+
+int
+filter_misses
+(
+   const char * a,
+   const char * b,
+   int          tau
+)
+// Whether the filter of 'long_pairs()' can miss the pair 'a', 'b'.
+{
+   uint32_t *ma = malloc((strlen(a)+1) * sizeof(uint32_t));
+   uint32_t *mb = malloc((strlen(b)+1) * sizeof(uint32_t));
+   int na = long_minimizers(a, ma);
+   int nb = long_minimizers(b, mb);
+   // The minimizers are sorted.
+   int shared = 0;
+   for (int i = 0, j = 0 ; i < na && j < nb ; ) {
+      if (ma[i] == mb[j]) { shared++; i++; j++; }
+      else if (ma[i] < mb[j]) i++;
+      else j++;
+   }
+   free(ma);
+   free(mb);
+   return shared == 0 || na - shared > LONG_E*tau ||
+      nb - shared > LONG_E*tau;
+}
+
+int
+edge_order
+(
+   const void *a,
+   const void *b
+)
+{
+   const edge_t *e1 = a;
+   const edge_t *e2 = b;
+   if (e1->i != e2->i) return e1->i < e2->i ? -1 : 1;
+   if (e1->j != e2->j) return e1->j < e2->j ? -1 : 1;
+   return e1->dist - e2->dist;
+}
+
+edge_t *
+reference_edges
+(
+   char ** seqs,
+   int     n,
+   int     tau,
+   ref_t   ref,
+   int   * nedges
+)
+{
+   int height = 0;
+   for (int i = 0 ; i < n ; i++) height = max(height, (int) strlen(seqs[i]));
+   // Codes of the sequences as queries and as sequences of the trie.
+   int *qcodes = malloc(n * (height+2) * sizeof(int));
+   int *tcodes = malloc(n * (height+2) * sizeof(int));
+   for (int i = 0 ; i < n ; i++) {
+      reference_codes(seqs[i], height, 1, qcodes + i*(height+2));
+      reference_codes(seqs[i], height, 0, tcodes + i*(height+2));
+   }
+
+   int size = 1024;
+   edge_t *edges = malloc(size * sizeof(edge_t));
+   *nedges = 0;
+   for (int i = 0 ; i < n ; i++) {
+   for (int j = i+1 ; j < n ; j++) {
+      // The distance is symmetric, the later sequence is the query.
+      int known = 0;
+      int d;
+      if (ref == REF_LONG) {
+         d = plain_distance(seqs[j], seqs[i], tau, tau);
+         known = d <= tau && filter_misses(seqs[i], seqs[j], tau);
+      }
+      else if (ref == REF_BAND) {
+         d = plain_distance(seqs[j], seqs[i], tau, min(tau, BAND_INDELS));
+      }
+      else {
+         d = reference_distance(qcodes + j*(height+2),
+               tcodes + i*(height+2), tau, height, &known);
+      }
+      // Distance 0 does not happen after 'seqsort()', and
+      // is never reported by the engines.
+      if ((d > tau && !known) || d == 0) continue;
+      if (*nedges == size) {
+         size *= 2;
+         edges = realloc(edges, size * sizeof(edge_t));
+      }
+      edges[(*nedges)++] =
+         (edge_t) { .i = i+1, .j = j+1, .dist = d, .known = known };
+   }
+   }
+   free(qcodes);
+   free(tcodes);
+   qsort(edges, *nedges, sizeof(edge_t), edge_order);
+   return edges;
+}
+
+
+// ------  ENGINES ------ //
+// Engines receive sorted unique sequences and leave
+// bidirectional matches in the 'matches' member.
+
+void
+run_trie_engine
+(
+   gstack_t * uSQ,
+   int        tau,
+   int        thrmax
+)
+// Same steps as 'starcode()'.
+{
+   int ntries = 3 * thrmax + (thrmax % 2 == 0);
+   if (uSQ->nitems < ntries) {
+      ntries = 1;
+      thrmax = 1;
+   }
+   int med = -1;
+   int height = useq_lengths(uSQ, &med);
+   mtplan_t *mtplan = plan_mt(tau, height, med, ntries, thrmax, uSQ);
+   run_plan(mtplan, 0, thrmax);
+   destroy_plan(mtplan);
+}
+
+void
+engine_small
+(
+   gstack_t * uSQ,
+   int        tau
+)
+// Single trie of 'small_search()', whatever the size.
+{
+   int med = -1;
+   int height = useq_lengths(uSQ, &med);
+   small_search(uSQ, tau, height, med);
+}
+
+void
+engine_batch
+(
+   gstack_t * uSQ,
+   int        tau
+)
+// All the sequences in one trie, queried by 'search_batch()'
+// in batches of 64 (without seed depth or pebbles).
+{
+   int med = -1;
+   int height = useq_lengths(uSQ, &med);
+   trie_t *trie = new_trie(height);
+   node_t *nodes = malloc(uSQ->nitems * height * sizeof(node_t));
+   node_t *pos = nodes;
+   for (int i = 0 ; i < uSQ->nitems ; i++) {
+      useq_t *u = uSQ->items[i];
+      void **data = insert_string_wo_malloc(trie, u->seq, &pos);
+      *data = u;
+   }
+   const char *queries[64];
+   gstack_t **hits[64];
+   for (int k = 0 ; k < 64 ; k++) hits[k] = new_tower(tau+1);
+   for (int start = 0 ; start < uSQ->nitems ; start += 64) {
+      int nq = min(64, uSQ->nitems - start);
+      for (int k = 0 ; k < nq ; k++) {
+         queries[k] = ((useq_t *) uSQ->items[start+k])->seq;
+         for (int d = 0 ; d <= tau ; d++) hits[k][d]->nitems = 0;
+      }
+      if (search_batch(trie, queries, nq, tau, hits)) {
+         alert();
+         krash();
+      }
+      // Every pair is found from both sides, keep one.
+      for (int k = 0 ; k < nq ; k++) {
+         useq_t *u = uSQ->items[start+k];
+         for (int d = 1 ; d <= tau ; d++) {
+         for (int h = 0 ; h < hits[k][d]->nitems ; h++) {
+            useq_t *match = hits[k][d]->items[h];
+            if (match->seqid < u->seqid) {
+               link_match(u, match, d, tau, NULL, NULL);
+            }
+         }
+         }
+      }
+   }
+   for (int k = 0 ; k < 64 ; k++) destroy_tower(hits[k]);
+   destroy_trie(trie, DESTROY_NODES_NO, NULL);
+   free(nodes);
+}
+
+void
+engine_split
+(
+   gstack_t * uSQ,
+   int        tau
+)
+// Trie search with '--split-search'.
+{
+   SPLITSEARCH = 1;
+   run_trie_engine(uSQ, tau, 1);
+   SPLITSEARCH = 0;
+}
+
+void
+engine_long
+(
+   gstack_t * uSQ,
+   int        tau
+)
+// Minimizer engine of '--long'.
+{
+   long_search(uSQ, tau, 1);
+}
+
+void
+engine_band
+(
+   gstack_t * uSQ,
+   int        tau
+)
+// Trie search with '--max-indels' (ignored unless 'tau' is greater).
+{
+   MAXINDELS = BAND_INDELS < tau ? BAND_INDELS : -1;
+   run_trie_engine(uSQ, tau, 1);
+   MAXINDELS = -1;
+}
+
+void engine_trie(gstack_t *uSQ, int tau) { run_trie_engine(uSQ, tau, 1); }
+void engine_trie_mt(gstack_t *uSQ, int tau) { run_trie_engine(uSQ, tau, 4); }
+
+static engine_t ENGINES[] = {
+   { "trie",      engine_trie,    REF_TRIE,   0,  0, 0.0, 0, 0 },
+   { "trie(t=4)", engine_trie_mt, REF_TRIE,   0,  0, 0.0, 0, 0 },
+   { "small",     engine_small,   REF_TRIE,   0,  0, 0.0, 0, 0 },
+   { "batch",     engine_batch,   REF_TRIE,   0,  0, 0.0, 0, 0 },
+   { "split",     engine_split,   REF_TRIE,   0,  1, 0.0, 0, 0 },
+   { "band",      engine_band,    REF_BAND,   0,  1, 0.0, 0, 0 },
+   // The filter of '--long' needs several windows.
+   { "long",      engine_long,    REF_LONG,   40, 0,
+      0.0, 0, 0 },
+   { NULL, NULL, 0, 0, 0, 0.0, 0, 0 },
+};
+
+
+// ------  DATA GENERATION ------ //
+
+static const dataset_t DATASETS[] = {
+   { "fixed",     20, 20, 0.00 },
+   { "fixed-N",   24, 24, 0.02 },
+   { "variable",  15, 25, 0.00 },
+   { "with-N",    18, 22, 0.02 },
+   { "padding",    8, 40, 0.00 },
+   { "long",      60, 80,  0.01 },
+   { NULL, 0, 0, 0.0 },
+};
+
+void
+random_seq
+(
+   char            * seq,
+   const dataset_t * ds
+)
+{
+   int len = ds->minlen + xorshift() % (ds->maxlen - ds->minlen + 1);
+   for (int i = 0 ; i < len ; i++) {
+      int isn = (xorshift() % 10000) < ds->nrate * 10000;
+      seq[i] = isn ? 'N' : "ACGT"[xorshift() & 3];
+   }
+   seq[len] = '\0';
+}
+
+void
+mutate
+(
+   char            * seq,
+   int               nerr,
+   const dataset_t * ds
+)
+// Random substitutions, insertions and deletions.
+{
+   for (int e = 0 ; e < nerr ; e++) {
+      int len = strlen(seq);
+      int type = xorshift() % 3;
+      if (len <= ds->minlen && type == 2) type = 0;
+      if (len >= ds->maxlen && type == 1) type = 0;
+      int pos = xorshift() % (len + (type == 1));
+      char c = "ACGT"[xorshift() & 3];
+      if (type == 0 && pos < len) seq[pos] = c;
+      if (type == 1) {
+         memmove(seq+pos+1, seq+pos, len-pos+1);
+         seq[pos] = c;
+      }
+      if (type == 2) memmove(seq+pos, seq+pos+1, len-pos);
+   }
+}
+
+gstack_t *
+generate
+(
+   const dataset_t * ds,
+   int               n,
+   int               tau
+)
+// Clusters of 8 sequences, mutated from a random seed with
+// up to 'tau'+1 errors, then sorted and reduced.
+{
+   char seed[M];
+   char seq[M];
+   gstack_t *uSQ = new_gstack();
+   for (int i = 0 ; i < n ; i++) {
+      if (i % 8 == 0) random_seq(seed, ds);
+      strcpy(seq, seed);
+      mutate(seq, xorshift() % (tau + 2), ds);
+      push(new_useq(1, seq, NULL), &uSQ);
+   }
+   uSQ->nitems = seqsort((useq_t **) uSQ->items, uSQ->nitems, 1);
+   // Use the seqid as the index of the sequence (1-based).
+   for (int i = 0 ; i < uSQ->nitems ; i++) {
+      useq_t *u = uSQ->items[i];
+      u->nids = 1;
+      u->seqid = (void *)(unsigned long)(i+1);
+   }
+   return uSQ;
+}
+
+
+// ------  COMPARISON ------ //
+
+edge_t *
+engine_edges
+(
+   gstack_t * uSQ,
+   int      * nedges
+)
+{
+   int size = 1024;
+   edge_t *edges = malloc(size * sizeof(edge_t));
+   *nedges = 0;
+   for (int i = 0 ; i < uSQ->nitems ; i++) {
+      useq_t *u = uSQ->items[i];
+      if (u->matches == NULL) continue;
+      int ui = (int)(unsigned long) u->seqid;
+      for (int d = 0 ; u->matches[d] != TOWER_TOP ; d++) {
+      for (int k = 0 ; k < u->matches[d]->nitems ; k++) {
+         useq_t *m = u->matches[d]->items[k];
+         int mi = (int)(unsigned long) m->seqid;
+         if (*nedges == size) {
+            size *= 2;
+            edges = realloc(edges, size * sizeof(edge_t));
+         }
+         edges[(*nedges)++] = (edge_t) {
+            .i = min(ui, mi), .j = max(ui, mi), .dist = d };
+      }
+      }
+      destroy_tower(u->matches);
+      u->matches = NULL;
+   }
+   qsort(edges, *nedges, sizeof(edge_t), edge_order);
+   // Matches are bidirectional, remove duplicates.
+   int k = 0;
+   for (int e = 0 ; e < *nedges ; e++) {
+      if (k > 0 && edge_order(edges+k-1, edges+e) == 0) continue;
+      edges[k++] = edges[e];
+   }
+   *nedges = k;
+   return edges;
+}
+
+long
+compare_edges
+(
+   const char * engine,
+   char      ** seqs,
+   edge_t     * ref,
+   int          nref,
+   edge_t     * got,
+   int          ngot,
+   long       * known
+)
+// Returns the number of differences (printed if VERBOSE). The
+// differences on the edges that depend on 'dash()' are added to
+// 'known' instead. Such edges are in the reference even if the
+// distance is greater than 'tau'.
+{
+   long diff = 0;
+   int a = 0, b = 0;
+   while (a < nref || b < ngot) {
+      int cmp;
+      if (a == nref) cmp = 1;
+      else if (b == ngot) cmp = -1;
+      else if (ref[a].i != got[b].i) cmp = ref[a].i < got[b].i ? -1 : 1;
+      else if (ref[a].j != got[b].j) cmp = ref[a].j < got[b].j ? -1 : 1;
+      else cmp = 0;
+      edge_t *e = cmp <= 0 ? ref+a : got+b;
+      const char *what = NULL;
+      if (cmp < 0) what = "missing";
+      else if (cmp > 0) what = "extra";
+      else if (ref[a].dist != got[b].dist) what = "distance";
+      if (what != NULL && cmp <= 0 && ref[a].known) {
+         (*known)++;
+         what = NULL;
+      }
+      if (what != NULL) {
+         diff++;
+         if (VERBOSE) {
+            fprintf(stderr, "%s: %s edge %s %s (ref %d, got %d)\n",
+                  engine, what, seqs[e->i-1], seqs[e->j-1],
+                  cmp <= 0 ? ref[a].dist : -1,
+                  cmp >= 0 ? got[b].dist : -1);
+         }
+      }
+      if (cmp <= 0) a++;
+      if (cmp >= 0) b++;
+   }
+   return diff;
+}
+
+int
+main
+(
+   int argc,
+   char **argv
+)
+{
+   int c;
+   while ((c = getopt(argc, argv, "n:r:s:v")) != -1) {
+      switch (c) {
+         case 'n': NSEQ = atoi(optarg); break;
+         case 'r': ROUNDS = atoi(optarg); break;
+         case 's': RSTATE = strtoull(optarg, NULL, 10) | 1; break;
+         case 'v': VERBOSE = 1; break;
+         default:
+            fprintf(stderr,
+                  "usage: %s [-n nseq] [-r rounds] [-s seed] [-v]\n",
+                  argv[0]);
+            return 1;
+      }
+   }
+
+   // Search threads read the global clustering algorithm.
+   CLUSTERALG = SPHERES_CLUSTER;
+
+   double reftime = 0.0;
+   long total_errors = 0;
+
+   fprintf(stdout, "%-4s %-10s %7s %7s", "tau", "dataset", "nseq", "edges");
+   for (engine_t *e = ENGINES ; e->name != NULL ; e++) {
+      fprintf(stdout, " %10s", e->name);
+   }
+   fprintf(stdout, "\n");
+
+   for (int tau = 0 ; tau <= STARCODE_MAX_TAU ; tau++) {
+   for (const dataset_t *ds = DATASETS ; ds->name != NULL ; ds++) {
+   for (int r = 0 ; r < ROUNDS ; r++) {
+      gstack_t *uSQ = generate(ds, NSEQ, tau);
+      char **seqs = malloc(uSQ->nitems * sizeof(char *));
+      for (int i = 0 ; i < uSQ->nitems ; i++) {
+         seqs[i] = strdup(((useq_t *) uSQ->items[i])->seq);
+      }
+
+      // The references are computed when an engine needs them.
+      edge_t *refs[NREFS] = { NULL };
+      int nrefs[NREFS] = { 0 };
+      double t0 = now_sec();
+      refs[REF_TRIE] = reference_edges(seqs, uSQ->nitems, tau, REF_TRIE,
+            &nrefs[REF_TRIE]);
+      reftime += now_sec() - t0;
+
+      fprintf(stdout, "%-4d %-10s %7d %7d", tau, ds->name,
+            uSQ->nitems, nrefs[REF_TRIE]);
+      for (engine_t *e = ENGINES ; e->name != NULL ; e++) {
+         if ((e->fixed && ds->minlen != ds->maxlen) ||
+               ds->minlen < e->minlen) {
+            fprintf(stdout, " %10s", "-");
+            continue;
+         }
+         if (refs[e->ref] == NULL) {
+            t0 = now_sec();
+            refs[e->ref] = reference_edges(seqs, uSQ->nitems, tau, e->ref,
+                  &nrefs[e->ref]);
+            reftime += now_sec() - t0;
+         }
+         edge_t *ref = refs[e->ref];
+         int nref = nrefs[e->ref];
+         t0 = now_sec();
+         e->run(uSQ, tau);
+         e->time += now_sec() - t0;
+         int ngot;
+         edge_t *got = engine_edges(uSQ, &ngot);
+         long diff = compare_edges(e->name, seqs, ref, nref, got, ngot,
+               &e->known);
+         e->errors += diff;
+         total_errors += diff;
+         if (diff) fprintf(stdout, " %8ld !", diff);
+         else      fprintf(stdout, " %10s", "ok");
+         free(got);
+      }
+      fprintf(stdout, "\n");
+
+      for (int k = 0 ; k < NREFS ; k++) free(refs[k]);
+      for (int i = 0 ; i < uSQ->nitems ; i++) {
+         destroy_useq(uSQ->items[i]);
+         free(seqs[i]);
+      }
+      free(seqs);
+      free(uSQ);
+   }
+   }
+   }
+
+   fprintf(stdout, "\n%-12s %10s %10s %10s\n", "engine", "time (s)",
+         "errors", "known");
+   fprintf(stdout, "%-12s %10.3f %10s %10s\n", "reference", reftime,
+         "-", "-");
+   for (engine_t *e = ENGINES ; e->name != NULL ; e++) {
+      fprintf(stdout, "%-12s %10.3f %10ld %10ld\n", e->name, e->time,
+            e->errors, e->known);
+   }
+
+   return total_errors > 0;
+}
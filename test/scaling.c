@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// Scaling test of the starcode binary. Datasets of increasing size
+// are generated (clusters of mutated random 30-mers, in raw format)
+// and starcode is run on each of them with an increasing number of
+// threads. The wall time and the peak RSS of every run are recorded,
+// as well as the parallel efficiency (time with 1 thread divided by
+// the number of threads times the time with t threads) and the peak
+// memory per unique sequence.
+//
+// The test fails if a run exceeds a budget:
+//   -T  maximum wall time of a run, in seconds (default 600)
+//   -m  maximum peak RSS per unique sequence, in bytes (default 4096)
+//   -e  minimum parallel efficiency, in percent (default 0: no check)
+//
+// Sizes and threads:
+//   -n  largest size as a power of 10 (default 5, from 10^4)
+//   -t  largest number of threads, doubling from 1 (default 4)
+//   -d  distance passed to starcode (default 3)
+//   -b  path to the binary (default ../starcode)
+
+#define SEQLEN 30
+
+static int      MAXEXP  = 5;
+static int      MAXTHR  = 4;
+static int      DIST    = 3;
+static double   MAXTIME = 600.0;
+static double   MAXMEM  = 4096.0;
+static double   MINEFF  = 0.0;
+static char   * BINARY  = "../starcode";
+static uint64_t RSTATE  = 88172645463325252ULL;
+
+uint64_t
+xorshift
+(void)
+{
+   RSTATE ^= RSTATE << 13;
+   RSTATE ^= RSTATE >> 7;
+   RSTATE ^= RSTATE << 17;
+   return RSTATE;
+}
+
+int
+generate
+(
+   const char * path,
+   long         n
+)
+// Write 'n' sequences in clusters of 10 (a random seed and
+// 9 copies with 1 or 2 substitutions) with random counts.
+{
+   FILE *f = fopen(path, "w");
+   if (f == NULL) return 1;
+   char seed[SEQLEN+1];
+   char seq[SEQLEN+1];
+   seed[SEQLEN] = seq[SEQLEN] = '\0';
+   for (long i = 0 ; i < n ; i++) {
+      if (i % 10 == 0) {
+         for (int j = 0 ; j < SEQLEN ; j++) seed[j] = "ACGT"[xorshift() & 3];
+         memcpy(seq, seed, SEQLEN);
+      }
+      else {
+         memcpy(seq, seed, SEQLEN);
+         int nerr = 1 + xorshift() % 2;
+         for (int e = 0 ; e < nerr ; e++) {
+            seq[xorshift() % SEQLEN] = "ACGT"[xorshift() & 3];
+         }
+      }
+      int count = i % 10 == 0 ? 100 + xorshift() % 1000 : 1 + xorshift() % 5;
+      fprintf(f, "%s\t%d\n", seq, count);
+   }
+   return fclose(f) != 0;
+}
+
+int
+run
+(
+   const char * input,
+   int          threads,
+   double     * wall,
+   double     * rss
+)
+// Run starcode and collect wall time (seconds) and peak RSS (bytes).
+{
+   char thr[16];
+   char dist[16];
+   snprintf(thr, 16, "%d", threads);
+   snprintf(dist, 16, "%d", DIST);
+   char *argv[] = { BINARY, "-q", "-t", thr, "-d", dist,
+      "-i", (char *) input, "-o", "/dev/null", NULL };
+
+   struct timespec t0, t1;
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   pid_t pid = fork();
+   if (pid < 0) return 1;
+   if (pid == 0) {
+      execv(BINARY, argv);
+      fprintf(stderr, "cannot run %s: %s\n", BINARY, strerror(errno));
+      _exit(127);
+   }
+   int status;
+   struct rusage usage;
+   if (wait4(pid, &status, 0, &usage) < 0) return 1;
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   *wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+   // 'ru_maxrss' is in kilobytes on Linux.
+   *rss = usage.ru_maxrss * 1024.0;
+   return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+int
+main
+(
+   int argc,
+   char **argv
+)
+{
+   int c;
+   while ((c = getopt(argc, argv, "b:d:e:m:n:t:T:")) != -1) {
+      switch (c) {
+         case 'b': BINARY  = optarg; break;
+         case 'd': DIST    = atoi(optarg); break;
+         case 'e': MINEFF  = atof(optarg); break;
+         case 'm': MAXMEM  = atof(optarg); break;
+         case 'n': MAXEXP  = atoi(optarg); break;
+         case 't': MAXTHR  = atoi(optarg); break;
+         case 'T': MAXTIME = atof(optarg); break;
+         default:
+            fprintf(stderr, "usage: %s [-b binary] [-d dist] [-e min eff %%] "
+                  "[-m max bytes/seq] [-n max exp] [-t max threads] "
+                  "[-T max seconds]\n", argv[0]);
+            return 1;
+      }
+   }
+   if (MAXEXP < 4 || MAXTHR < 1) {
+      fprintf(stderr, "invalid parameters\n");
+      return 1;
+   }
+
+   char input[] = "/tmp/starcode-scaling-XXXXXX";
+   int fd = mkstemp(input);
+   if (fd < 0) {
+      fprintf(stderr, "cannot create temporary file\n");
+      return 1;
+   }
+   close(fd);
+
+   int failed = 0;
+   fprintf(stdout, "%10s %7s %10s %10s %10s %10s\n",
+         "nseq", "threads", "wall (s)", "RSS (MB)", "bytes/seq", "eff (%)");
+
+   for (int e = 4 ; e <= MAXEXP ; e++) {
+      long n = 1;
+      for (int i = 0 ; i < e ; i++) n *= 10;
+      if (generate(input, n)) {
+         fprintf(stderr, "cannot write %s\n", input);
+         failed = 1;
+         break;
+      }
+      double t1 = 0.0;
+      for (int t = 1 ; t <= MAXTHR ; t *= 2) {
+         double wall, rss;
+         if (run(input, t, &wall, &rss)) {
+            fprintf(stdout, "%10ld %7d   run failed\n", n, t);
+            failed = 1;
+            continue;
+         }
+         if (t == 1) t1 = wall;
+         double eff = 100 * t1 / (t * wall);
+         double perseq = rss / n;
+         const char *flag = "";
+         if (wall > MAXTIME) flag = "  time budget exceeded";
+         else if (perseq > MAXMEM) flag = "  memory budget exceeded";
+         else if (t > 1 && eff < MINEFF) flag = "  efficiency too low";
+         if (*flag) failed = 1;
+         fprintf(stdout, "%10ld %7d %10.3f %10.1f %10.0f %10.1f%s\n",
+               n, t, wall, rss / (1 << 20), perseq, eff, flag);
+         fflush(stdout);
+      }
+   }
+
+   unlink(input);
+   return failed;
+}
@@ -1,5 +1,6 @@
 #include "unittest.h"
 #include "starcode.c"
+#include <zlib.h>
 
 static const char untranslate[7] = "NACGT N";
 
@@ -373,7 +374,7 @@ test_starcode_5
 void
 test_starcode_6
 (void)
-// Test 'pad_useq()' and 'unpad_useq()'
+// Test 'useq_lengths()'
 {
 
    gstack_t * useqS = new_gstack();
@@ -389,9 +390,10 @@ test_starcode_6
    test_assert(useqS->nitems == 2);
 
    int med;
-   pad_useq(useqS, &med);
-   // The call to 'new_useq()' will capitalize the sequence.
-   test_assert(strcmp(u2->seq, "    $EE6XKB+.Q;NK)|W[KQ;") == 0);
+   test_assert(useq_lengths(useqS, &med) == 24);
+   // The sequences are not padded. The call to 'new_useq()'
+   // will capitalize the sequence.
+   test_assert(strcmp(u2->seq, "$EE6XKB+.Q;NK)|W[KQ;") == 0);
    test_assert(med == 20);
 
    useq_t *u3 = new_useq(23, "0sdfd:'!'@{1$Ee6xkB+.Q;[Nk)|w[KQ;", NULL);
@@ -399,17 +401,17 @@ test_starcode_6
    push(u3, &useqS);
    test_assert(useqS->nitems == 3);
 
-   pad_useq(useqS, &med);
-   // The call to 'new_useq()' will capitalize the sequence.
-   test_assert(strcmp(u1->seq, "         L@[OHZTP{2@V(U(X7FLT&X80") == 0);
-   test_assert(strcmp(u2->seq, "             $EE6XKB+.Q;NK)|W[KQ;") == 0);
-   test_assert(med == 24);
-
-   unpad_useq(useqS);
-   // The call to 'new_useq()' will capitalize the sequence.
+   test_assert(useq_lengths(useqS, &med) == 33);
    test_assert(strcmp(u1->seq, "L@[OHZTP{2@V(U(X7FLT&X80") == 0);
    test_assert(strcmp(u2->seq, "$EE6XKB+.Q;NK)|W[KQ;") == 0);
    test_assert(strcmp(u3->seq, "0SDFD:'!'@{1$EE6XKB+.Q;[NK)|W[KQ;") == 0);
+   test_assert(med == 20);
+
+   // Common prefix of the virtually padded sequences.
+   test_assert(padded_prefix("ACGT", "ACGA", 6) == 5);
+   test_assert(padded_prefix("ACGT", "TCGT", 6) == 2);
+   test_assert(padded_prefix("ACGT", "ACGTA", 6) == 1);
+   test_assert(padded_prefix("ACGTAA", "ACG", 6) == 0);
 
    destroy_useq(u1);
    destroy_useq(u2);
@@ -433,7 +435,7 @@ test_starcode_7
    };
 
    for (int i = 0 ; i < 4 ; i++) {
-      lookup_t * lut = new_lookup(20+i, 20+i, 3);
+      lookup_t * lut = new_lookup(20+i, 20+i, 3, 1);
       test_assert_critical(lut != NULL);
       test_assert(lut->kmers == 3+1);
       test_assert(lut->slen == 20+i);
@@ -445,7 +447,7 @@ test_starcode_7
    }
 
    for (int i = 0 ; i < 10 ; i++) {
-      lookup_t * lut = new_lookup(59+i, 59+i, 3);
+      lookup_t * lut = new_lookup(59+i, 59+i, 3, 1);
       test_assert_critical(lut != NULL);
       test_assert(lut->kmers == 3+1);
       test_assert(lut->slen == 59+i);
@@ -511,61 +513,87 @@ test_starcode_9
 
    srand48(123);
 
-   lookup_t *lut = new_lookup(20, 20, 3);
+   uint32_t mask;
+   lookup_t *lut = new_lookup(20, 20, 3, 1);
    test_assert_critical(lut != NULL);
 
    // Insert a too short string (nothing happens).
    useq_t *u = new_useq(0, "", NULL);
    test_assert_critical(u != NULL);
-   test_assert(lut_insert(lut, u) == 0);
+   test_assert(lut_insert(lut, u, 0) == 0);
    destroy_useq(u);
 
    // Insert the following k-mers: ACG|TAGC|GCTA|TAGC|GATCA
    u = new_useq(0, "ACGTAGCGCTATAGCGATCA", NULL);
    test_assert_critical(u != NULL);
-   test_assert(lut_insert(lut, u) == 0);
-   test_assert(lut_search(lut, u) == 1);
+   test_assert(lut_insert(lut, u, 0) == 0);
+   test_assert(lut_search(lut, u, -1, &mask) == 1);
    destroy_useq(u);
 
    u = new_useq(0, "CGTAGCGCTATAGCGATCAA", NULL);
    test_assert_critical(u != NULL);
-   test_assert(lut_search(lut, u) == 1);
+   test_assert(lut_search(lut, u, -1, &mask) == 1);
    destroy_useq(u);
 
    u = new_useq(0, "AAAATAGCGCCCCCCCCCCC", NULL);
    test_assert_critical(u != NULL);
-   test_assert(lut_search(lut, u) == 1);
+   test_assert(lut_search(lut, u, -1, &mask) == 1);
    destroy_useq(u);
 
    u = new_useq(0, "CCCCCCCCCCCCCCCGATCA", NULL);
    test_assert_critical(u != NULL);
-   test_assert(lut_search(lut, u) == 1);
+   test_assert(lut_search(lut, u, -1, &mask) == 1);
    destroy_useq(u);
 
    u = new_useq(0, "CCCCCGCTACCCCCCCCCCC", NULL);
    test_assert_critical(u != NULL);
-   test_assert(lut_search(lut, u) == 1);
+   test_assert(lut_search(lut, u, -1, &mask) == 1);
    destroy_useq(u);
 
    u = new_useq(0, "TAGCAAAAAAAAAAAAAAAA", NULL);
    test_assert_critical(u != NULL);
-   test_assert(lut_search(lut, u) == 1);
+   test_assert(lut_search(lut, u, -1, &mask) == 1);
    destroy_useq(u);
 
    u = new_useq(0, "CCCCCCCCCCCCCCGATCAC", NULL);
    test_assert_critical(u != NULL);
-   test_assert(lut_search(lut, u) == 0);
+   test_assert(lut_search(lut, u, -1, &mask) == 0);
    destroy_useq(u);
 
    u = new_useq(0, "AAAAAAAAAAAAAAAAAAAA", NULL);
    test_assert_critical(u != NULL);
-   test_assert(lut_search(lut, u) == 0);
+   test_assert(lut_search(lut, u, -1, &mask) == 0);
    destroy_useq(u);
 
    destroy_lookup(lut);
    lut = NULL;
 
-   lut = new_lookup(20, 20, 3);
+   // Index of 3 tries.
+   lut = new_lookup(20, 20, 3, 3);
+   test_assert_critical(lut != NULL);
+   useq_t *a = new_useq(0, "ACGTAGCGCTATAGCGATCA", NULL);
+   useq_t *b = new_useq(0, "CCCCCCCCCCCCCCCGATCA", NULL);
+   useq_t *c = new_useq(0, "TTTTTTTTTTTTTTTTTTTT", NULL);
+   test_assert_critical(a != NULL && b != NULL && c != NULL);
+   test_assert(lut_insert(lut, a, 0) == 0);
+   test_assert(lut_insert(lut, b, 2) == 0);
+   test_assert(lut_insert(lut, c, 1) == 0);
+   test_assert(lut_search(lut, a, -1, &mask) == 1);
+   test_assert(mask == 5);
+   test_assert(lut_search(lut, a, 0, &mask) == 1);
+   test_assert(mask == 4);
+   test_assert(lut_search(lut, b, 2, &mask) == 1);
+   test_assert(mask == 1);
+   test_assert(lut_search(lut, c, -1, &mask) == 1);
+   test_assert(mask == 2);
+   test_assert(lut_search(lut, c, 1, &mask) == 0);
+   test_assert(mask == 0);
+   destroy_useq(a);
+   destroy_useq(b);
+   destroy_useq(c);
+   destroy_lookup(lut);
+
+   lut = new_lookup(20, 20, 3, 1);
    test_assert_critical(lut != NULL);
 
    for (int i = 0 ; i < 10000 ; i++) {
@@ -575,15 +603,15 @@ test_starcode_9
          seq[j] = untranslate[(int)(1 + 4*drand48())];
       } 
       u = new_useq(0, seq, NULL);
-      test_assert(lut_insert(lut, u) == 0);
-      test_assert(lut_search(lut, u) == 1);
+      test_assert(lut_insert(lut, u, 0) == 0);
+      test_assert(lut_search(lut, u, -1, &mask) == 1);
       destroy_useq(u);
    }
 
    destroy_lookup(lut);
 
    // Insert every 4-mer.
-   lut = new_lookup(19, 19, 3);
+   lut = new_lookup(19, 19, 3, 1);
    test_assert_critical(lut != NULL);
    char seq[20] = "AAAAAAAAAAAAAAAAAAA"; //AAA|AAAA|AAAA|AAAA
    for (int i = 0 ; i < 256 ; i++) {
@@ -593,18 +621,20 @@ test_starcode_9
       }
       u = new_useq(0, seq, NULL);
       test_assert_critical(u != NULL);
-      test_assert(lut_insert(lut, u) == 0);
+      test_assert(lut_insert(lut, u, 0) == 0);
       destroy_useq(u);
    }
 
    for (int i = 0 ; i < 4 ; i++) {
-      test_assert(*lut->lut[i] == 255);
+      for (int j = 0 ; j < 256 / 8 ; j++) {
+         test_assert(lut->lut[i][j] == 255);
+      }
    }
 
    destroy_lookup(lut);
 
    // Insert randomly.
-   lut = new_lookup(64, 64, 3);
+   lut = new_lookup(64, 64, 3, 1);
    test_assert_critical(lut != NULL);
    for (int i = 0 ; i < 4 ; i++) {
       // MAX_K_FOR_LOOKUP
@@ -618,7 +648,7 @@ test_starcode_9
       } 
       u = new_useq(0, seq, NULL);
       test_assert_critical(u != NULL);
-      test_assert(lut_insert(lut, u) == 0);
+      test_assert(lut_insert(lut, u, 0) == 0);
       destroy_useq(u);
    }
 
@@ -702,7 +732,7 @@ test_starcode_10
 
    // Read raw file.
    FILE *f = fopen("test_file.txt", "r");
-   gstack_t *useqS = read_file(f, NULL, 0);
+   gstack_t *useqS = read_file(f, NULL, NULL, 1, 0);
    test_assert(useqS->nitems == 35);
    for (int i = 0 ; i < useqS->nitems ; i++) {
       useq_t * u = (useq_t *) useqS->items[i];
@@ -719,7 +749,7 @@ test_starcode_10
 
    // Read fasta file.
    f = fopen("test_file.fasta", "r");
-   useqS = read_file(f, NULL, 0);
+   useqS = read_file(f, NULL, NULL, 1, 0);
    test_assert(useqS->nitems == 5);
    for (int i = 0 ; i < useqS->nitems ; i++) {
       useq_t * u = (useq_t *) useqS->items[i];
@@ -736,7 +766,7 @@ test_starcode_10
 
    // Read fastq file.
    f = fopen("test_file1.fastq", "r");
-   useqS = read_file(f, NULL, 0);
+   useqS = read_file(f, NULL, NULL, 1, 0);
    test_assert(useqS->nitems == 5);
    for (int i = 0 ; i < useqS->nitems ; i++) {
       useq_t * u = (useq_t *) useqS->items[i];
@@ -770,7 +800,7 @@ test_starcode_10
    // Read paired-end fastq file.
    FILE *f1 = fopen("test_file1.fastq", "r");
    FILE *f2 = fopen("test_file2.fastq", "r");
-   useqS = read_file(f1, f2, 0);
+   useqS = read_file(f1, f2, NULL, 1, 0);
    test_assert(useqS->nitems == 5);
    for (int i = 0 ; i < useqS->nitems ; i++) {
       useq_t * u = (useq_t *) useqS->items[i];
@@ -792,6 +822,152 @@ test_starcode_10
 }
 
 
+void
+test_read_files
+(void)
+// Test 'read_files()'.
+{
+
+   // Read three copies of the same raw file with two threads.
+   FILE *f[3];
+   for (int i = 0 ; i < 3 ; i++) {
+      f[i] = fopen("test_file.txt", "r");
+      test_assert_critical(f[i] != NULL);
+   }
+   gstack_t *useqS = read_files(f, NULL, 3, NULL, 2, 0);
+   test_assert_critical(useqS != NULL);
+   test_assert(FORMAT == RAW);
+   test_assert(useqS->nitems == 105);
+
+   // Items are in file order and ids are consecutive.
+   for (int i = 0 ; i < useqS->nitems ; i++) {
+      useq_t *u = (useq_t *) useqS->items[i];
+      useq_t *v = (useq_t *) useqS->items[i % 35];
+      test_assert(strcmp(u->seq, v->seq) == 0);
+      test_assert((unsigned long) u->seqid == i+1);
+   }
+
+   // Clean.
+   for (int i = 0 ; i < useqS->nitems ; i++) {
+      destroy_useq(useqS->items[i]);
+   }
+   free(useqS);
+   for (int i = 0 ; i < 3 ; i++) fclose(f[i]);
+
+   // Read two pairs of paired-end fastq files.
+   FILE *f1[2];
+   FILE *f2[2];
+   for (int i = 0 ; i < 2 ; i++) {
+      f1[i] = fopen("test_file1.fastq", "r");
+      f2[i] = fopen("test_file2.fastq", "r");
+      test_assert_critical(f1[i] != NULL && f2[i] != NULL);
+   }
+   useqS = read_files(f1, f2, 2, NULL, 4, 0);
+   test_assert_critical(useqS != NULL);
+   test_assert(FORMAT == PE_FASTQ);
+   test_assert(useqS->nitems == 10);
+   for (int i = 0 ; i < useqS->nitems ; i++) {
+      useq_t *u = (useq_t *) useqS->items[i];
+      useq_t *v = (useq_t *) useqS->items[i % 5];
+      test_assert(strcmp(u->seq, v->seq) == 0);
+      test_assert((unsigned long) u->seqid == i+1);
+   }
+
+   // Clean.
+   for (int i = 0 ; i < useqS->nitems ; i++) {
+      destroy_useq(useqS->items[i]);
+   }
+   free(useqS);
+   for (int i = 0 ; i < 2 ; i++) {
+      fclose(f1[i]);
+      fclose(f2[i]);
+   }
+
+}
+
+
+void
+test_read_bam
+(void)
+// Test 'read_bam()' through 'read_file()'.
+{
+
+   const char * expected[] = {
+      "AGGGCTTACAAGTATAGGCC",
+      "TGCGCCAAGTACGATTTCCG",
+      "CCTCATTATTTGTCGCAATG",
+      "AGGGCTTACAAGTATAGGCC",
+      "AGGGCTTACAAGTATAGGCC",
+   };
+
+   // Single-end BAM file (small BGZF blocks, so that records span
+   // several blocks) with a secondary alignment, which is skipped,
+   // and a reverse read, which is reverse-complemented.
+   OUTPUTT = NRED_OUTPUT;
+   FILE *f = fopen("test_file.bam", "r");
+   test_assert_critical(f != NULL);
+   gstack_t *useqS = read_file(f, NULL, NULL, 2, 0);
+   test_assert_critical(useqS != NULL);
+   test_assert(FORMAT == FASTQ);
+   test_assert(useqS->nitems == 5);
+   for (int i = 0 ; i < useqS->nitems ; i++) {
+      useq_t * u = (useq_t *) useqS->items[i];
+      char info[32];
+      sprintf(info, "@seq%d\nBBBBBBBBBBBBBBBBBBBB", i+1);
+      test_assert(u->count == 1);
+      test_assert(strcmp(u->seq, expected[i]) == 0);
+      test_assert(strcmp(u->info, info) == 0);
+      test_assert((unsigned long) u->seqid == i+1);
+   }
+
+   // Clean.
+   for (int i = 0 ; i < useqS->nitems ; i++) {
+      destroy_useq(useqS->items[i]);
+   }
+   free(useqS);
+   fclose(f);
+
+   char *PE_expected[]= {
+      "AGGGCTTACAAGTATAGGCC---------AAGGGCTTACAAGTATAGGC",
+      "TGCGCCAAGTACGATTTCCG---------ATGCGCCAAGTACGATTTCC",
+      "CCTCATTATTTGTCGCAATG---------ACCTCATTATTTGTCGCAAT",
+      "AGGGCTTACAAGTATAGGCC---------AAGGGCTTACAAGTATAGGC",
+      "AGGGCTTACAAGTATAGGCC---------AAGGGCTTACAAGTATAGGC",
+   };
+
+   char *PE_info[] = {
+      "AGGGCTTACAAGTATAGGCC/AAGGGCTTACAAGTATAGGC",
+      "TGCGCCAAGTACGATTTCCG/ATGCGCCAAGTACGATTTCC",
+      "CCTCATTATTTGTCGCAATG/ACCTCATTATTTGTCGCAAT",
+      "AGGGCTTACAAGTATAGGCC/AAGGGCTTACAAGTATAGGC",
+      "AGGGCTTACAAGTATAGGCC/AAGGGCTTACAAGTATAGGC",
+   };
+
+   // Paired-end BAM file (read 2 is reverse).
+   OUTPUTT = DEFAULT_OUTPUT;
+   f = fopen("test_file_PE.bam", "r");
+   test_assert_critical(f != NULL);
+   useqS = read_file(f, NULL, NULL, 1, 0);
+   test_assert_critical(useqS != NULL);
+   test_assert(FORMAT == PE_FASTQ);
+   test_assert(useqS->nitems == 5);
+   for (int i = 0 ; i < useqS->nitems ; i++) {
+      useq_t * u = (useq_t *) useqS->items[i];
+      test_assert(u->count == 1);
+      test_assert(strcmp(u->seq, PE_expected[i]) == 0);
+      test_assert(strcmp(u->info, PE_info[i]) == 0);
+   }
+
+   // Clean.
+   for (int i = 0 ; i < useqS->nitems ; i++) {
+      destroy_useq(useqS->items[i]);
+   }
+   free(useqS);
+   fclose(f);
+
+}
+
+
 void
 test_seqsort
 (void)
@@ -1002,6 +1178,657 @@ test_seqsort
 
 }
 
+void
+test_ingest_seq
+(void)
+// Test ingest_seq().
+{
+
+   // Longer than the vector width, to test both the
+   // vectorized loop and the scalar remainder.
+   char seq[] = "acgtnACGTNacgtnACGTNacgtnACGTNacgtnACGTNaCgTn";
+   size_t len = strlen(seq);
+   test_assert(ingest_seq(seq, len) == 0);
+   test_assert(strcmp(seq,
+            "ACGTNACGTNACGTNACGTNACGTNACGTNACGTNACGTNACGTN") == 0);
+
+   // Only the first 'len' characters are processed.
+   char part[] = "acgtacgt";
+   test_assert(ingest_seq(part, 4) == 0);
+   test_assert(strcmp(part, "ACGTacgt") == 0);
+
+   // Empty sequence is valid.
+   test_assert(ingest_seq(part, 0) == 0);
+
+   // Invalid characters at every position are detected,
+   // including those that map to 'ACGTN' with other bits.
+   const char bad[] = { 'U', 'x', ' ', '-', '!', '#', 'A' | 0x80, 0 };
+   for (int i = 0 ; bad[i] != 0 ; i++) {
+      for (size_t pos = 0 ; pos < len ; pos++) {
+         char copy[sizeof(seq)];
+         memcpy(copy, seq, sizeof(seq));
+         copy[pos] = bad[i];
+         test_assert(ingest_seq(copy, len) == 1);
+      }
+   }
+
+}
+
+void
+test_merge_runs
+(void)
+// Test the sorted runs made while reading.
+{
+
+   // Reference: read then sort.
+   FILE *f = fopen("test_file.txt", "r");
+   test_assert_critical(f != NULL);
+   gstack_t *ref = read_file(f, NULL, NULL, 1, 0);
+   test_assert_critical(ref != NULL);
+   ref->nitems = seqsort((useq_t **) ref->items, ref->nitems, 1);
+   fclose(f);
+
+   // Small runs, so that there are several levels of merge. Run
+   // sizes that do not divide the input and a single run as well.
+   const int runsizes[] = {1, 4, 5, 16, 100};
+   const int threads[] = {1, 2, 3, 4, 1};
+   for (int k = 0 ; k < 5 ; k++) {
+      sorter_t *sorter = new_sorter(runsizes[k], threads[k]);
+      f = fopen("test_file.txt", "r");
+      test_assert_critical(f != NULL);
+      gstack_t *useqS = read_file(f, NULL, sorter, threads[k], 0);
+      test_assert_critical(useqS != NULL);
+      test_assert(useqS->nitems == 35);
+      useqS->nitems = merge_runs(sorter, (useq_t **) useqS->items,
+            threads[k]);
+      test_assert(sorter->nruns == 0);
+      destroy_sorter(sorter);
+      fclose(f);
+
+      test_assert(useqS->nitems == ref->nitems);
+      for (int i = 0 ; i < useqS->nitems ; i++) {
+         useq_t *u = (useq_t *) useqS->items[i];
+         useq_t *v = (useq_t *) ref->items[i];
+         test_assert(strcmp(u->seq, v->seq) == 0);
+         test_assert(u->count == v->count);
+         test_assert(u->nids == v->nids);
+         if (u->nids == 1) test_assert(u->seqid == v->seqid);
+         else {
+            for (unsigned int j = 0 ; j < u->nids ; j++) {
+               test_assert(u->seqid[j] == v->seqid[j]);
+            }
+         }
+      }
+
+      // Clean.
+      for (int i = 0 ; i < useqS->nitems ; i++) {
+         destroy_useq(useqS->items[i]);
+      }
+      free(useqS);
+   }
+
+   for (int i = 0 ; i < ref->nitems ; i++) {
+      destroy_useq(ref->items[i]);
+   }
+   free(ref);
+
+}
+
+int
+naive_levenshtein
+(
+   const char * a,
+   const char * b
+)
+// Reference for 'long_distance()' ('N' matches nothing).
+{
+   int m = strlen(a);
+   int n = strlen(b);
+   int *prev = malloc((n+1) * sizeof(int));
+   int *curr = malloc((n+1) * sizeof(int));
+   if (prev == NULL || curr == NULL) {
+      fprintf(stderr, "unittest error (%s:%d)\n", __FILE__, __LINE__);
+      exit(EXIT_FAILURE);
+   }
+   for (int j = 0 ; j <= n ; j++) prev[j] = j;
+   for (int i = 1 ; i <= m ; i++) {
+      curr[0] = i;
+      for (int j = 1 ; j <= n ; j++) {
+         int sub = prev[j-1] + (a[i-1] != b[j-1] || a[i-1] == 'N');
+         curr[j] = min(sub, min(prev[j], curr[j-1]) + 1);
+      }
+      int *tmp = prev;
+      prev = curr;
+      curr = tmp;
+   }
+   int dist = prev[n];
+   free(prev);
+   free(curr);
+   return dist;
+}
+
+
+void
+test_long_distance
+(void)
+// Test 'long_distance()' against the naive dynamic programming.
+{
+
+   test_assert(long_distance("ACGT", "ACGT", 0) == 0);
+   test_assert(long_distance("ACGN", "ACGN", 0) == 1);
+   test_assert(long_distance("ACGT", "AGT", 2) == 1);
+   test_assert(long_distance("ACGT", "TGCA", 2) == 3);
+   test_assert(long_distance("A", "AAAA", 2) == 3);
+   test_assert(long_distance("AAAAATA", "AAAAA", 3) == 2);
+
+   srand48(123);
+   char a[501];
+   char b[521];
+   for (int it = 0 ; it < 2000 ; it++) {
+      int len = 1 + (int)((it % 2 ? 500 : 30) * drand48());
+      for (int i = 0 ; i < len ; i++) {
+         a[i] = "ACGTN"[(int)((it % 5 ? 4 : 5) * drand48())];
+      }
+      a[len] = '\0';
+      // Substitutions, insertions and deletions.
+      strcpy(b, a);
+      for (int e = 0 ; e < it % 10 ; e++) {
+         int n = strlen(b);
+         int pos = (int)(n * drand48());
+         char c = untranslate[(int)(1 + 4*drand48())];
+         switch (e % 3) {
+            case 0:
+               b[pos] = c;
+               break;
+            case 1:
+               memmove(b+pos+1, b+pos, n-pos+1);
+               b[pos] = c;
+               break;
+            default:
+               if (n > 1) memmove(b+pos, b+pos+1, n-pos);
+         }
+      }
+      int tau = it % 9;
+      int dist = naive_levenshtein(a, b);
+      test_assert(long_distance(a, b, tau) == min(dist, tau+1));
+   }
+
+}
+
+
+void
+test_long_pairs
+(void)
+// Test 'long_minimizers()' and 'long_pairs()'.
+{
+
+   uint32_t mins[64];
+   // Too short for a k-mer.
+   test_assert(long_minimizers("ACGTACGTACGTAC", mins) == 0);
+   // One k-mer, one minimizer. 'N' k-mers are skipped.
+   test_assert(long_minimizers("ACGTACGTACGTACG", mins) == 1);
+   test_assert(long_minimizers("ACGTACGTACGTACN", mins) == 0);
+   // A homopolymer has a single distinct minimizer.
+   test_assert(long_minimizers(
+            "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", mins) == 1);
+
+   // Random sequences of length 300 with variants.
+   srand48(123);
+   const int nseeds = 50;
+   const int nseqs = nseeds * 4;
+   char **seqs = malloc(nseqs * sizeof(char *));
+   test_assert_critical(seqs != NULL);
+   for (int s = 0 ; s < nseeds ; s++) {
+      for (int v = 0 ; v < 4 ; v++) {
+         char *seq = seqs[4*s+v] = calloc(302, 1);
+         test_assert_critical(seq != NULL);
+         if (v == 0) {
+            for (int i = 0 ; i < 300 ; i++) {
+               seq[i] = untranslate[(int)(1 + 4*drand48())];
+            }
+            continue;
+         }
+         strcpy(seq, seqs[4*s]);
+         for (int e = 0 ; e < v ; e++) {
+            seq[(int)(300 * drand48())] = untranslate[(int)(1 + 4*drand48())];
+         }
+         // Insertion in the last variant.
+         if (v == 3) {
+            memmove(seq+151, seq+150, 151);
+            seq[150] = 'A';
+         }
+      }
+   }
+
+   for (int tau = 1 ; tau < 5 ; tau++) {
+      ledge_t *edges = NULL;
+      long nedges = long_pairs(seqs, nseqs, tau, 1 + tau % 3, &edges);
+      test_assert_critical(nedges >= 0);
+      // All the pairs within the distance (the filter can miss pairs
+      // in principle, but not on this data), in order.
+      long k = 0;
+      for (int i = 0 ; i < nseqs ; i++) {
+         for (int j = i+1 ; j < nseqs ; j++) {
+            int dist = naive_levenshtein(seqs[i], seqs[j]);
+            if (dist < 1 || dist > tau) continue;
+            test_assert(k < nedges);
+            if (k >= nedges) continue;
+            test_assert(edges[k].i == i);
+            test_assert(edges[k].j == j);
+            test_assert(edges[k].dist == dist);
+            k++;
+         }
+      }
+      test_assert(k == nedges);
+      free(edges);
+   }
+
+   for (int i = 0 ; i < nseqs ; i++) free(seqs[i]);
+   free(seqs);
+
+}
+
+
+void
+test_serve_connection
+(void)
+// Test the protocol of 'serve_connection()' on temporary files.
+{
+
+   char *seqs[] = {"ACGTACGTAC", "ACGTACGTAA", "TTTTTTTTTT"};
+   useq_t *u[3];
+   // The server trie is 'tau' nucleotides higher than the sequences.
+   trie_t *trie = new_trie(12);
+   node_t *nodes = malloc(3 * 12 * sizeof(node_t));
+   test_assert_critical(trie != NULL && nodes != NULL);
+   node_t *node_pos = nodes;
+   for (int i = 0 ; i < 3 ; i++) {
+      u[i] = new_useq(1, seqs[i], NULL);
+      test_assert_critical(u[i] != NULL);
+      u[i]->nids = 1;
+      u[i]->seqid = (void *)(unsigned long) (i+1);
+      void **data = insert_string_wo_malloc(trie, u[i]->seq, &node_pos);
+      test_assert_critical(data != NULL);
+      *data = u[i];
+   }
+
+   // Two requests on the same connection (the second one
+   // reuses the buffers of the first).
+   char *queries[] = {
+      "acgtacgtac",     // Exact match, lower case.
+      "ACGTACGTAG",     // Two nearest sequences.
+      "GGGGGGGGGG",     // No match.
+      "ACGTACGTACG",    // Insertion.
+      "TTTTTTTTTTTTTTTTTTTT", // Longer than the trie.
+      "TTTTTTTTAT",
+   };
+   uint32_t nq[] = {5, 1};
+   FILE *in = tmpfile();
+   FILE *out = tmpfile();
+   test_assert_critical(in != NULL && out != NULL);
+   int k = 0;
+   for (int r = 0 ; r < 2 ; r++) {
+      fwrite(nq+r, sizeof(uint32_t), 1, in);
+      for (uint32_t q = 0 ; q < nq[r] ; q++) {
+         uint32_t len = strlen(queries[k]);
+         fwrite(&len, sizeof(uint32_t), 1, in);
+         fwrite(queries[k++], sizeof(char), len, in);
+      }
+   }
+   rewind(in);
+   test_assert(serve_connection(trie, 2, in, out) == 0);
+   rewind(out);
+
+   uint32_t expected[] = {
+      0, 1, 1,
+      1, 2, 1, 2,
+      UINT32_MAX, 0,
+      1, 1, 1,
+      UINT32_MAX, 0,
+      1, 1, 3,
+   };
+   const int n = sizeof(expected) / sizeof(uint32_t);
+   uint32_t response[32];
+   test_assert(fread(response, sizeof(uint32_t), 32, out) == (size_t) n);
+   for (int i = 0 ; i < n ; i++) test_assert(response[i] == expected[i]);
+   fclose(in);
+   fclose(out);
+
+   // A truncated request is an error.
+   in = tmpfile();
+   out = tmpfile();
+   test_assert_critical(in != NULL && out != NULL);
+   uint32_t header[] = {2, 10};
+   fwrite(header, sizeof(uint32_t), 2, in);
+   fwrite(seqs[0], sizeof(char), 10, in);
+   rewind(in);
+   test_assert(serve_connection(trie, 2, in, out) == 1);
+   fclose(in);
+   fclose(out);
+
+   destroy_trie(trie, DESTROY_NODES_NO, NULL);
+   free(nodes);
+   for (int i = 0 ; i < 3 ; i++) destroy_useq(u[i]);
+
+}
+
+
+void
+test_starcode_cluster
+(void)
+// Test the in-memory entry point 'starcode_cluster()'.
+{
+
+   // Records of 12 bytes, padded with NUL.
+   const char seqs[] =
+      "ACGTACGTAC\0\0"
+      "ACGTACGTAA\0\0"
+      "acgtacgtac\0\0"     // Same as the first.
+      "TTTTTTTTTT\0\0"
+      "TTTTTTTTTA\0\0";
+   int counts[] = {10, 1, 2, 3, 3};
+   int clusters[5];
+   int canonicals[5];
+   int sizes[5];
+
+   // Message passing: the Ts have the same count and are not linked.
+   // The ties are sorted by sequence.
+   test_assert(starcode_cluster(seqs, 12, counts, 5, 1, 1, MP_CLUSTER, 5,
+            clusters, canonicals, sizes) == 3);
+   int mp_canonicals[] = {0, 4, 3};
+   int mp_sizes[] = {13, 3, 3};
+   int mp_clusters[] = {0, 0, 0, 2, 1};
+   for (int i = 0 ; i < 3 ; i++) {
+      test_assert(canonicals[i] == mp_canonicals[i]);
+      test_assert(sizes[i] == mp_sizes[i]);
+   }
+   for (int i = 0 ; i < 5 ; i++) test_assert(clusters[i] == mp_clusters[i]);
+
+   // Spheres and connected components link the Ts.
+   for (int alg = SPHERES_CLUSTER ; alg <= COMPONENTS_CLUSTER ; alg++) {
+      test_assert(starcode_cluster(seqs, 12, counts, 5, 1, 1, alg, 5,
+               clusters, canonicals, sizes) == 2);
+      test_assert(canonicals[0] == 0 && sizes[0] == 13);
+      test_assert(sizes[1] == 6);
+      test_assert(canonicals[1] == 3 || canonicals[1] == 4);
+      for (int i = 0 ; i < 5 ; i++) test_assert(clusters[i] == (i > 2));
+   }
+
+   // Counts are 1 by default.
+   test_assert(starcode_cluster(seqs, 12, NULL, 5, 1, 1, MP_CLUSTER, 1,
+            clusters, canonicals, sizes) == 2);
+   test_assert(canonicals[0] == 0 && sizes[0] == 3);
+
+   // Invalid sequences and counts.
+   counts[1] = 0;
+   redirect_stderr();
+   test_assert(starcode_cluster(seqs, 12, counts, 5, 1, 1, MP_CLUSTER, 5,
+            clusters, canonicals, sizes) == -1);
+   test_assert(starcode_cluster("ACGTX", 5, NULL, 1, 1, 1, MP_CLUSTER, 5,
+            clusters, canonicals, sizes) == -1);
+   unredirect_stderr();
+   test_assert(starcode_cluster("", 5, NULL, 0, 1, 1, MP_CLUSTER, 5,
+            clusters, canonicals, sizes) == 0);
+
+}
+
+
+void
+test_thread_independence
+(void)
+// Test that the clusters do not depend on the number of threads.
+{
+
+   // Triples of random 12-mers: two parents at distance 2 and a
+   // child at distance 1 from both. The count of the child is odd,
+   // so it is split between the parents with a remainder.
+   const int nseq = 6000;
+   char *seqs = malloc(nseq * 13);
+   int *counts = malloc(nseq * sizeof(int));
+   int *clusters = malloc(2 * nseq * sizeof(int));
+   int *canonicals = malloc(2 * nseq * sizeof(int));
+   int *sizes = malloc(2 * nseq * sizeof(int));
+   test_assert_critical(seqs != NULL && counts != NULL &&
+         clusters != NULL && canonicals != NULL && sizes != NULL);
+   unsigned int state = 12345;
+   for (int i = 0 ; i < nseq ; i += 3) {
+      char *s = seqs + 13*i;
+      for (int j = 0 ; j < 12 ; j++) {
+         state = state * 1103515245 + 12345;
+         s[j] = "ACGT"[(state >> 16) & 3];
+      }
+      s[12] = '\0';
+      memcpy(s + 13, s, 13);
+      memcpy(s + 26, s, 13);
+      // Mutate positions 'a' and 'b' in the second parent and only
+      // position 'a' in the child.
+      state = state * 1103515245 + 12345;
+      int a = (state >> 16) % 6;
+      int b = 6 + (state >> 8) % 6;
+      s[13+a] = s[26+a] = s[a] == 'A' ? 'C' : 'A';
+      s[13+b] = s[b] == 'G' ? 'T' : 'G';
+      counts[i] = counts[i+1] = 100;
+      counts[i+2] = 1 + 2 * ((state >> 4) % 5);
+   }
+   for (int alg = MP_CLUSTER ; alg <= COMPONENTS_CLUSTER ; alg++) {
+      int ncl1 = starcode_cluster(seqs, 13, counts, nseq, 1, 1, alg, 5,
+            clusters, canonicals, sizes);
+      int ncl2 = starcode_cluster(seqs, 13, counts, nseq, 1, 4, alg, 5,
+            clusters + nseq, canonicals + nseq, sizes + nseq);
+      test_assert_critical(ncl1 > 0 && ncl1 == ncl2);
+      test_assert(memcmp(clusters, clusters + nseq,
+               nseq * sizeof(int)) == 0);
+      test_assert(memcmp(canonicals, canonicals + nseq,
+               ncl1 * sizeof(int)) == 0);
+      test_assert(memcmp(sizes, sizes + nseq, ncl1 * sizeof(int)) == 0);
+   }
+
+   free(seqs);
+   free(counts);
+   free(clusters);
+   free(canonicals);
+   free(sizes);
+
+}
+
+void
+test_compress_open
+(void)
+// Test that compressed outputs of several blocks are read back.
+{
+
+   // Lines of text over a little more than 2 blocks.
+   const int nlines = (5 * COMPRESS_BLOCK_SIZE / 2) / 16;
+   char line[32];
+
+   FILE *tmp = tmpfile();
+   test_assert_critical(tmp != NULL);
+   // The stream closes its file, keep a duplicate to read back.
+   FILE *out = fdopen(dup(fileno(tmp)), "w");
+   test_assert_critical(out != NULL);
+   FILE *stream = compress_open(out, COMPRESS_GZIP, 3);
+   test_assert_critical(stream != NULL);
+   for (int i = 0 ; i < nlines ; i++) {
+      fprintf(stream, "ACGT\t%010d\n", i);
+   }
+   test_assert(fclose(stream) == 0);
+
+   rewind(tmp);
+   gzFile gz = gzdopen(dup(fileno(tmp)), "r");
+   test_assert_critical(gz != NULL);
+   int i = 0;
+   while (gzgets(gz, line, sizeof(line)) != NULL) {
+      char expected[32];
+      sprintf(expected, "ACGT\t%010d\n", i++);
+      if (strcmp(line, expected) != 0) break;
+   }
+   test_assert(i == nlines);
+   test_assert(gzgets(gz, line, sizeof(line)) == NULL);
+   gzclose(gz);
+   fclose(tmp);
+
+   // An empty output is a valid gzip file.
+   tmp = tmpfile();
+   test_assert_critical(tmp != NULL);
+   out = fdopen(dup(fileno(tmp)), "w");
+   stream = compress_open(out, COMPRESS_GZIP, 1);
+   test_assert_critical(stream != NULL);
+   test_assert(fclose(stream) == 0);
+   test_assert(fseek(tmp, 0, SEEK_END) == 0 && ftell(tmp) > 0);
+   rewind(tmp);
+   gz = gzdopen(dup(fileno(tmp)), "r");
+   test_assert_critical(gz != NULL);
+   test_assert(gzgets(gz, line, sizeof(line)) == NULL);
+   gzclose(gz);
+   fclose(tmp);
+
+   // No compression returns the file itself.
+   test_assert(compress_open(stdout, COMPRESS_NONE, 1) == stdout);
+   test_assert(compress_suffix("out.txt.gz") == COMPRESS_GZIP);
+   test_assert(compress_suffix("out.gz.txt") == COMPRESS_NONE);
+   test_assert(compress_format("bzip2") == COMPRESS_INVALID);
+
+}
+
+void
+test_trace_event
+(void)
+// Test the format of the trace and the escaping of event names.
+{
+
+   char path[] = "/tmp/starcode_trace_XXXXXX";
+   int fd = mkstemp(path);
+   test_assert_critical(fd >= 0);
+   close(fd);
+
+   // Nothing is recorded before 'trace_open()'.
+   test_assert(!trace_enabled());
+   trace_event("lost", 1, 0.0, 1.0, NULL);
+
+   test_assert_critical(trace_open(path) == 0);
+   test_assert(trace_enabled());
+   trace_stage("build");
+   trace_event("a \"b\"\\\n", 2, 1.0, 3.5, "\"queries\":%d", 7);
+   trace_event("c", 1, 4.0, 4.25, NULL);
+   trace_stage(NULL);
+   test_assert(trace_close() == 0);
+   test_assert(!trace_enabled());
+
+   char buf[4096];
+   FILE *f = fopen(path, "r");
+   test_assert_critical(f != NULL);
+   size_t n = fread(buf, 1, sizeof(buf)-1, f);
+   buf[n] = '\0';
+   fclose(f);
+   unlink(path);
+
+   const char *head = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+   test_assert(strncmp(buf, head, strlen(head)) == 0);
+   test_assert(n > 4 && strcmp(buf + n - 4, "\n]}\n") == 0);
+   // One lane name per worker.
+   test_assert(strstr(buf, "\"tid\":2,\"args\":{\"name\":\"worker 2\"}")
+         != NULL);
+   test_assert(strstr(buf, "\"tid\":3,") == NULL);
+   // Quotes, backslashes and control characters are escaped.
+   test_assert(strstr(buf, "{\"name\":\"a \\\"b\\\"\\\\\\u000a\",\"ph\":"
+         "\"X\",\"pid\":1,\"tid\":2,\"ts\":1.000,\"dur\":2.500,"
+         "\"args\":{\"queries\":7}}") != NULL);
+   test_assert(strstr(buf, "{\"name\":\"c\",\"ph\":\"X\",\"pid\":1,"
+         "\"tid\":1,\"ts\":4.000,\"dur\":0.250,\"args\":{}}") != NULL);
+   // The stage is on the main lane.
+   test_assert(strstr(buf, "{\"name\":\"build\",\"ph\":\"X\",\"pid\":1,"
+         "\"tid\":0,") != NULL);
+   test_assert(strstr(buf, "lost") == NULL);
+
+}
+
+struct stream_t {
+   int ncalls;
+   int stop;
+   int counts[8];
+   int nmembers[8];
+   char canonicals[8][16];
+   int assign[8];
+};
+
+int
+stream_cluster
+(
+   const starcode_cluster_t * cluster,
+         void               * data
+)
+{
+   struct stream_t *stream = (struct stream_t *) data;
+   // Every cluster comes before the reads of its members.
+   test_assert(cluster->number == stream->ncalls);
+   test_assert(strcmp(cluster->members[0], cluster->canonical) == 0 ||
+         strcmp(cluster->members[1], cluster->canonical) == 0);
+   stream->counts[stream->ncalls] = cluster->count;
+   stream->nmembers[stream->ncalls] = cluster->nmembers;
+   strcpy(stream->canonicals[stream->ncalls++], cluster->canonical);
+   return stream->stop;
+}
+
+int
+stream_assign
+(
+   int    seqid,
+   int    cluster,
+   void * data
+)
+{
+   struct stream_t *stream = (struct stream_t *) data;
+   test_assert(cluster < stream->ncalls);
+   stream->assign[seqid] = cluster;
+   return 0;
+}
+
+void
+test_starcode_stream
+(void)
+// Test the callbacks of 'starcode_stream()'.
+{
+
+   FILE *inputf = tmpfile();
+   test_assert_critical(inputf != NULL);
+   fprintf(inputf, "ACGTACGTAC\t10\nACGTACGTAA\t1\nACGTACGTAC\t2\n"
+         "TTTTTTTTTT\t3\nTTTTTTTTTA\t3\n");
+
+   struct stream_t stream = {0};
+   starcode_callbacks_t callbacks = {
+      .cluster = stream_cluster,
+      .assign  = stream_assign,
+      .data    = &stream,
+   };
+   rewind(inputf);
+   redirect_stderr();
+   test_assert(starcode_stream(&inputf, NULL, 1, 1, 0, 1, MP_CLUSTER, 5,
+            &callbacks) == 0);
+   unredirect_stderr();
+   test_assert(stream.ncalls == 3);
+   test_assert(strcmp(stream.canonicals[0], "ACGTACGTAC") == 0);
+   test_assert(stream.counts[0] == 13 && stream.nmembers[0] == 2);
+   test_assert(strcmp(stream.canonicals[1], "TTTTTTTTTA") == 0);
+   test_assert(stream.counts[1] == 3 && stream.nmembers[1] == 1);
+   test_assert(strcmp(stream.canonicals[2], "TTTTTTTTTT") == 0);
+   int assign[] = {0, 0, 0, 0, 2, 1};
+   for (int i = 1 ; i <= 5 ; i++) test_assert(stream.assign[i] == assign[i]);
+
+   // A callback can stop the run.
+   memset(&stream, 0, sizeof(stream));
+   stream.stop = 1;
+   rewind(inputf);
+   redirect_stderr();
+   test_assert(starcode_stream(&inputf, NULL, 1, 1, 0, 1, SPHERES_CLUSTER,
+            5, &callbacks) == 1);
+   unredirect_stderr();
+   test_assert(stream.ncalls == 1);
+   test_assert(stream.counts[0] == 13);
+
+   fclose(inputf);
+
+}
+
 // Test cases for export.
 const test_case_t test_cases_starcode[] = {
    {"starcode/base/1",  test_starcode_1},
@@ -1014,6 +1841,18 @@ const test_case_t test_cases_starcode[] = {
    {"starcode/base/8",  test_starcode_8},
    {"starcode/base/9",  test_starcode_9},
    {"starcode/base/10", test_starcode_10},
+   {"starcode/read_files", test_read_files},
+   {"starcode/read_bam", test_read_bam},
    {"starcode/seqsort", test_seqsort},
+   {"starcode/merge_runs", test_merge_runs},
+   {"starcode/ingest_seq", test_ingest_seq},
+   {"starcode/long_distance", test_long_distance},
+   {"starcode/long_pairs", test_long_pairs},
+   {"starcode/serve_connection", test_serve_connection},
+   {"starcode/starcode_cluster", test_starcode_cluster},
+   {"starcode/starcode_stream", test_starcode_stream},
+   {"starcode/thread_independence", test_thread_independence},
+   {"starcode/compress_open", test_compress_open},
+   {"starcode/trace_event", test_trace_event},
    {NULL, NULL}
 };
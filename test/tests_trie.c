@@ -249,9 +249,10 @@ test_base_4
       // Make sure that 'info' is initialized properly.
       info_t *info = trie->info;
       test_assert(((node_t*) *info->pebbles[0]->items) == trie->root);
-      for (int i = 1 ; i < M ; i++) {
+      for (int i = 1 ; i <= height ; i++) {
          test_assert_critical(info->pebbles[i]->items != NULL);
       }
+      test_assert(info->pebbles[height+1] == TOWER_TOP);
 
       // Insert 20 random sequences.
       for (int i = 0 ; i < 20 ; i++) {
@@ -278,9 +279,10 @@ test_base_4
       // Make sure that 'info' is initialized properly.
       info_t *info = trie->info;
       test_assert(((node_t*) *info->pebbles[0]->items) == trie->root);
-      for (int i = 1 ; i < M ; i++) {
+      for (int i = 1 ; i <= height ; i++) {
          test_assert_critical(info->pebbles[i]->items != NULL);
       }
+      test_assert(info->pebbles[height+1] == TOWER_TOP);
 
       // Insert 20 random sequences without malloc.
       node_t *nodes = malloc(20*height * sizeof(node_t));
@@ -421,6 +423,65 @@ test_base_8
 }
 
 
+void
+test_base_9
+(void)
+// Test virtual padding in 'insert_string_wo_malloc()' and 'search()'.
+{
+   trie_t *trie = new_trie(6);
+   test_assert_critical(trie != NULL);
+
+   node_t *nodes = malloc(3 * 5 * sizeof(node_t));
+   if (nodes == NULL) {
+      fprintf(stderr, "unittest error (%s:%d)\n", __FILE__, __LINE__);
+      exit(EXIT_FAILURE);
+   }
+   node_t *pos = nodes;
+
+   // Short strings take the same path as explicitly padded ones.
+   void **data = insert_string_wo_malloc(trie, "ACGT", &pos);
+   test_assert_critical(data != NULL);
+   *data = data;
+   test_assert(5 == (pos - nodes));
+   test_assert(insert_string_wo_malloc(trie, "  ACGT", &pos) == data);
+   test_assert(5 == (pos - nodes));
+
+   data = insert_string_wo_malloc(trie, "TACGT", &pos);
+   test_assert_critical(data != NULL);
+   *data = data;
+   data = insert_string_wo_malloc(trie, "AACGTA", &pos);
+   test_assert_critical(data != NULL);
+   *data = data;
+
+   // Short queries find the same hits as explicitly padded ones.
+   gstack_t **hits = new_tower(3);
+   gstack_t **phits = new_tower(3);
+   test_assert_critical(hits != NULL && phits != NULL);
+   const char *queries[] = {"ACGT", "CGT", "ACGTA", "TACGT"};
+   const char *padded[]  = {"  ACGT", "   CGT", " ACGTA", " TACGT"};
+   for (int i = 0 ; i < 4 ; i++) {
+      reset_gstack(hits);
+      reset_gstack(phits);
+      test_assert(search(trie, queries[i], 2, hits, 0, 0) == 0);
+      test_assert(search(trie, padded[i], 2, phits, 0, 0) == 0);
+      for (int d = 0 ; d < 3 ; d++) {
+         test_assert(hits[d]->nitems == phits[d]->nitems);
+      }
+   }
+   reset_gstack(hits);
+   search(trie, "ACGT", 2, hits, 0, 0);
+   test_assert(hits[0]->nitems == 1);
+   test_assert(hits[1]->nitems == 1);
+   test_assert(hits[2]->nitems == 1);
+
+   destroy_tower(hits);
+   destroy_tower(phits);
+   destroy_trie(trie, DESTROY_NODES_NO, NULL);
+   free(nodes);
+
+}
+
+
 void
 test_errmsg
 (void)
@@ -456,6 +517,8 @@ test_errmsg
    redirect_stderr();
    not_inserted = insert_string_wo_malloc(trie, too_long_string, &dummy);
    unredirect_stderr();
+   sprintf(string, "error: cannot insert string longer than %d\n",
+         get_height(trie));
    test_assert(not_inserted == NULL);
    test_assert_stderr(string);
 
@@ -1362,6 +1425,317 @@ test_search
 }
 
 
+void
+compare_search_batch
+(
+   int minlen
+)
+// Compare 'search_batch()' and 'search()' on a random trie of
+// height 20 with sequences of length 'minlen' to 20.
+{
+
+   srand48(123);
+
+   // Shorter sequences are virtually padded.
+   const int nseq = 2000;
+   trie_t *trie = new_trie(20);
+   test_assert_critical(trie != NULL);
+   node_t *nodes = malloc(nseq * 20 * sizeof(node_t));
+   char (*seqs)[21] = calloc(nseq, 21);
+   if (nodes == NULL || seqs == NULL) {
+      fprintf(stderr, "unittest error (%s:%d)\n", __FILE__, __LINE__);
+      exit(EXIT_FAILURE);
+   }
+   node_t *pos = nodes;
+   for (int i = 0 ; i < nseq ; i++) {
+      int len = minlen + (int)((21 - minlen) * drand48());
+      for (int j = 0 ; j < len ; j++) {
+         seqs[i][j] = untranslate[(int)(1 + 4*drand48())];
+      }
+      void **data = insert_string_wo_malloc(trie, seqs[i], &pos);
+      test_assert_critical(data != NULL);
+      *data = seqs[i];
+   }
+
+   // Queries are mutated sequences, some with an 'N'.
+   const int nq = 203;
+   char (*qrys)[21] = calloc(nq, 21);
+   const char **queries = malloc(nq * sizeof(char *));
+   gstack_t ***bhits = malloc(nq * sizeof(gstack_t **));
+   if (qrys == NULL || queries == NULL || bhits == NULL) {
+      fprintf(stderr, "unittest error (%s:%d)\n", __FILE__, __LINE__);
+      exit(EXIT_FAILURE);
+   }
+   for (int i = 0 ; i < nq ; i++) {
+      strcpy(qrys[i], seqs[(int)(nseq * drand48())]);
+      int len = strlen(qrys[i]);
+      for (int e = 0 ; e < i % 4 ; e++) {
+         qrys[i][(int)(len * drand48())] = untranslate[(int)(5*drand48())];
+      }
+      queries[i] = qrys[i];
+   }
+
+   gstack_t **hits = new_tower(5);
+   test_assert_critical(hits != NULL);
+   for (int tau = 0 ; tau < 5 ; tau++) {
+      for (int i = 0 ; i < nq ; i++) {
+         bhits[i] = new_tower(tau+1);
+         test_assert_critical(bhits[i] != NULL);
+      }
+      test_assert(search_batch(trie, queries, nq, tau, bhits) == 0);
+      for (int i = 0 ; i < nq ; i++) {
+         reset_gstack(hits);
+         test_assert(search(trie, queries[i], tau, hits, 0, 0) == 0);
+         for (int d = 0 ; d <= tau ; d++) {
+            test_assert(bhits[i][d]->nitems == hits[d]->nitems);
+            int n = min(bhits[i][d]->nitems, hits[d]->nitems);
+            for (int j = 0 ; j < n ; j++) {
+               test_assert(bhits[i][d]->items[j] == hits[d]->items[j]);
+            }
+         }
+         destroy_tower(bhits[i]);
+      }
+   }
+
+   destroy_tower(hits);
+   destroy_trie(trie, DESTROY_NODES_NO, NULL);
+   free(nodes);
+   free(seqs);
+   free(qrys);
+   free(queries);
+   free(bhits);
+
+}
+
+
+void
+test_search_batch
+(void)
+// Test 'search_batch()' against 'search()'.
+{
+
+   compare_search_batch(16);
+
+   // Check error message.
+   trie_t *trie = setup();
+   gstack_t **hits = new_tower(4);
+   test_assert_critical(hits != NULL);
+   redirect_stderr();
+   const char *too_long[] = {"AAAAAAAAAAAAAAAAAAAAA"};
+   test_assert(search_batch(trie, too_long, 1, 3, &hits) > 0);
+   unredirect_stderr();
+   test_assert_stderr("error: query longer than allowed max\n");
+   destroy_tower(hits);
+   teardown(trie);
+
+}
+
+
+void
+test_search_fixed
+(void)
+// Test 'poucet_fixed()' (fixed-length sequences are searched
+// without PAD logic) against 'search_batch()'.
+{
+   compare_search_batch(20);
+}
+
+
+void
+test_search_split
+(void)
+// Test 'search_split()' against 'search()'.
+{
+
+   srand48(123);
+
+   const int nseq = 2000;
+   trie_t *trie = new_trie(20);
+   trie_t *rtrie = new_trie(20);
+   test_assert_critical(trie != NULL && rtrie != NULL);
+   char (*seqs)[21] = calloc(nseq, 21);
+   if (seqs == NULL) {
+      fprintf(stderr, "unittest error (%s:%d)\n", __FILE__, __LINE__);
+      exit(EXIT_FAILURE);
+   }
+   for (int i = 0 ; i < nseq ; i++) {
+      char reversed[21] = {0};
+      for (int j = 0 ; j < 20 ; j++) {
+         seqs[i][j] = reversed[19-j] = untranslate[(int)(1 + 4*drand48())];
+      }
+      void **data = insert_string(trie, seqs[i]);
+      void **rdata = insert_string(rtrie, reversed);
+      test_assert_critical(data != NULL && rdata != NULL);
+      *data = *rdata = seqs[i];
+   }
+
+   // Queries are mutated sequences (substitutions and indels that
+   // keep the length).
+   gstack_t **hits = new_tower(5);
+   gstack_t **shits = new_tower(5);
+   test_assert_critical(hits != NULL && shits != NULL);
+   for (int i = 0 ; i < 300 ; i++) {
+      char query[21];
+      strcpy(query, seqs[(int)(nseq * drand48())]);
+      for (int e = 0 ; e < i % 5 ; e++) {
+         int pos = (int)(20 * drand48());
+         char c = untranslate[(int)(1 + 4*drand48())];
+         if (e % 2 == 0) {
+            query[pos] = c;
+         }
+         else {
+            // Delete at 'pos' and insert at the end or the start.
+            memmove(query+pos, query+pos+1, 19-pos);
+            if (drand48() < .5) {
+               query[19] = c;
+            }
+            else {
+               memmove(query+1, query, 19);
+               query[0] = c;
+            }
+         }
+      }
+      for (int tau = 0 ; tau < 5 ; tau++) {
+         reset_gstack(hits);
+         reset_gstack(shits);
+         test_assert(search(trie, query, tau, hits, 0, 0) == 0);
+         test_assert(search_split(trie, rtrie, query, tau, shits,
+                  0, 0) == 0);
+         for (int d = 0 ; d <= tau ; d++) {
+            test_assert(shits[d]->nitems == hits[d]->nitems);
+            for (int j = 0 ; j < shits[d]->nitems ; j++) {
+               int found = 0;
+               for (int k = 0 ; k < hits[d]->nitems ; k++) {
+                  found |= hits[d]->items[k] == shits[d]->items[j];
+               }
+               test_assert(found);
+            }
+         }
+      }
+   }
+
+   // Check error message.
+   redirect_stderr();
+   test_assert(search_split(trie, rtrie, "AAAA", 3, hits, 0, 0) > 0);
+   unredirect_stderr();
+   test_assert_stderr("error: split search requires length 20\n");
+
+   destroy_tower(hits);
+   destroy_tower(shits);
+   destroy_trie(trie, DESTROY_NODES_YES, NULL);
+   destroy_trie(rtrie, DESTROY_NODES_YES, NULL);
+   free(seqs);
+
+}
+
+
+int
+band_distance
+(
+   const char * a,
+   const char * b,
+   const int    n,
+   const int    band
+)
+// Levenshtein distance between 'a' and 'b' (both of length 'n')
+// restricted to the 'band' diagonals on either side of the center.
+{
+   int D[21][21];
+   for (int i = 0 ; i <= n ; i++) {
+      for (int j = 0 ; j <= n ; j++) {
+         if (abs(i-j) > band) D[i][j] = 99;
+         else if (i == 0 || j == 0) D[i][j] = i + j;
+         else {
+            int d = D[i-1][j-1] + (a[i-1] != b[j-1]);
+            d = min(d, D[i-1][j] + 1);
+            D[i][j] = min(d, D[i][j-1] + 1);
+         }
+      }
+   }
+   return D[n][n];
+}
+
+
+void
+test_search_band
+(void)
+// Test 'search_band()' against a naive banded alignment.
+{
+
+   srand48(123);
+
+   const int nseq = 1000;
+   trie_t *trie = new_trie(20);
+   test_assert_critical(trie != NULL);
+   char (*seqs)[21] = calloc(nseq, 21);
+   if (seqs == NULL) {
+      fprintf(stderr, "unittest error (%s:%d)\n", __FILE__, __LINE__);
+      exit(EXIT_FAILURE);
+   }
+   for (int i = 0 ; i < nseq ; i++) {
+      for (int j = 0 ; j < 20 ; j++) {
+         seqs[i][j] = untranslate[(int)(1 + 4*drand48())];
+      }
+      void **data = insert_string(trie, seqs[i]);
+      test_assert_critical(data != NULL);
+      *data = seqs[i];
+   }
+
+   gstack_t **hits = new_tower(9);
+   test_assert_critical(hits != NULL);
+   for (int i = 0 ; i < 100 ; i++) {
+      char query[21];
+      strcpy(query, seqs[(int)(nseq * drand48())]);
+      for (int e = 0 ; e < i % 7 ; e++) {
+         int pos = (int)(20 * drand48());
+         char c = untranslate[(int)(1 + 4*drand48())];
+         if (e % 3 != 2) {
+            query[pos] = c;
+         }
+         else {
+            memmove(query+pos, query+pos+1, 19-pos);
+            query[19] = c;
+         }
+      }
+      for (int tau = 0 ; tau < 9 ; tau++) {
+      for (int indels = 0 ; indels <= 2 ; indels++) {
+         reset_gstack(hits);
+         test_assert(search_band(trie, query, tau, indels, hits,
+                  0, 0) == 0);
+         int nhits = 0;
+         for (int d = 0 ; d <= tau ; d++) {
+            nhits += hits[d]->nitems;
+            for (int j = 0 ; j < hits[d]->nitems ; j++) {
+               const char *seq = (const char *) hits[d]->items[j];
+               test_assert(band_distance(seq, query, 20, indels) == d);
+            }
+         }
+         int expected = 0;
+         for (int j = 0 ; j < nseq ; j++) {
+            expected += band_distance(seqs[j], query, 20, indels) <= tau;
+         }
+         test_assert(nhits == expected);
+      }
+      }
+   }
+
+   // Check error messages.
+   redirect_stderr();
+   test_assert(search_band(trie, "AAAA", 3, 1, hits, 0, 0) > 0);
+   unredirect_stderr();
+   test_assert_stderr("error: band search requires length 20\n");
+   redirect_stderr();
+   test_assert(search_band(trie, seqs[0], 3, -1, hits, 0, 0) > 0);
+   unredirect_stderr();
+   test_assert_stderr("error: negative number of indels\n");
+
+   destroy_tower(hits);
+   destroy_trie(trie, DESTROY_NODES_YES, NULL);
+   free(seqs);
+
+}
+
+
 void
 test_mem_1
 (void)
@@ -1668,8 +2042,13 @@ const test_case_t test_cases_trie[] = {
       {"trie/base/6", test_base_6},
       {"trie/base/7", test_base_7},
       {"trie/base/8", test_base_8},
+      {"trie/base/9", test_base_9},
       {"errmsg",      test_errmsg},
       {"search",      test_search},
+      {"search/batch", test_search_batch},
+      {"search/fixed", test_search_fixed},
+      {"search/split", test_search_split},
+      {"search/band", test_search_band},
       {"mem/1",       test_mem_1},
       {"mem/2",       test_mem_2},
       {"mem/3",       test_mem_3},